@@ -14,6 +14,8 @@ function randomx_request(url, data, content) {
 const hashes = 10000;
 const hashingBlob = Buffer.from('4c0b0b98bea7e805e0010a2126d287a2a0cc833d312cb786385a7c2f9de69d25537f584a9bc9977b00000000666fd8753bf61a8631f12984e3fd44f4014eca629276817b56f32e9b68bd82f416', 'hex');
 const batchSize = 256;
+const requests = 1000;
+const pauseMs = 5;
 
 async function bechmark() {
 	let start = Date.now();
@@ -35,4 +37,50 @@ async function bechmark() {
 	console.log("Perf: " + 1000 * hashes / (end - start) + " H/s");
 }
 
-bechmark();
+//the service iterates the nonces itself, so only the blob is sent
+async function mine() {
+	let start = Date.now();
+	for (let nonce = 0; nonce < hashes; nonce += batchSize) {
+		let count = hashes - nonce < batchSize ? hashes - nonce : batchSize;
+		var res = await fetch('http://localhost:39093/mine?start=' + nonce + '&count=' + count, {
+			method: 'POST',
+			body: hashingBlob,
+			headers: {
+				"Content-Type": 'application/x.randomx+bin',
+				"RandomX-Difficulty": '1000'
+			}
+		});
+		if (res.status != 200)
+			throw Error("Unexpected status: HTTP " + res.status);
+		let result = await res.json();
+		console.log("batch: " + result.hashes + ", hits: " + result.hits.length);
+	}
+	let end = Date.now();
+	console.log("Perf: " + 1000 * hashes / (end - start) + " H/s");
+}
+
+//single hashes with a pause between them, so the workers are idle when each connection arrives
+async function latency() {
+	let times = [];
+	for (let i = 0; i < requests; ++i) {
+		hashingBlob.writeUInt32LE(i, 39);
+		let start = process.hrtime.bigint();
+		var res = await randomx_request('http://localhost:39093/hash', hashingBlob, 'application/x.randomx+bin');
+		await res.buffer();
+		times.push(Number(process.hrtime.bigint() - start) / 1000);
+		if (res.status != 200)
+			throw Error("Unexpected status: HTTP " + res.status);
+		await new Promise(resolve => setTimeout(resolve, pauseMs));
+	}
+	times.sort((a, b) => a - b);
+	let mean = times.reduce((a, b) => a + b, 0) / times.length;
+	let percentile = p => times[Math.min(times.length - 1, Math.floor(times.length * p))];
+	console.log("Latency: mean " + mean.toFixed(0) + " us, p50 " + percentile(0.5).toFixed(0) + " us, p99 " + percentile(0.99).toFixed(0) + " us");
+}
+
+if (process.argv[2] == 'latency')
+	latency();
+else if (process.argv[2] == 'mine')
+	mine();
+else
+	bechmark();
@@ -0,0 +1,196 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "autotune.h"
+#include "cpu_topology.h"
+#include "../RandomX/src/randomx.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <cstdlib>
+
+namespace randomx {
+
+	constexpr int TunedFlags = (int)RANDOMX_FLAG_JIT | (int)RANDOMX_FLAG_HARD_AES;
+	constexpr uint64_t ScratchpadSize = 2 * 1024 * 1024;
+
+	bool parseTuneObjective(const std::string& name, TuneObjective& objective) {
+		if (name == "hashrate") {
+			objective = TuneObjective::Hashrate;
+		}
+		else if (name == "latency") {
+			objective = TuneObjective::Latency;
+		}
+		else {
+			return false;
+		}
+		return true;
+	}
+
+	const char* getTuneObjectiveName(TuneObjective objective) {
+		return objective == TuneObjective::Latency ? "latency" : "hashrate";
+	}
+
+	std::vector<int> getTuneFlags(int flags) {
+		int supported = randomx_get_flags() & TunedFlags;
+		int base = flags & ~TunedFlags;
+		std::vector<int> result;
+		//the subsets of the supported flags, starting with all of them
+		for (int subset = supported; ; subset = (subset - 1) & supported) {
+			result.push_back(base | subset);
+			if (subset == 0) {
+				break;
+			}
+		}
+		return result;
+	}
+
+#if defined(__linux__)
+	static uint64_t getL3Size(const std::vector<CpuInfo>& cpus) {
+		std::set<std::string> caches;
+		uint64_t total = 0;
+		for (auto& cpu : cpus) {
+			auto path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu.cpu) + "/cache/index3/";
+			std::ifstream sharedFile(path + "shared_cpu_map");
+			std::ifstream sizeFile(path + "size");
+			std::string shared, size;
+			if (!(sharedFile >> shared) || !(sizeFile >> size) || !caches.insert(shared).second) {
+				continue;
+			}
+			//e.g. "32768K"
+			uint64_t bytes = std::strtoull(size.c_str(), nullptr, 10);
+			if (size.back() == 'K') {
+				bytes <<= 10;
+			}
+			else if (size.back() == 'M') {
+				bytes <<= 20;
+			}
+			total += bytes;
+		}
+		return total;
+	}
+#else
+	static uint64_t getL3Size(const std::vector<CpuInfo>& cpus) {
+		return 0;
+	}
+#endif
+
+	std::vector<unsigned> getTuneThreads(unsigned maxThreads) {
+		auto cpus = getCpuTopology();
+		std::set<int> cores;
+		for (auto& cpu : cpus) {
+			cores.insert(cpu.core);
+		}
+		std::set<unsigned> candidates = { maxThreads, std::max(maxThreads / 2, 1u) };
+		if (!cores.empty()) {
+			candidates.insert(std::min<unsigned>(cores.size(), maxThreads));
+		}
+		auto cacheThreads = getL3Size(cpus) / ScratchpadSize;
+		if (cacheThreads > 0) {
+			candidates.insert((unsigned)std::min<uint64_t>(cacheThreads, maxThreads));
+		}
+		return std::vector<unsigned>(candidates.rbegin(), candidates.rend());
+	}
+
+	TuneResult selectTuneResult(const std::vector<TuneResult>& results, TuneObjective objective) {
+		if (objective == TuneObjective::Hashrate) {
+			return *std::max_element(results.begin(), results.end(), [](const TuneResult& a, const TuneResult& b) {
+				return a.hashrate < b.hashrate;
+			});
+		}
+		auto best = *std::min_element(results.begin(), results.end(), [](const TuneResult& a, const TuneResult& b) {
+			return a.latency < b.latency;
+		});
+		for (auto& result : results) {
+			if (result.latency <= best.latency * 1.1 && (result.threads > best.threads ||
+				(result.threads == best.threads && result.latency < best.latency))) {
+				best = result;
+			}
+		}
+		return best;
+	}
+
+	static std::string getCpuModel() {
+		std::ifstream f("/proc/cpuinfo");
+		std::string line;
+		while (std::getline(f, line)) {
+			if (line.compare(0, 10, "model name") == 0) {
+				auto pos = line.find(": ");
+				if (pos != std::string::npos) {
+					return line.substr(pos + 2);
+				}
+			}
+		}
+		return "unknown";
+	}
+
+	std::string getTuneKey(unsigned maxThreads, int flags, TuneObjective objective) {
+		std::stringstream key;
+		key << getCpuModel() << ", " << maxThreads << " threads, flags " << (flags & ~TunedFlags) << ", " << getTuneObjectiveName(objective);
+		return key.str();
+	}
+
+	bool loadTuneFile(const std::string& path, const std::string& key, TuneResult& result) {
+		std::ifstream f(path);
+		std::string line, fileKey;
+		bool hasThreads = false, hasFlags = false;
+		while (std::getline(f, line)) {
+			auto pos = line.find(' ');
+			if (pos == std::string::npos) {
+				continue;
+			}
+			auto name = line.substr(0, pos);
+			auto value = line.substr(pos + 1);
+			if (name == "key") {
+				fileKey = value;
+			}
+			else if (name == "threads") {
+				result.threads = std::strtoul(value.c_str(), nullptr, 10);
+				hasThreads = result.threads > 0;
+			}
+			else if (name == "flags") {
+				result.flags = std::atoi(value.c_str());
+				hasFlags = true;
+			}
+		}
+		return fileKey == key && hasThreads && hasFlags;
+	}
+
+	bool saveTuneFile(const std::string& path, const std::string& key, const TuneResult& result) {
+		std::ofstream f(path, std::ios::trunc);
+		f << "key " << key << "\n";
+		f << "threads " << result.threads << "\n";
+		f << "flags " << result.flags << "\n";
+		f << "hashrate " << result.hashrate << "\n";
+		f << "latency " << result.latency << "\n";
+		return (bool)f.flush();
+	}
+
+}
@@ -0,0 +1,68 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace randomx {
+
+	enum class TuneObjective {
+		Hashrate,
+		Latency
+	};
+
+	bool parseTuneObjective(const std::string& name, TuneObjective& objective);
+	const char* getTuneObjectiveName(TuneObjective objective);
+
+	struct TuneResult {
+		unsigned threads;
+		int flags;
+		double hashrate;
+		//average duration of one hash in microseconds
+		double latency;
+	};
+
+	//Returns the flags with every combination of JIT and hard AES that is supported by the CPU.
+	std::vector<int> getTuneFlags(int flags);
+
+	//Returns the thread counts that are calibrated: all threads, one thread per physical core,
+	//one thread per 2 MiB of L3 cache and half of the threads.
+	std::vector<unsigned> getTuneThreads(unsigned maxThreads);
+
+	//With the latency objective, the highest thread count within 10% of the lowest latency is selected.
+	TuneResult selectTuneResult(const std::vector<TuneResult>& results, TuneObjective objective);
+
+	//The result is only reused with the same CPU model, maximum number of threads, flags and objective.
+	std::string getTuneKey(unsigned maxThreads, int flags, TuneObjective objective);
+	bool loadTuneFile(const std::string& path, const std::string& key, TuneResult& result);
+	bool saveTuneFile(const std::string& path, const std::string& key, const TuneResult& result);
+
+}
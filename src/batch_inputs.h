@@ -0,0 +1,105 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+namespace randomx {
+
+	//The inputs of a batch. A template batch has one blob and a list or a range of nonces. Each nonce
+	//is written into a copy of the blob just before it is hashed, so the inputs are never materialized.
+	class BatchInputs {
+	public:
+		BatchInputs() : isTemplate_(false), nonceOffset_(0), nonceSize_(0), start_(0), count_(0) {}
+
+		void add(std::vector<char>&& input) {
+			inputs_.push_back(std::move(input));
+		}
+
+		//nonces contains count little-endian nonces of nonceSize bytes; if it's empty, the nonces are start, start + 1, ...
+		void setTemplate(std::vector<char>&& blob, size_t nonceOffset, size_t nonceSize, std::string&& nonces, uint64_t start, size_t count) {
+			isTemplate_ = true;
+			blob_ = std::move(blob);
+			nonceOffset_ = nonceOffset;
+			nonceSize_ = nonceSize;
+			nonces_ = std::move(nonces);
+			start_ = start;
+			count_ = count;
+		}
+
+		size_t size() const {
+			return isTemplate_ ? count_ : inputs_.size();
+		}
+
+		uint64_t nonce(size_t i) const {
+			if (nonces_.empty()) {
+				return start_ + i;
+			}
+			uint64_t nonce = 0;
+			for (size_t j = nonceSize_; j > 0; --j) {
+				nonce = (nonce << 8) | (uint8_t)nonces_[i * nonceSize_ + j - 1];
+			}
+			return nonce;
+		}
+
+		//Returns the i-th input. A template input is written into buffer, so each thread needs its own
+		//buffer and the input is valid until the buffer is used again.
+		const std::vector<char>& get(size_t i, std::vector<char>& buffer) const {
+			if (!isTemplate_) {
+				return inputs_[i];
+			}
+			if (buffer.size() != blob_.size()) {
+				buffer = blob_;
+			}
+			if (!nonces_.empty()) {
+				memcpy(&buffer[nonceOffset_], &nonces_[i * nonceSize_], nonceSize_);
+			}
+			else {
+				uint64_t nonce = start_ + i;
+				for (size_t j = 0; j < nonceSize_; ++j) {
+					buffer[nonceOffset_ + j] = (char)(nonce >> (8 * j));
+				}
+			}
+			return buffer;
+		}
+	private:
+		std::vector<std::vector<char>> inputs_;
+		bool isTemplate_;
+		std::vector<char> blob_;
+		size_t nonceOffset_;
+		size_t nonceSize_;
+		std::string nonces_;
+		uint64_t start_;
+		size_t count_;
+	};
+
+}
@@ -0,0 +1,139 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "bulk_job.h"
+#include <algorithm>
+
+namespace randomx {
+
+	const char* getJobStateName(JobState state) {
+		switch (state) {
+		case JobState::Queued:
+			return "queued";
+		case JobState::Running:
+			return "running";
+		case JobState::Done:
+			return "done";
+		case JobState::Cancelled:
+			return "cancelled";
+		default:
+			return "failed";
+		}
+	}
+
+	BulkJob::BulkJob(const std::string& id, BatchInputs&& inputs, const std::string& seed, bool lowPriority) :
+		id_(id),
+		inputs_(std::move(inputs)),
+		seed_(seed),
+		lowPriority_(lowPriority),
+		results_(inputs_.size() * HashSize),
+		state_(JobState::Queued),
+		nextChunk_(0),
+		chunksDone_((inputs_.size() + ChunkSize - 1) / ChunkSize),
+		done_(0)
+	{
+	}
+
+	bool BulkJob::claimChunk(size_t& begin, size_t& end) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (!isActive() || nextChunk_ == chunksDone_.size()) {
+			return false;
+		}
+		if (state_ == JobState::Queued) {
+			state_ = JobState::Running;
+			started_ = std::chrono::steady_clock::now();
+		}
+		begin = nextChunk_ * ChunkSize;
+		end = std::min(begin + ChunkSize, inputs_.size());
+		nextChunk_++;
+		return true;
+	}
+
+	void BulkJob::finishChunk(size_t begin, size_t end) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		chunksDone_[begin / ChunkSize] = true;
+		done_ += end - begin;
+		if (done_ == inputs_.size() && state_ == JobState::Running) {
+			finish(JobState::Done);
+		}
+	}
+
+	void BulkJob::fail(const std::string& error) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (isActive()) {
+			error_ = error;
+			finish(JobState::Failed);
+		}
+	}
+
+	void BulkJob::cancel() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (isActive()) {
+			finish(JobState::Cancelled);
+		}
+	}
+
+	void BulkJob::finish(JobState state) {
+		state_ = state;
+		finished_ = std::chrono::steady_clock::now();
+		if (nextChunk_ == 0) {
+			started_ = finished_;
+		}
+	}
+
+	JobStatus BulkJob::getStatus() const {
+		std::unique_lock<std::mutex> lock(mutex_);
+		JobStatus status;
+		status.state = state_;
+		status.error = error_;
+		status.hashes = inputs_.size();
+		status.done = done_;
+		status.seconds = 0;
+		if (state_ != JobState::Queued) {
+			auto end = isActive() ? std::chrono::steady_clock::now() : finished_;
+			status.seconds = std::chrono::duration<double>(end - started_).count();
+		}
+		return status;
+	}
+
+	size_t BulkJob::getAvailable(size_t offset, size_t count) const {
+		std::unique_lock<std::mutex> lock(mutex_);
+		size_t end = std::min(offset + count, inputs_.size());
+		size_t i = offset;
+		while (i < end && chunksDone_[i / ChunkSize]) {
+			i = std::min((i / ChunkSize + 1) * ChunkSize, end);
+		}
+		return i > offset ? i - offset : 0;
+	}
+
+	bool BulkJob::isExpired(std::chrono::steady_clock::time_point now, std::chrono::seconds ttl) const {
+		std::unique_lock<std::mutex> lock(mutex_);
+		return !isActive() && now - finished_ > ttl;
+	}
+
+}
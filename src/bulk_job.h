@@ -0,0 +1,122 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "batch_inputs.h"
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+namespace randomx {
+
+	enum class JobState {
+		Queued,
+		Running,
+		Done,
+		Cancelled,
+		Failed
+	};
+
+	const char* getJobStateName(JobState state);
+
+	struct JobStatus {
+		JobState state;
+		std::string error;
+		size_t hashes;
+		size_t done;
+		//since the first chunk was started (until the job finished)
+		double seconds;
+	};
+
+	//A large batch that is calculated by the workers in chunks in the background.
+	//The hashes are kept until the job is deleted or expires.
+	class BulkJob {
+	public:
+		static const size_t ChunkSize = 64;
+		static const size_t HashSize = 32;
+
+		BulkJob(const std::string& id, BatchInputs&& inputs, const std::string& seed, bool lowPriority);
+
+		const std::string& getId() const {
+			return id_;
+		}
+		const std::string& getSeed() const {
+			return seed_;
+		}
+		bool isLowPriority() const {
+			return lowPriority_;
+		}
+		const BatchInputs& getInputs() const {
+			return inputs_;
+		}
+		size_t size() const {
+			return inputs_.size();
+		}
+
+		//claims the inputs [begin, end); returns false if there is nothing left to calculate
+		bool claimChunk(size_t& begin, size_t& end);
+		//the hash of input i of a claimed chunk must be written here
+		char* getResult(size_t i) {
+			return &results_[i * HashSize];
+		}
+		void finishChunk(size_t begin, size_t end);
+		void fail(const std::string& error);
+		void cancel();
+		JobStatus getStatus() const;
+		//the number of calculated hashes starting with offset (at most count)
+		size_t getAvailable(size_t offset, size_t count) const;
+		//only valid for the hashes reported by getAvailable
+		const char* getResult(size_t i) const {
+			return &results_[i * HashSize];
+		}
+		bool isExpired(std::chrono::steady_clock::time_point now, std::chrono::seconds ttl) const;
+	private:
+		bool isActive() const {
+			return state_ == JobState::Queued || state_ == JobState::Running;
+		}
+		void finish(JobState state);
+
+		std::string id_;
+		BatchInputs inputs_;
+		std::string seed_;
+		bool lowPriority_;
+		std::vector<char> results_;
+		mutable std::mutex mutex_;
+		JobState state_;
+		std::string error_;
+		size_t nextChunk_;
+		std::vector<bool> chunksDone_;
+		size_t done_;
+		std::chrono::steady_clock::time_point started_;
+		std::chrono::steady_clock::time_point finished_;
+	};
+
+}
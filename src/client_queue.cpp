@@ -0,0 +1,332 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "client_queue.h"
+#include <algorithm>
+#include <cmath>
+
+namespace randomx {
+
+	//the waiting connections of a client that are checked for an earlier deadline
+	constexpr size_t maxScannedJobs = 64;
+	//the counters of inactive clients are discarded when more clients are tracked
+	constexpr size_t maxClients = 4096;
+
+	bool parseClientIdentity(const std::string& name, ClientIdentity& identity) {
+		if (name == "listener") {
+			identity = ClientIdentity::Listener;
+		}
+		else if (name == "address") {
+			identity = ClientIdentity::Address;
+		}
+		else if (name == "key") {
+			identity = ClientIdentity::Key;
+		}
+		else {
+			return false;
+		}
+		return true;
+	}
+
+	const char* getClientIdentityName(ClientIdentity identity) {
+		switch (identity) {
+		case ClientIdentity::Address:
+			return "address";
+		case ClientIdentity::Key:
+			return "key";
+		default:
+			return "listener";
+		}
+	}
+
+	//reads the timeout and the client key of a waiting connection once its headers have arrived
+	static bool peekJob(PendingJob& job) {
+		if (!job.peeked) {
+			httplib::RequestInfo info;
+			if (job.task.peek && !job.task.peek(info)) {
+				return false;
+			}
+			job.peeked = true;
+			if (info.timeout > 0) {
+				job.deadline = job.enqueued + std::chrono::milliseconds(std::min(info.timeout, httplib::max_request_timeout));
+			}
+			job.key = info.client;
+		}
+		return true;
+	}
+
+	ClientQueue::ClientQueue(const std::string& listener) :
+		listener_(listener),
+		size_(0)
+	{
+	}
+
+	void ClientQueue::setLimits(const ClientLimits& limits) {
+		limits_ = limits;
+		for (auto& client : clients_) {
+			client.second.tokens = std::max(limits_.hashrate, 1.0);
+		}
+	}
+
+	std::string ClientQueue::getClientId(const PendingJob& job) const {
+		switch (limits_.identity) {
+		case ClientIdentity::Address:
+			return job.task.remote_addr;
+		case ClientIdentity::Key:
+			//clients without a key are identified by their address
+			return job.key.empty() ? job.task.remote_addr : "key:" + job.key;
+		default:
+			return listener_;
+		}
+	}
+
+	ClientState& ClientQueue::getClient(const std::string& id) {
+		auto it = clients_.find(id);
+		if (it != clients_.end()) {
+			return it->second;
+		}
+		if (clients_.size() >= maxClients) {
+			for (auto c = clients_.begin(); c != clients_.end();) {
+				if (c->second.connections == 0) {
+					c = clients_.erase(c);
+				}
+				else {
+					++c;
+				}
+			}
+		}
+		auto& client = clients_[id];
+		client.id = id;
+		client.scheduled = false;
+		client.deficit = 0;
+		client.connections = 0;
+		client.tokens = std::max(limits_.hashrate, 1.0);
+		client.refilled = std::chrono::steady_clock::now();
+		client.requests = 0;
+		client.hashes = 0;
+		client.rejected = 0;
+		return client;
+	}
+
+	void ClientQueue::push(PendingJob job, std::vector<Rejection>& rejected) {
+		if (limits_.identity == ClientIdentity::Key && !peekJob(job)) {
+			unclassified_.push_back(std::move(job));
+			size_++;
+			return;
+		}
+		auto& client = getClient(getClientId(job));
+		schedule(client, std::move(job), rejected);
+	}
+
+	void ClientQueue::schedule(ClientState& client, PendingJob job, std::vector<Rejection>& rejected) {
+		if (limits_.connections > 0 && client.connections >= limits_.connections && job.task.reject) {
+			client.rejected++;
+			rejected.push_back({ job.task.reject, 429, 1 });
+			return;
+		}
+		client.connections++;
+		client.jobs.push_back(std::move(job));
+		size_++;
+		if (!client.scheduled) {
+			client.scheduled = true;
+			ring_.push_back(&client);
+		}
+	}
+
+	void ClientQueue::unschedule(ClientState& client) {
+		ring_.remove(&client);
+		client.scheduled = false;
+		//unused turns are not saved for later
+		client.deficit = std::min<int64_t>(client.deficit, 0);
+	}
+
+	void ClientQueue::classify(std::vector<Rejection>& rejected) {
+		size_t scanned = 0;
+		for (auto it = unclassified_.begin(); it != unclassified_.end() && scanned < maxScannedJobs; ++scanned) {
+			if (!peekJob(*it)) {
+				++it;
+				continue;
+			}
+			auto job = std::move(*it);
+			it = unclassified_.erase(it);
+			size_--;
+			auto& client = getClient(getClientId(job));
+			schedule(client, std::move(job), rejected);
+		}
+	}
+
+	bool ClientQueue::pop(PendingJob& job, ClientState*& client, std::vector<Rejection>& rejected) {
+		auto now = std::chrono::steady_clock::now();
+		classify(rejected);
+		for (;;) {
+			if (ring_.empty()) {
+				if (unclassified_.empty()) {
+					return false;
+				}
+				//the headers have not arrived yet, so the worker will wait for them
+				auto first = std::move(unclassified_.front());
+				unclassified_.pop_front();
+				size_--;
+				first.peeked = true;
+				auto& owner = getClient(getClientId(first));
+				schedule(owner, std::move(first), rejected);
+				continue;
+			}
+			//the client with the largest deficit is served; ties are resolved in round-robin order
+			auto next = ring_.begin();
+			for (auto it = ring_.begin(); it != ring_.end(); ++it) {
+				if ((*it)->deficit > (*next)->deficit) {
+					next = it;
+				}
+			}
+			auto& owner = **next;
+			if (owner.deficit <= 0) {
+				//a new round: all waiting clients get the same quantum
+				auto quantum = 1 - owner.deficit;
+				for (auto other : ring_) {
+					other->deficit += quantum;
+				}
+			}
+			//the connections of the client are served earliest deadline first
+			auto best = owner.jobs.end();
+			size_t scanned = 0;
+			for (auto it = owner.jobs.begin(); it != owner.jobs.end() && scanned < maxScannedJobs; ++scanned) {
+				peekJob(*it);
+				if (it->deadline <= now && it->task.reject) {
+					rejected.push_back({ it->task.reject, 504, 0 });
+					owner.connections--;
+					size_--;
+					it = owner.jobs.erase(it);
+					continue;
+				}
+				if (best == owner.jobs.end() || it->deadline < best->deadline) {
+					best = it;
+				}
+				++it;
+			}
+			if (best == owner.jobs.end()) {
+				if (owner.jobs.empty()) {
+					unschedule(owner);
+				}
+				continue;
+			}
+			job = std::move(*best);
+			owner.jobs.erase(best);
+			size_--;
+			client = &owner;
+			ring_.erase(next);
+			if (owner.jobs.empty()) {
+				owner.scheduled = false;
+				owner.deficit = std::min<int64_t>(owner.deficit, 0);
+			}
+			else {
+				ring_.push_back(&owner);
+			}
+			return true;
+		}
+	}
+
+	bool ClientQueue::dropLongest(PendingJob& job) {
+		std::list<PendingJob>* longest = unclassified_.empty() ? nullptr : &unclassified_;
+		ClientState* owner = nullptr;
+		for (auto client : ring_) {
+			if (longest == nullptr || client->jobs.size() > longest->size()) {
+				longest = &client->jobs;
+				owner = client;
+			}
+		}
+		if (longest == nullptr || !longest->front().task.reject) {
+			return false;
+		}
+		job = std::move(longest->front());
+		longest->pop_front();
+		size_--;
+		if (owner != nullptr) {
+			owner->connections--;
+			if (owner->jobs.empty()) {
+				unschedule(*owner);
+			}
+		}
+		return true;
+	}
+
+	std::chrono::steady_clock::time_point ClientQueue::getOldest() const {
+		auto oldest = std::chrono::steady_clock::now();
+		if (!unclassified_.empty()) {
+			oldest = std::min(oldest, unclassified_.front().enqueued);
+		}
+		for (auto client : ring_) {
+			oldest = std::min(oldest, client->jobs.front().enqueued);
+		}
+		return oldest;
+	}
+
+	void ClientQueue::finish(ClientState* client) {
+		client->connections--;
+	}
+
+	bool ClientQueue::checkQuota(ClientState* client, int& retryAfter) {
+		if (limits_.hashrate <= 0) {
+			return true;
+		}
+		auto now = std::chrono::steady_clock::now();
+		double elapsed = std::chrono::duration<double>(now - client->refilled).count();
+		client->refilled = now;
+		//the bucket holds one second worth of hashes
+		client->tokens = std::min(client->tokens + elapsed * limits_.hashrate, std::max(limits_.hashrate, 1.0));
+		if (client->tokens >= 1) {
+			return true;
+		}
+		client->rejected++;
+		retryAfter = std::max((int)std::ceil((1 - client->tokens) / limits_.hashrate), 1);
+		return false;
+	}
+
+	void ClientQueue::charge(ClientState* client, uint64_t hashes) {
+		client->requests++;
+		client->hashes += hashes;
+		client->deficit -= hashes;
+		//the quota may be exceeded by one request, which delays the next one
+		client->tokens -= hashes;
+	}
+
+	std::vector<ClientUsage> ClientQueue::getUsage() const {
+		std::vector<ClientUsage> usage;
+		for (auto& entry : clients_) {
+			auto& client = entry.second;
+			std::string id = client.id;
+			//API keys are not disclosed; at most a quarter of a key (and no more than 4 characters) is shown
+			if (id.compare(0, 4, "key:") == 0) {
+				id = id.substr(0, 4 + std::min<size_t>((id.size() - 4) / 4, 4)) + "...";
+			}
+			usage.push_back({ id, client.connections, client.jobs.size(), client.requests, client.hashes, client.rejected });
+		}
+		return usage;
+	}
+
+}
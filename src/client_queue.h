@@ -0,0 +1,152 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "task_queue.h"
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+namespace randomx {
+
+	struct ServiceWorker;
+
+	//how the clients that share the workers fairly are identified; by default,
+	//all connections to the listening port of a partition are one client
+	enum class ClientIdentity {
+		Listener,
+		Address,
+		Key
+	};
+
+	bool parseClientIdentity(const std::string& name, ClientIdentity& identity);
+	const char* getClientIdentityName(ClientIdentity identity);
+
+	struct ClientLimits {
+		ClientIdentity identity = ClientIdentity::Listener;
+		//queued and running connections per client (0 = unlimited)
+		unsigned connections = 0;
+		//hashes per second per client (0 = unlimited)
+		double hashrate = 0;
+	};
+
+	//a connection waiting for a worker
+	struct PendingJob {
+		httplib::Task<ServiceWorker> task;
+		std::chrono::steady_clock::time_point enqueued;
+		//time_point::max() if the request has no timeout or its headers have not been received yet
+		std::chrono::steady_clock::time_point deadline;
+		bool peeked;
+		std::string key;
+	};
+
+	//a connection that is answered without a worker
+	struct Rejection {
+		std::function<void(int, int)> reject;
+		int status;
+		int retryAfter;
+	};
+
+	struct ClientState {
+		std::string id;
+		std::list<PendingJob> jobs;
+		//true if the client is in the round-robin list
+		bool scheduled;
+		//hashes the client may calculate before it's the other clients' turn
+		int64_t deficit;
+		unsigned connections;
+		double tokens;
+		std::chrono::steady_clock::time_point refilled;
+		uint64_t requests;
+		uint64_t hashes;
+		uint64_t rejected;
+	};
+
+	struct ClientUsage {
+		std::string client;
+		unsigned connections;
+		size_t queued;
+		uint64_t requests;
+		uint64_t hashes;
+		uint64_t rejected;
+	};
+
+	//The queue of a partition. Clients are served by deficit round robin: each client is
+	//charged for the hashes it has calculated and the client with the largest deficit gets
+	//the next worker, so the workers are shared by the number of hashes rather than by the
+	//number of connections. The connections of one client are served earliest deadline first.
+	//Not thread-safe; the pool guards it with its mutex.
+	class ClientQueue {
+	public:
+		ClientQueue(const std::string& listener);
+
+		void setLimits(const ClientLimits& limits);
+		const ClientLimits& getLimits() const {
+			return limits_;
+		}
+		size_t size() const {
+			return size_;
+		}
+
+		void push(PendingJob job, std::vector<Rejection>& rejected);
+		//returns false if there is no connection to serve; expired connections are rejected
+		bool pop(PendingJob& job, ClientState*& client, std::vector<Rejection>& rejected);
+		//removes the oldest connection of the client with the most waiting connections
+		bool dropLongest(PendingJob& job);
+		std::chrono::steady_clock::time_point getOldest() const;
+
+		//called when the connection of a client is closed
+		void finish(ClientState* client);
+		//returns false if the client has exceeded its hash rate quota
+		bool checkQuota(ClientState* client, int& retryAfter);
+		void charge(ClientState* client, uint64_t hashes);
+
+		std::vector<ClientUsage> getUsage() const;
+
+	private:
+		std::string getClientId(const PendingJob& job) const;
+		ClientState& getClient(const std::string& id);
+		void schedule(ClientState& client, PendingJob job, std::vector<Rejection>& rejected);
+		void unschedule(ClientState& client);
+		void classify(std::vector<Rejection>& rejected);
+
+		std::string listener_;
+		ClientLimits limits_;
+		std::map<std::string, ClientState> clients_;
+		std::list<ClientState*> ring_;
+		//connections whose client key has not been received yet
+		std::list<PendingJob> unclassified_;
+		size_t size_;
+	};
+
+}
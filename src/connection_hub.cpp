@@ -0,0 +1,343 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "connection_hub.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+//the sockets are non-blocking on Windows instead
+#ifndef MSG_DONTWAIT
+#define MSG_DONTWAIT 0
+#endif
+
+namespace randomx {
+
+	//a client that doesn't read its responses can't block a worker for long
+	constexpr std::chrono::seconds SendTimeout(10);
+
+	static bool wouldBlock() {
+#ifdef _WIN32
+		return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+		return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+	}
+
+	//sends as much as the socket buffer takes; returns false if the connection is broken
+	static bool sendAvailable(socket_t sock, const char* data, size_t size, size_t& sent) {
+		sent = 0;
+		while (sent < size) {
+			auto n = ::send(sock, data + sent, static_cast<int>(size - sent), MSG_DONTWAIT);
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n < 0 && wouldBlock()) {
+				return true;
+			}
+			if (n <= 0) {
+				return false;
+			}
+			sent += n;
+		}
+		return true;
+	}
+
+	HubConnection::HubConnection(ConnectionHub& hub, socket_t sock, unsigned maxPending) :
+		hub_(hub),
+		sock_(sock),
+		maxPending_(maxPending),
+		queued_(false),
+		closed_(false),
+		pending_(0),
+		stalled_(false)
+	{
+#ifdef _WIN32
+		//the hub must never wait for a socket, and there is no MSG_DONTWAIT
+		u_long nonBlocking = 1;
+		ioctlsocket(sock_, FIONBIO, &nonBlocking);
+#endif
+	}
+
+	HubConnection::~HubConnection() {
+		httplib::detail::close_socket(sock_);
+	}
+
+	void HubConnection::finish() {
+		if (pending_.fetch_sub(1) == maxPending_) {
+			hub_.wake();
+		}
+	}
+
+	bool HubConnection::write(const std::string& data, bool wait) {
+		std::unique_lock<std::mutex> lock(writeMutex_);
+		if (closed_) {
+			return false;
+		}
+		//queued output must be sent first
+		size_t sent = 0;
+		bool ok = !output_.empty() || sendAvailable(sock_, data.data(), data.size(), sent);
+		if (ok && sent < data.size()) {
+			ok = output_.size() + data.size() - sent <= MaxOutput;
+			if (ok) {
+				output_.append(data, sent, std::string::npos);
+				if (!queued_.exchange(true)) {
+					hub_.wake();
+				}
+			}
+		}
+		if (!ok) {
+			lock.unlock();
+			shutdown();
+			return false;
+		}
+		lock.unlock();
+		return !wait || waitOutput();
+	}
+
+	bool HubConnection::waitOutput() {
+		std::unique_lock<std::mutex> lock(writeMutex_);
+		if (!writeCond_.wait_for(lock, SendTimeout, [this] { return output_.empty() || closed_; })) {
+			lock.unlock();
+			shutdown();
+			return false;
+		}
+		return !closed_;
+	}
+
+	bool HubConnection::accepting() {
+		if (pending_.load() >= maxPending_) {
+			stalled_ = true;
+			return false;
+		}
+		return true;
+	}
+
+	//the socket is closed when the last reference to the connection is released
+	void HubConnection::shutdown() {
+		if (!closed_.exchange(true)) {
+			httplib::detail::shutdown_socket(sock_);
+			hub_.wake();
+		}
+		//writers that wait for the queued output are released
+		std::unique_lock<std::mutex> lock(writeMutex_);
+		output_.clear();
+		writeCond_.notify_all();
+	}
+
+	ConnectionHub::ConnectionHub() :
+		stop_(false)
+	{
+		wakeFd_[0] = wakeFd_[1] = -1;
+#ifndef _WIN32
+		if (pipe(wakeFd_) == 0) {
+			fcntl(wakeFd_[0], F_SETFL, O_NONBLOCK);
+			fcntl(wakeFd_[1], F_SETFL, O_NONBLOCK);
+		}
+#endif
+	}
+
+	ConnectionHub::~ConnectionHub() {
+		stop();
+#ifndef _WIN32
+		if (wakeFd_[0] >= 0) {
+			::close(wakeFd_[0]);
+			::close(wakeFd_[1]);
+		}
+#endif
+	}
+
+	bool ConnectionHub::add(const std::shared_ptr<HubConnection>& connection) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (stop_ || connections_.size() >= MaxConnections) {
+			lock.unlock();
+			connection->shutdown();
+			return false;
+		}
+		connections_.push_back(connection);
+		if (!thread_.joinable()) {
+			thread_ = std::thread(&ConnectionHub::run, this);
+		}
+		lock.unlock();
+		wake();
+		return true;
+	}
+
+	std::vector<std::shared_ptr<HubConnection>> ConnectionHub::getConnections() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		return connections_;
+	}
+
+	size_t ConnectionHub::size() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		return connections_.size();
+	}
+
+	void ConnectionHub::stop() {
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		wake();
+		if (thread_.joinable()) {
+			thread_.join();
+		}
+		std::vector<std::shared_ptr<HubConnection>> connections;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			connections.swap(connections_);
+		}
+		for (auto& connection : connections) {
+			connection->goAway();
+		}
+	}
+
+	void ConnectionHub::wake() {
+#ifndef _WIN32
+		if (wakeFd_[1] >= 0) {
+			char byte = 0;
+			(void)!::write(wakeFd_[1], &byte, 1);
+		}
+#endif
+	}
+
+	void ConnectionHub::run() {
+		std::vector<pollfd> fds;
+		std::vector<std::shared_ptr<HubConnection>> polled, resumed;
+		for (;;) {
+			polled.clear();
+			resumed.clear();
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				if (stop_) {
+					break;
+				}
+				for (auto& connection : connections_) {
+					if (connection->pending_.load() < connection->maxPending_ && connection->stalled_) {
+						resumed.push_back(connection);
+					}
+					else if (connection->pending_.load() < connection->maxPending_ || connection->queued_) {
+						polled.push_back(connection);
+					}
+				}
+			}
+			//input that was received while the connection had too many pending requests
+			for (auto& connection : resumed) {
+				connection->stalled_ = false;
+				if (!connection->parse(connection)) {
+					remove(connection);
+				}
+				else if (!connection->stalled_ || connection->queued_) {
+					polled.push_back(connection);
+				}
+			}
+			fds.clear();
+#ifndef _WIN32
+			if (wakeFd_[0] >= 0) {
+				fds.push_back({ wakeFd_[0], POLLIN, 0 });
+			}
+#endif
+			size_t first = fds.size();
+			for (auto& connection : polled) {
+				//a connection with too many pending requests is only polled to send its output
+				bool reading = connection->pending_.load() < connection->maxPending_ && !connection->stalled_;
+				short events = (reading ? POLLIN : 0) | (connection->queued_ ? POLLOUT : 0);
+				fds.push_back({ connection->sock_, events, 0 });
+			}
+#ifdef _WIN32
+			//there is no wake-up descriptor on Windows
+			int ready = WSAPoll(fds.data(), (ULONG)fds.size(), 100);
+#else
+			int ready = poll(fds.data(), fds.size(), -1);
+#endif
+			if (ready <= 0) {
+				continue;
+			}
+#ifndef _WIN32
+			if (first > 0 && (fds[0].revents & POLLIN)) {
+				char buffer[64];
+				while (::read(wakeFd_[0], buffer, sizeof(buffer)) > 0) {}
+			}
+#endif
+			for (size_t i = first; i < fds.size(); ++i) {
+				auto& connection = polled[i - first];
+				bool ok = !(fds[i].revents & POLLOUT) || flush(connection);
+				if (ok && (fds[i].revents & (POLLIN | POLLERR | POLLHUP | POLLNVAL))) {
+					//errors of a connection that isn't read are detected by sending
+					ok = (fds[i].events & POLLIN) ? receive(connection) : flush(connection);
+				}
+				if (!ok) {
+					remove(connection);
+				}
+			}
+		}
+	}
+
+	bool ConnectionHub::receive(const std::shared_ptr<HubConnection>& connection) {
+		char buffer[16384];
+		auto n = recv(connection->sock_, buffer, sizeof(buffer), 0);
+		if (n < 0 && (errno == EINTR || wouldBlock())) {
+			return true;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		connection->input_.append(buffer, n);
+		return connection->parse(connection);
+	}
+
+	bool ConnectionHub::flush(const std::shared_ptr<HubConnection>& connection) {
+		std::unique_lock<std::mutex> lock(connection->writeMutex_);
+		size_t sent = 0;
+		if (!sendAvailable(connection->sock_, connection->output_.data(), connection->output_.size(), sent)) {
+			return false;
+		}
+		connection->output_.erase(0, sent);
+		if (connection->output_.empty()) {
+			connection->queued_ = false;
+			connection->writeCond_.notify_all();
+		}
+		return true;
+	}
+
+	void ConnectionHub::remove(const std::shared_ptr<HubConnection>& connection) {
+		connection->shutdown();
+		std::unique_lock<std::mutex> lock(mutex_);
+		auto it = std::find(connections_.begin(), connections_.end(), connection);
+		if (it != connections_.end()) {
+			connections_.erase(it);
+		}
+	}
+
+}
@@ -0,0 +1,124 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <climits>
+#include "httplib.h"
+
+namespace randomx {
+
+	class ConnectionHub;
+
+	//A connection that has been taken over from the HTTP server, e.g. after an upgrade. Its input
+	//is read by the hub; the output may be written from any thread.
+	class HubConnection {
+	public:
+		//the hub doesn't read the connection while maxPending requests are unanswered
+		HubConnection(ConnectionHub& hub, socket_t sock, unsigned maxPending = UINT_MAX);
+		virtual ~HubConnection();
+		//must be called when a request passed on by the connection has been answered
+		void finish();
+		bool isClosed() const {
+			return closed_.load();
+		}
+	protected:
+		friend class ConnectionHub;
+
+		//Processes the data in input_ and removes what has been processed. Returns false if
+		//the connection must be closed.
+		virtual bool parse(const std::shared_ptr<HubConnection>& self) = 0;
+		//called when the hub is stopped
+		virtual void goAway() {
+			shutdown();
+		}
+		//The data that doesn't fit into the socket buffer is queued and sent by the hub when the
+		//socket is writable. With wait, the caller waits until the queue has been sent, so a slow
+		//client holds up its worker, but never the hub.
+		bool write(const std::string& data, bool wait);
+		//waits until the queued output has been sent
+		bool waitOutput();
+		//returns false and stops reading if too many requests are pending
+		bool accepting();
+		virtual void shutdown();
+
+		//the output that can be queued before the connection is closed
+		static const size_t MaxOutput = 67108864;
+
+		ConnectionHub& hub_;
+		socket_t sock_;
+		const unsigned maxPending_;
+		std::mutex writeMutex_;
+		std::condition_variable writeCond_;
+		std::string output_;
+		std::atomic<bool> queued_;
+		std::atomic<bool> closed_;
+		std::atomic<unsigned> pending_;
+		//the rest of the connection is only used by the hub thread
+		std::string input_;
+		bool stalled_;
+	};
+
+	//Reads all connections on one thread, which is started with the first connection.
+	class ConnectionHub {
+	public:
+		static const size_t MaxConnections = 1024;
+
+		ConnectionHub();
+		virtual ~ConnectionHub();
+		//returns false if there are too many connections; the connection is closed in that case
+		bool add(const std::shared_ptr<HubConnection>& connection);
+		std::vector<std::shared_ptr<HubConnection>> getConnections();
+		size_t size();
+		//closes all connections (see HubConnection::goAway)
+		void stop();
+	private:
+		friend class HubConnection;
+
+		void run();
+		void wake();
+		bool receive(const std::shared_ptr<HubConnection>& connection);
+		bool flush(const std::shared_ptr<HubConnection>& connection);
+		void remove(const std::shared_ptr<HubConnection>& connection);
+
+		std::mutex mutex_;
+		std::vector<std::shared_ptr<HubConnection>> connections_;
+		std::thread thread_;
+		bool stop_;
+		int wakeFd_[2];
+	};
+
+}
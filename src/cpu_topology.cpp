@@ -0,0 +1,173 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "cpu_topology.h"
+#include <algorithm>
+#include <map>
+#include <string>
+#include <fstream>
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <cstring>
+#include <cstdlib>
+#endif
+
+namespace randomx {
+
+	struct CpuOrder {
+		CpuInfo info;
+		int sibling;
+	};
+
+	static std::vector<CpuInfo> sortCpus(const std::vector<CpuInfo>& cpus) {
+		std::map<int, int> coreThreads;
+		std::vector<CpuOrder> order;
+		for (auto& cpu : cpus) {
+			order.push_back({ cpu, coreThreads[cpu.core]++ });
+		}
+		std::stable_sort(order.begin(), order.end(), [](const CpuOrder& a, const CpuOrder& b) {
+			if (a.sibling != b.sibling) {
+				return a.sibling < b.sibling;
+			}
+			return a.info.node < b.info.node;
+		});
+		std::vector<CpuInfo> result;
+		for (auto& cpu : order) {
+			result.push_back(cpu.info);
+		}
+		return result;
+	}
+
+#if defined(__linux__)
+	static int readSysInt(const std::string& path, int defaultValue) {
+		std::ifstream f(path);
+		int value;
+		if (f >> value) {
+			return value;
+		}
+		return defaultValue;
+	}
+
+	static int getCpuNode(int cpu) {
+		auto path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+		auto* dir = opendir(path.c_str());
+		int node = 0;
+		if (dir != nullptr) {
+			while (auto* entry = readdir(dir)) {
+				if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+					node = atoi(entry->d_name + 4);
+					break;
+				}
+			}
+			closedir(dir);
+		}
+		return node;
+	}
+
+	std::vector<CpuInfo> getCpuTopology() {
+		std::vector<CpuInfo> cpus;
+		cpu_set_t set;
+		if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+			return cpus;
+		}
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			if (!CPU_ISSET(cpu, &set)) {
+				continue;
+			}
+			auto topology = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+			int package = readSysInt(topology + "physical_package_id", 0);
+			int core = readSysInt(topology + "core_id", cpu);
+			cpus.push_back({ cpu, (package << 16) | core, getCpuNode(cpu) });
+		}
+		return sortCpus(cpus);
+	}
+
+	bool setThreadAffinity(std::thread& thread, int cpu) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+	}
+#elif defined(_WIN32)
+	std::vector<CpuInfo> getCpuTopology() {
+		std::vector<CpuInfo> cpus;
+		DWORD_PTR processMask, systemMask;
+		if (!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) {
+			return cpus;
+		}
+		DWORD length = 0;
+		GetLogicalProcessorInformation(nullptr, &length);
+		std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+		if (info.empty() || !GetLogicalProcessorInformation(info.data(), &length)) {
+			return cpus;
+		}
+		int maxCpu = sizeof(DWORD_PTR) * 8;
+		std::vector<int> cores(maxCpu, -1), nodes(maxCpu, 0);
+		int coreIndex = 0;
+		for (auto& item : info) {
+			for (int cpu = 0; cpu < maxCpu; ++cpu) {
+				if (!(item.ProcessorMask & ((DWORD_PTR)1 << cpu))) {
+					continue;
+				}
+				if (item.Relationship == RelationProcessorCore) {
+					cores[cpu] = coreIndex;
+				}
+				else if (item.Relationship == RelationNumaNode) {
+					nodes[cpu] = (int)item.NumaNode.NodeNumber;
+				}
+			}
+			if (item.Relationship == RelationProcessorCore) {
+				coreIndex++;
+			}
+		}
+		for (int cpu = 0; cpu < maxCpu; ++cpu) {
+			if (processMask & ((DWORD_PTR)1 << cpu)) {
+				cpus.push_back({ cpu, cores[cpu] >= 0 ? cores[cpu] : maxCpu + cpu, nodes[cpu] });
+			}
+		}
+		return sortCpus(cpus);
+	}
+
+	bool setThreadAffinity(std::thread& thread, int cpu) {
+		return SetThreadAffinityMask(thread.native_handle(), (DWORD_PTR)1 << cpu) != 0;
+	}
+#else
+	std::vector<CpuInfo> getCpuTopology() {
+		return std::vector<CpuInfo>();
+	}
+
+	bool setThreadAffinity(std::thread& thread, int cpu) {
+		return false;
+	}
+#endif
+
+}
@@ -0,0 +1,230 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "dataset_file.h"
+#include "service.h"
+#include "../RandomX/src/randomx.h"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace randomx {
+
+	static const char datasetFileMagic[8] = { 'R', 'X', 'D', 'A', 'T', 'A', 'S', 'E' };
+	static const uint32_t datasetFileVersion = 1;
+	static const size_t datasetFileChunk = 1024 * 1024;
+
+	class Checksum {
+	public:
+		Checksum() : a_{ 0 }, b_{ 0 } {}
+		//size must be a multiple of 32 bytes
+		void update(const void* data, size_t size) {
+			auto* words = (const uint64_t*)data;
+			for (size_t i = 0; i < size / sizeof(uint64_t); i += 4) {
+				for (int j = 0; j < 4; ++j) {
+					a_[j] += words[i + j];
+					b_[j] += a_[j];
+				}
+			}
+		}
+		uint64_t digest() const {
+			uint64_t h = 0;
+			for (int j = 0; j < 4; ++j) {
+				h = (h ^ a_[j]) * 0x100000001b3ULL;
+				h = (h ^ b_[j]) * 0x100000001b3ULL;
+			}
+			return h;
+		}
+	private:
+		uint64_t a_[4];
+		uint64_t b_[4];
+	};
+
+	static uint64_t getDatasetSize() {
+		return (uint64_t)randomx_dataset_item_count() * RANDOMX_DATASET_ITEM_SIZE;
+	}
+
+	static bool checkHeader(const DatasetFileHeader& header) {
+		return memcmp(header.magic, datasetFileMagic, sizeof(datasetFileMagic)) == 0
+			&& header.formatVersion == datasetFileVersion
+			&& header.itemSize == RANDOMX_DATASET_ITEM_SIZE
+			&& header.itemCount == randomx_dataset_item_count()
+			&& strncmp(header.algorithm, SERVICE_ALGORITHM, sizeof(header.algorithm)) == 0
+			&& header.seedSize <= sizeof(header.seed);
+	}
+
+	static bool matchSeed(const DatasetFileHeader& header, const void* seed, size_t seedSize) {
+		return header.seedSize == seedSize && memcmp(header.seed, seed, seedSize) == 0;
+	}
+
+	DatasetFile::DatasetFile(const std::string& dir) : dir_(dir) {
+	}
+
+	std::string DatasetFile::getSlotPath(int slot) const {
+		return dir_ + "/randomx-dataset." + std::to_string(slot);
+	}
+
+	bool DatasetFile::readHeader(int slot, DatasetFileHeader& header) const {
+		auto* f = fopen(getSlotPath(slot).c_str(), "rb");
+		if (f == nullptr) {
+			return false;
+		}
+		bool ok = fread(&header, sizeof(header), 1, f) == 1 && checkHeader(header);
+		fclose(f);
+		return ok;
+	}
+
+	bool DatasetFile::load(const void* seed, size_t seedSize, randomx_dataset* dataset) const {
+		DatasetFileHeader header;
+		int slot = 0;
+		while (slot < DatasetFileSlots && !(readHeader(slot, header) && matchSeed(header, seed, seedSize))) {
+			slot++;
+		}
+		if (slot == DatasetFileSlots) {
+			return false;
+		}
+		auto path = getSlotPath(slot);
+		auto datasetSize = getDatasetSize();
+		auto* memory = (uint8_t*)randomx_get_dataset_memory(dataset);
+		Checksum checksum;
+#ifdef _WIN32
+		auto* f = fopen(path.c_str(), "rb");
+		if (f == nullptr) {
+			return false;
+		}
+		bool ok = _fseeki64(f, DatasetFileAlignment, SEEK_SET) == 0;
+		for (uint64_t pos = 0; ok && pos < datasetSize; pos += datasetFileChunk) {
+			auto chunk = (size_t)std::min<uint64_t>(datasetFileChunk, datasetSize - pos);
+			ok = fread(memory + pos, chunk, 1, f) == 1;
+			checksum.update(memory + pos, chunk);
+		}
+		fclose(f);
+		if (!ok) {
+			return false;
+		}
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < DatasetFileAlignment + datasetSize) {
+			close(fd);
+			return false;
+		}
+		auto mapSize = (size_t)(DatasetFileAlignment + datasetSize);
+		auto* mapped = (uint8_t*)mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (mapped == MAP_FAILED) {
+			return false;
+		}
+		madvise(mapped, mapSize, MADV_SEQUENTIAL);
+		//the header may have been replaced since it was read
+		bool ok = memcmp(mapped, &header, sizeof(header)) == 0;
+		for (uint64_t pos = 0; ok && pos < datasetSize; pos += datasetFileChunk) {
+			auto chunk = (size_t)std::min<uint64_t>(datasetFileChunk, datasetSize - pos);
+			memcpy(memory + pos, mapped + DatasetFileAlignment + pos, chunk);
+			checksum.update(memory + pos, chunk);
+		}
+		munmap(mapped, mapSize);
+		if (!ok) {
+			return false;
+		}
+#endif
+		return checksum.digest() == header.checksum;
+	}
+
+	bool DatasetFile::save(const void* seed, size_t seedSize, randomx_dataset* dataset) const {
+		DatasetFileHeader header;
+		if (seedSize > sizeof(header.seed)) {
+			return false;
+		}
+		//reuse an empty slot or the slot with the oldest dataset
+		int slot = 0;
+		uint64_t oldest = UINT64_MAX;
+		for (int i = 0; i < DatasetFileSlots; ++i) {
+			if (!readHeader(i, header)) {
+				slot = i;
+				break;
+			}
+			if (header.timestamp < oldest) {
+				oldest = header.timestamp;
+				slot = i;
+			}
+		}
+		memset(&header, 0, sizeof(header));
+		header.formatVersion = datasetFileVersion;
+		header.itemSize = RANDOMX_DATASET_ITEM_SIZE;
+		header.itemCount = randomx_dataset_item_count();
+		strncpy(header.algorithm, SERVICE_ALGORITHM, sizeof(header.algorithm));
+		header.timestamp = (uint64_t)time(nullptr);
+		header.seedSize = (uint32_t)seedSize;
+		memcpy(header.seed, seed, seedSize);
+
+		auto path = getSlotPath(slot);
+		auto tmpPath = path + ".tmp";
+		auto* f = fopen(tmpPath.c_str(), "wb");
+		if (f == nullptr) {
+			return false;
+		}
+		//the magic is written last, so an incomplete file is never accepted
+		std::vector<char> padding(DatasetFileAlignment - sizeof(header));
+		bool ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(padding.data(), padding.size(), 1, f) == 1;
+		auto datasetSize = getDatasetSize();
+		auto* memory = (const uint8_t*)randomx_get_dataset_memory(dataset);
+		Checksum checksum;
+		for (uint64_t pos = 0; ok && pos < datasetSize; pos += datasetFileChunk) {
+			auto chunk = (size_t)std::min<uint64_t>(datasetFileChunk, datasetSize - pos);
+			checksum.update(memory + pos, chunk);
+			ok = fwrite(memory + pos, chunk, 1, f) == 1;
+		}
+		memcpy(header.magic, datasetFileMagic, sizeof(datasetFileMagic));
+		header.checksum = checksum.digest();
+		ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1;
+		ok = (fclose(f) == 0) && ok;
+#ifdef _WIN32
+		if (ok) {
+			remove(path.c_str());
+		}
+#endif
+		if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+			remove(tmpPath.c_str());
+			return false;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,67 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+struct randomx_dataset;
+
+namespace randomx {
+
+	//the dataset starts at this offset in the file, so the file can be mapped with huge pages
+	constexpr uint64_t DatasetFileAlignment = 2 * 1024 * 1024;
+	//the files for the current and the previous seed are kept
+	constexpr int DatasetFileSlots = 2;
+
+	struct DatasetFileHeader {
+		char magic[8];
+		uint32_t formatVersion;
+		uint32_t itemSize;
+		uint64_t itemCount;
+		char algorithm[8];
+		uint64_t timestamp;
+		uint64_t checksum;
+		uint32_t seedSize;
+		char seed[60];
+	};
+
+	class DatasetFile {
+	public:
+		DatasetFile(const std::string& dir);
+		bool load(const void* seed, size_t seedSize, randomx_dataset* dataset) const;
+		bool save(const void* seed, size_t seedSize, randomx_dataset* dataset) const;
+		std::string getSlotPath(int slot) const;
+	private:
+		bool readHeader(int slot, DatasetFileHeader& header) const;
+		std::string dir_;
+	};
+
+}
@@ -0,0 +1,178 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "dataset_memory.h"
+#include "dataset_wrapper.h"
+#include <cstdint>
+#if defined(__linux__)
+#include <sys/mman.h>
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#endif
+
+namespace randomx {
+
+	bool parsePageStrategy(const std::string& name, PageStrategy& strategy) {
+		if (name == "1g" || name == "auto") {
+			strategy = PageStrategy::Huge1G;
+		}
+		else if (name == "2m") {
+			strategy = PageStrategy::Huge2M;
+		}
+		else if (name == "thp") {
+			strategy = PageStrategy::Transparent;
+		}
+		else if (name == "4k") {
+			strategy = PageStrategy::Small;
+		}
+		else {
+			return false;
+		}
+		return true;
+	}
+
+	const char* getPageStrategyName(PageStrategy strategy) {
+		switch (strategy) {
+		case PageStrategy::Huge1G:
+			return "1g";
+		case PageStrategy::Huge2M:
+			return "2m";
+		case PageStrategy::Transparent:
+			return "thp";
+		default:
+			return "4k";
+		}
+	}
+
+#if defined(__linux__)
+	constexpr size_t PageSize1G = 1024 * 1024 * 1024;
+	constexpr size_t PageSize2M = 2 * 1024 * 1024;
+
+	static size_t getMappingSize(size_t pageSize) {
+		size_t size = (size_t)randomx_dataset_item_count() * RANDOMX_DATASET_ITEM_SIZE;
+		return (size + pageSize - 1) / pageSize * pageSize;
+	}
+
+	template<size_t PageSize>
+	static void unmapDataset(randomx_dataset* dataset) {
+		munmap(randomx_get_dataset_memory(dataset), getMappingSize(PageSize));
+	}
+
+	static void* mapHugePages(size_t pageSize, int pageShift) {
+		auto* memory = mmap(nullptr, getMappingSize(pageSize), PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (pageShift << MAP_HUGE_SHIFT), -1, 0);
+		return memory != MAP_FAILED ? memory : nullptr;
+	}
+
+	//transparent huge pages are only used for 2 MiB aligned memory
+	static void* mapTransparent() {
+		size_t size = getMappingSize(PageSize2M);
+		auto* memory = (uint8_t*)mmap(nullptr, size + PageSize2M, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED) {
+			return nullptr;
+		}
+		auto offset = (PageSize2M - (uintptr_t)memory % PageSize2M) % PageSize2M;
+		if (offset > 0) {
+			munmap(memory, offset);
+		}
+		munmap(memory + offset + size, PageSize2M - offset);
+		if (madvise(memory + offset, size, MADV_HUGEPAGE) != 0) {
+			munmap(memory + offset, size);
+			return nullptr;
+		}
+		return memory + offset;
+	}
+
+	static void* mapSmall() {
+		auto* memory = mmap(nullptr, getMappingSize(PageSize2M), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return memory != MAP_FAILED ? memory : nullptr;
+	}
+
+	randomx_dataset* allocDataset(PageStrategy& strategy, randomx_flags flags) {
+		void* memory = nullptr;
+		DatasetRelease release = &unmapDataset<PageSize2M>;
+		switch (strategy) {
+		case PageStrategy::Huge1G:
+			if ((memory = mapHugePages(PageSize1G, 30)) != nullptr) {
+				release = &unmapDataset<PageSize1G>;
+				break;
+			}
+			strategy = PageStrategy::Huge2M;
+			//fall through
+		case PageStrategy::Huge2M:
+			if ((memory = mapHugePages(PageSize2M, 21)) != nullptr) {
+				break;
+			}
+			strategy = PageStrategy::Transparent;
+			//fall through
+		case PageStrategy::Transparent:
+			if ((memory = mapTransparent()) != nullptr) {
+				break;
+			}
+			strategy = PageStrategy::Small;
+			//fall through
+		default:
+			memory = mapSmall();
+		}
+		if (memory == nullptr) {
+			return nullptr;
+		}
+		return wrapDataset(memory, release);
+	}
+
+	bool lockMemory(randomx_dataset* dataset, randomx_cache* cache) {
+		bool ok = true;
+		if (dataset != nullptr) {
+			auto size = (size_t)randomx_dataset_item_count() * RANDOMX_DATASET_ITEM_SIZE;
+			ok = mlock(randomx_get_dataset_memory(dataset), size) == 0;
+		}
+		if (cache != nullptr && getCacheMemory(cache) != nullptr) {
+			ok = mlock(getCacheMemory(cache), getCacheSize()) == 0 && ok;
+		}
+		return ok;
+	}
+#else
+	randomx_dataset* allocDataset(PageStrategy& strategy, randomx_flags flags) {
+		randomx_dataset* dataset = nullptr;
+		if (strategy != PageStrategy::Small) {
+			dataset = randomx_alloc_dataset((randomx_flags)(flags | RANDOMX_FLAG_LARGE_PAGES));
+			strategy = PageStrategy::Huge2M;
+		}
+		if (dataset == nullptr) {
+			dataset = randomx_alloc_dataset((randomx_flags)(flags & ~RANDOMX_FLAG_LARGE_PAGES));
+			strategy = PageStrategy::Small;
+		}
+		return dataset;
+	}
+
+	bool lockMemory(randomx_dataset* dataset, randomx_cache* cache) {
+		return false;
+	}
+#endif
+}
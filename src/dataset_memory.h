@@ -0,0 +1,55 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <string>
+#include "../RandomX/src/randomx.h"
+
+namespace randomx {
+
+	//The page sizes that are tried for the dataset, starting with the configured one.
+	enum class PageStrategy {
+		Huge1G,
+		Huge2M,
+		Transparent,
+		Small
+	};
+
+	bool parsePageStrategy(const std::string& name, PageStrategy& strategy);
+	const char* getPageStrategyName(PageStrategy strategy);
+
+	//Allocates the dataset with the first page size that succeeds. The strategy
+	//is updated to the one that was used. The dataset is released with randomx_release_dataset.
+	randomx_dataset* allocDataset(PageStrategy& strategy, randomx_flags flags);
+
+	//Locks the dataset and the cache in memory. Either may be null. It's called after they have been
+	//initialized, so the pages are already faulted in by the threads that use them (NUMA first touch).
+	bool lockMemory(randomx_dataset* dataset, randomx_cache* cache);
+
+}
@@ -0,0 +1,53 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+
+#include "../RandomX/src/randomx.h"
+
+namespace randomx {
+
+	//RandomX can't create a dataset in memory allocated by the caller, so these functions fill in
+	//the internals of randomx_dataset (RandomX/src/dataset.hpp) and read those of randomx_cache. This is
+	//the only code that depends on them; it matches RandomX 1.1 and must be checked when the submodule is updated.
+
+	using DatasetRelease = void (*)(randomx_dataset* dataset);
+
+	//randomx_release_dataset calls the release function before it frees the dataset
+	randomx_dataset* wrapDataset(void* memory, DatasetRelease release);
+	//replaces the memory of a wrapped dataset without releasing the old memory
+	void setDatasetMemory(randomx_dataset* dataset, void* memory);
+	//frees a wrapped dataset without releasing its memory
+	void freeDatasetWrapper(randomx_dataset* dataset);
+
+	//RandomX has no public function that returns the memory of the cache
+	void* getCacheMemory(randomx_cache* cache);
+	size_t getCacheSize();
+
+}
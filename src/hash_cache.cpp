@@ -0,0 +1,207 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "hash_cache.h"
+#include <algorithm>
+#include <random>
+#include <cstring>
+
+namespace randomx {
+
+	static void toWords(const char* data, size_t size, uint64_t* words, size_t count) {
+		memset(words, 0, count * sizeof(uint64_t));
+		memcpy(words, data, size);
+	}
+
+	static std::string getFlightKey(uint64_t generation, const char* input, size_t size) {
+		std::string key((const char*)&generation, sizeof(generation));
+		key.append(input, size);
+		return key;
+	}
+
+	HashCache::HashCache(size_t capacity) :
+		sets_(std::max<size_t>((capacity + Shards * Ways - 1) / (Shards * Ways), 1)),
+		salt_(std::random_device()()),
+		generation_(0),
+		lookups_(0),
+		hits_(0),
+		merged_(0),
+		duplicates_(0)
+	{
+		for (auto& shard : shards_) {
+			shard.entries.reset(new Entry[sets_ * Ways]);
+			for (size_t i = 0; i < sets_ * Ways; ++i) {
+				shard.entries[i].sequence.store(0);
+				shard.entries[i].tag.store(0);
+			}
+		}
+	}
+
+	HashCache::~HashCache() {
+	}
+
+	//FNV-1a with a random salt, so clients can't choose inputs that evict each other
+	uint64_t HashCache::getKey(uint64_t generation, const char* input, size_t size) const {
+		uint64_t key = 14695981039346656037ULL ^ salt_ ^ generation;
+		for (size_t i = 0; i < size; ++i) {
+			key = (key ^ (uint8_t)input[i]) * 1099511628211ULL;
+		}
+		return key ^ (key >> 29);
+	}
+
+	HashCache::Entry* HashCache::getSet(uint64_t key) {
+		auto& shard = shards_[key % Shards];
+		return &shard.entries[(key / Shards) % sets_ * Ways];
+	}
+
+	bool HashCache::find(uint64_t generation, const char* input, size_t size, char* hash) {
+		if (size > MaxInput) {
+			return false;
+		}
+		lookups_.fetch_add(1, std::memory_order_relaxed);
+		uint64_t words[InputWords];
+		toWords(input, size, words, InputWords);
+		uint64_t tag = (generation << 8) | (size + 1);
+		auto set = getSet(getKey(generation, input, size));
+		for (size_t way = 0; way < Ways; ++way) {
+			auto& entry = set[way];
+			uint64_t sequence = entry.sequence.load(std::memory_order_acquire);
+			if ((sequence & 1) || entry.tag.load(std::memory_order_relaxed) != tag) {
+				continue;
+			}
+			bool match = true;
+			for (size_t i = 0; i < InputWords && match; ++i) {
+				match = entry.input[i].load(std::memory_order_relaxed) == words[i];
+			}
+			uint64_t result[HashWords];
+			for (size_t i = 0; i < HashWords; ++i) {
+				result[i] = entry.hash[i].load(std::memory_order_relaxed);
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			//the entry was overwritten while it was read
+			if (!match || entry.sequence.load(std::memory_order_relaxed) != sequence) {
+				continue;
+			}
+			memcpy(hash, result, HashSize);
+			hits_.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+		return false;
+	}
+
+	void HashCache::insert(uint64_t generation, const char* input, size_t size, const char* hash) {
+		//the hash may have been calculated with the previous seed
+		if (size > MaxInput || generation != generation_.load()) {
+			return;
+		}
+		uint64_t words[InputWords];
+		toWords(input, size, words, InputWords);
+		uint64_t result[HashWords];
+		memcpy(result, hash, HashSize);
+		uint64_t tag = (generation << 8) | (size + 1);
+		auto key = getKey(generation, input, size);
+		auto& shard = shards_[key % Shards];
+		auto set = getSet(key);
+		std::unique_lock<std::mutex> lock(shard.mutex);
+		//an empty or outdated entry is replaced before the others take turns
+		Entry* target = nullptr;
+		for (size_t way = 0; way < Ways; ++way) {
+			uint64_t entryTag = set[way].tag.load(std::memory_order_relaxed);
+			if (entryTag == tag) {
+				bool match = true;
+				for (size_t i = 0; i < InputWords && match; ++i) {
+					match = set[way].input[i].load(std::memory_order_relaxed) == words[i];
+				}
+				//another thread has cached the same input
+				if (match) {
+					return;
+				}
+			}
+			if (target == nullptr && (entryTag == 0 || (entryTag >> 8) != generation)) {
+				target = &set[way];
+			}
+		}
+		if (target == nullptr) {
+			target = &set[shard.victim++ % Ways];
+		}
+		uint64_t sequence = target->sequence.load(std::memory_order_relaxed);
+		target->sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		target->tag.store(tag, std::memory_order_relaxed);
+		for (size_t i = 0; i < InputWords; ++i) {
+			target->input[i].store(words[i], std::memory_order_relaxed);
+		}
+		for (size_t i = 0; i < HashWords; ++i) {
+			target->hash[i].store(result[i], std::memory_order_relaxed);
+		}
+		target->sequence.store(sequence + 2, std::memory_order_release);
+	}
+
+	bool HashCache::acquire(uint64_t generation, const char* input, size_t size, char* hash, std::chrono::steady_clock::time_point deadline) {
+		auto& shard = shards_[getKey(generation, input, size) % Shards];
+		auto key = getFlightKey(generation, input, size);
+		std::unique_lock<std::mutex> lock(shard.mutex);
+		auto it = shard.flights.find(key);
+		if (it == shard.flights.end()) {
+			shard.flights.emplace(std::move(key), std::make_shared<Flight>());
+			return false;
+		}
+		auto flight = it->second;
+		if (!shard.cond.wait_until(lock, deadline, [&] { return flight->done; })) {
+			return false;
+		}
+		memcpy(hash, flight->hash, HashSize);
+		merged_.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	void HashCache::release(uint64_t generation, const char* input, size_t size, const char* hash) {
+		insert(generation, input, size, hash);
+		auto& shard = shards_[getKey(generation, input, size) % Shards];
+		std::unique_lock<std::mutex> lock(shard.mutex);
+		auto it = shard.flights.find(getFlightKey(generation, input, size));
+		if (it != shard.flights.end()) {
+			memcpy(it->second->hash, hash, HashSize);
+			it->second->done = true;
+			shard.flights.erase(it);
+			shard.cond.notify_all();
+		}
+	}
+
+	HashCacheStats HashCache::getStats() const {
+		HashCacheStats stats;
+		stats.capacity = sets_ * Ways * Shards;
+		stats.lookups = lookups_.load();
+		stats.hits = hits_.load();
+		stats.merged = merged_.load();
+		stats.duplicates = duplicates_.load();
+		return stats;
+	}
+
+}
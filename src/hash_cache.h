@@ -0,0 +1,123 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+namespace randomx {
+
+	struct HashCacheStats {
+		size_t capacity;
+		uint64_t lookups;
+		uint64_t hits;
+		//requests that waited for an identical request instead of calculating the hash
+		uint64_t merged;
+		//inputs that were repeated in the same batch
+		uint64_t duplicates;
+	};
+
+	//A bounded cache of recent hashes. The entries are tagged with a generation, which is
+	//incremented when the seed changes, so clearing the cache doesn't touch the entries.
+	//Lookups don't take locks: each entry is guarded by a sequence number, which is odd
+	//while the entry is written. Inputs longer than MaxInput bytes are not cached.
+	class HashCache {
+	public:
+		static const size_t MaxInput = 128;
+		static const size_t HashSize = 32;
+
+		HashCache(size_t capacity);
+		~HashCache();
+
+		uint64_t getGeneration() const {
+			return generation_.load();
+		}
+		void clear() {
+			generation_.fetch_add(1);
+		}
+		bool find(uint64_t generation, const char* input, size_t size, char* hash);
+		void insert(uint64_t generation, const char* input, size_t size, const char* hash);
+		//Merges identical requests: returns true with the hash if another thread has been calculating
+		//it, otherwise the caller must calculate the hash and pass it to release. The caller also
+		//calculates the hash itself if the other thread isn't done by the deadline.
+		bool acquire(uint64_t generation, const char* input, size_t size, char* hash, std::chrono::steady_clock::time_point deadline);
+		void release(uint64_t generation, const char* input, size_t size, const char* hash);
+		void countDuplicates(size_t count) {
+			duplicates_.fetch_add(count);
+		}
+		HashCacheStats getStats() const;
+	private:
+		static const size_t Ways = 4;
+		static const size_t Shards = 16;
+		static const size_t InputWords = MaxInput / 8;
+		static const size_t HashWords = HashSize / 8;
+
+		struct Entry {
+			std::atomic<uint64_t> sequence;
+			//the generation and the input size + 1 (0 for an empty entry)
+			std::atomic<uint64_t> tag;
+			std::atomic<uint64_t> input[InputWords];
+			std::atomic<uint64_t> hash[HashWords];
+		};
+
+		struct Flight {
+			bool done = false;
+			char hash[HashSize];
+		};
+
+		struct Shard {
+			std::unique_ptr<Entry[]> entries;
+			std::mutex mutex;
+			std::condition_variable cond;
+			size_t victim = 0;
+			std::map<std::string, std::shared_ptr<Flight>> flights;
+		};
+
+		uint64_t getKey(uint64_t generation, const char* input, size_t size) const;
+		Entry* getSet(uint64_t key);
+
+		size_t sets_;
+		uint64_t salt_;
+		std::atomic<uint64_t> generation_;
+		Shard shards_[Shards];
+		std::atomic<uint64_t> lookups_;
+		std::atomic<uint64_t> hits_;
+		std::atomic<uint64_t> merged_;
+		std::atomic<uint64_t> duplicates_;
+	};
+
+}
@@ -0,0 +1,396 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "hpack.h"
+
+namespace randomx {
+
+	struct StaticEntry {
+		const char* name;
+		const char* value;
+	};
+
+	static const StaticEntry staticTable[] = {
+		{ ":authority", "" },
+		{ ":method", "GET" },
+		{ ":method", "POST" },
+		{ ":path", "/" },
+		{ ":path", "/index.html" },
+		{ ":scheme", "http" },
+		{ ":scheme", "https" },
+		{ ":status", "200" },
+		{ ":status", "204" },
+		{ ":status", "206" },
+		{ ":status", "304" },
+		{ ":status", "400" },
+		{ ":status", "404" },
+		{ ":status", "500" },
+		{ "accept-charset", "" },
+		{ "accept-encoding", "gzip, deflate" },
+		{ "accept-language", "" },
+		{ "accept-ranges", "" },
+		{ "accept", "" },
+		{ "access-control-allow-origin", "" },
+		{ "age", "" },
+		{ "allow", "" },
+		{ "authorization", "" },
+		{ "cache-control", "" },
+		{ "content-disposition", "" },
+		{ "content-encoding", "" },
+		{ "content-language", "" },
+		{ "content-length", "" },
+		{ "content-location", "" },
+		{ "content-range", "" },
+		{ "content-type", "" },
+		{ "cookie", "" },
+		{ "date", "" },
+		{ "etag", "" },
+		{ "expect", "" },
+		{ "expires", "" },
+		{ "from", "" },
+		{ "host", "" },
+		{ "if-match", "" },
+		{ "if-modified-since", "" },
+		{ "if-none-match", "" },
+		{ "if-range", "" },
+		{ "if-unmodified-since", "" },
+		{ "last-modified", "" },
+		{ "link", "" },
+		{ "location", "" },
+		{ "max-forwards", "" },
+		{ "proxy-authenticate", "" },
+		{ "proxy-authorization", "" },
+		{ "range", "" },
+		{ "referer", "" },
+		{ "refresh", "" },
+		{ "retry-after", "" },
+		{ "server", "" },
+		{ "set-cookie", "" },
+		{ "strict-transport-security", "" },
+		{ "transfer-encoding", "" },
+		{ "user-agent", "" },
+		{ "vary", "" },
+		{ "via", "" },
+		{ "www-authenticate", "" },
+	};
+
+	static const size_t StaticTableSize = sizeof(staticTable) / sizeof(staticTable[0]);
+
+	struct HuffmanCode {
+		uint32_t code;
+		uint8_t bits;
+	};
+
+	//RFC 7541, Appendix B; the EOS symbol is not included, because it must not be decoded
+	static const HuffmanCode huffmanCodes[256] = {
+		{ 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 }, { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+		{ 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 }, { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+		{ 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 }, { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+		{ 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 }, { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+		{ 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 }, { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+		{ 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 }, { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+		{ 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 }, { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+		{ 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 }, { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+		{ 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 }, { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+		{ 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 }, { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+		{ 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 }, { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+		{ 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 }, { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+		{ 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 }, { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+		{ 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 }, { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+		{ 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 }, { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+		{ 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 }, { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+		{ 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 }, { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+		{ 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 }, { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+		{ 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 }, { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+		{ 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 }, { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+		{ 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 }, { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+		{ 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 }, { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+		{ 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 }, { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+		{ 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 }, { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+		{ 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 }, { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+		{ 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 }, { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+		{ 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 }, { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+		{ 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 }, { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+		{ 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 }, { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+		{ 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 }, { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+		{ 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 }, { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+		{ 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 }, { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+	};
+
+	//A binary tree of the Huffman codes: each node has two children, and a leaf has
+	//no children and the symbol.
+	class HuffmanTree {
+	public:
+		struct Node {
+			int child[2];
+			int symbol;
+		};
+
+		HuffmanTree() {
+			nodes_.push_back({ { 0, 0 }, -1 });
+			for (int symbol = 0; symbol < 256; ++symbol) {
+				int node = 0;
+				auto& code = huffmanCodes[symbol];
+				for (int bit = code.bits - 1; bit >= 0; --bit) {
+					int branch = (code.code >> bit) & 1;
+					if (nodes_[node].child[branch] == 0) {
+						nodes_[node].child[branch] = (int)nodes_.size();
+						nodes_.push_back({ { 0, 0 }, -1 });
+					}
+					node = nodes_[node].child[branch];
+				}
+				nodes_[node].symbol = symbol;
+			}
+		}
+
+		const Node& get(int node) const {
+			return nodes_[node];
+		}
+	private:
+		std::vector<Node> nodes_;
+	};
+
+	static bool decodeHuffman(const char* data, size_t size, std::string& out) {
+		static const HuffmanTree tree;
+		int node = 0;
+		int depth = 0;
+		bool ones = true;
+		for (size_t i = 0; i < size; ++i) {
+			uint8_t byte = data[i];
+			for (int bit = 7; bit >= 0; --bit) {
+				int branch = (byte >> bit) & 1;
+				node = tree.get(node).child[branch];
+				if (node == 0) {
+					//the EOS code or an invalid code
+					return false;
+				}
+				depth++;
+				ones = ones && branch == 1;
+				if (tree.get(node).symbol >= 0) {
+					out += (char)tree.get(node).symbol;
+					node = 0;
+					depth = 0;
+					ones = true;
+				}
+			}
+		}
+		//the padding is a prefix of the EOS code (all ones) shorter than 8 bits
+		return depth < 8 && ones;
+	}
+
+	static bool readInteger(const std::string& in, size_t& pos, int prefix, uint64_t& value) {
+		if (pos >= in.size()) {
+			return false;
+		}
+		uint64_t max = (1u << prefix) - 1;
+		value = (uint8_t)in[pos++] & max;
+		if (value < max) {
+			return true;
+		}
+		for (int shift = 0; shift <= 28 && pos < in.size(); shift += 7) {
+			uint8_t byte = in[pos++];
+			value += (uint64_t)(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static bool readString(const std::string& in, size_t& pos, std::string& out) {
+		if (pos >= in.size()) {
+			return false;
+		}
+		bool huffman = (in[pos] & 0x80) != 0;
+		uint64_t length;
+		if (!readInteger(in, pos, 7, length) || length > in.size() - pos) {
+			return false;
+		}
+		out.clear();
+		if (huffman) {
+			if (!decodeHuffman(in.data() + pos, (size_t)length, out)) {
+				return false;
+			}
+		}
+		else {
+			out.assign(in.data() + pos, (size_t)length);
+		}
+		pos += (size_t)length;
+		return true;
+	}
+
+	static void writeInteger(uint64_t value, int prefix, uint8_t flags, std::string& out) {
+		uint64_t max = (1u << prefix) - 1;
+		if (value < max) {
+			out += (char)(flags | value);
+			return;
+		}
+		out += (char)(flags | max);
+		value -= max;
+		while (value >= 0x80) {
+			out += (char)(value | 0x80);
+			value >>= 7;
+		}
+		out += (char)value;
+	}
+
+	static void writeString(const std::string& value, std::string& out) {
+		writeInteger(value.size(), 7, 0, out);
+		out += value;
+	}
+
+	//each entry takes 32 bytes in addition to its name and value
+	static size_t getEntrySize(const HeaderField& field) {
+		return field.name.size() + field.value.size() + 32;
+	}
+
+	HpackDecoder::HpackDecoder() :
+		tableSize_(0),
+		maxTableSize_(TableSize)
+	{
+	}
+
+	bool HpackDecoder::getField(uint64_t index, HeaderField& field) const {
+		if (index == 0) {
+			return false;
+		}
+		if (index <= StaticTableSize) {
+			field.name = staticTable[index - 1].name;
+			field.value = staticTable[index - 1].value;
+			return true;
+		}
+		index -= StaticTableSize + 1;
+		if (index >= table_.size()) {
+			return false;
+		}
+		field = table_[(size_t)index];
+		return true;
+	}
+
+	void HpackDecoder::evict(size_t maxSize) {
+		while (tableSize_ > maxSize) {
+			tableSize_ -= getEntrySize(table_.back());
+			table_.pop_back();
+		}
+	}
+
+	//an entry larger than the table empties it
+	void HpackDecoder::insert(const HeaderField& field) {
+		auto size = getEntrySize(field);
+		if (size > maxTableSize_) {
+			evict(0);
+			return;
+		}
+		evict(maxTableSize_ - size);
+		table_.push_front(field);
+		tableSize_ += size;
+	}
+
+	bool HpackDecoder::decode(const std::string& block, std::vector<HeaderField>& headers) {
+		size_t pos = 0;
+		size_t listSize = 0;
+		bool first = true;
+		while (pos < block.size()) {
+			uint8_t byte = block[pos];
+			HeaderField field;
+			uint64_t index;
+			if (byte & 0x80) {
+				//indexed field
+				if (!readInteger(block, pos, 7, index) || !getField(index, field)) {
+					return false;
+				}
+			}
+			else if ((byte & 0xe0) == 0x20) {
+				//dynamic table size updates must be at the start of the block
+				if (!first || !readInteger(block, pos, 5, index) || index > TableSize) {
+					return false;
+				}
+				maxTableSize_ = (size_t)index;
+				evict(maxTableSize_);
+				continue;
+			}
+			else {
+				//a literal field with incremental indexing (6-bit prefix), without indexing or never indexed (4-bit prefix)
+				bool indexing = (byte & 0xc0) == 0x40;
+				if (!readInteger(block, pos, indexing ? 6 : 4, index)) {
+					return false;
+				}
+				if (index > 0) {
+					if (!getField(index, field)) {
+						return false;
+					}
+				}
+				else if (!readString(block, pos, field.name)) {
+					return false;
+				}
+				if (!readString(block, pos, field.value)) {
+					return false;
+				}
+				if (indexing) {
+					insert(field);
+				}
+			}
+			first = false;
+			listSize += getEntrySize(field);
+			if (listSize > MaxHeaderList) {
+				return false;
+			}
+			headers.push_back(std::move(field));
+		}
+		return true;
+	}
+
+	void encodeHeaders(const std::vector<HeaderField>& headers, std::string& out) {
+		for (auto& field : headers) {
+			size_t nameIndex = 0;
+			size_t fieldIndex = 0;
+			for (size_t i = 0; i < StaticTableSize && fieldIndex == 0; ++i) {
+				if (field.name == staticTable[i].name) {
+					if (nameIndex == 0) {
+						nameIndex = i + 1;
+					}
+					if (field.value == staticTable[i].value) {
+						fieldIndex = i + 1;
+					}
+				}
+			}
+			if (fieldIndex > 0) {
+				writeInteger(fieldIndex, 7, 0x80, out);
+				continue;
+			}
+			//literal field without indexing
+			writeInteger(nameIndex, 4, 0x00, out);
+			if (nameIndex == 0) {
+				writeString(field.name, out);
+			}
+			writeString(field.value, out);
+		}
+	}
+
+}
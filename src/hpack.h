@@ -0,0 +1,70 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace randomx {
+
+	struct HeaderField {
+		std::string name;
+		std::string value;
+	};
+
+	//Decodes the header blocks of one HTTP/2 connection (RFC 7541), which share the dynamic table.
+	class HpackDecoder {
+	public:
+		//the table size advertised in SETTINGS_HEADER_TABLE_SIZE
+		static const size_t TableSize = 4096;
+		//the decoded headers of a block are limited, because indexed fields can repeat large entries
+		static const size_t MaxHeaderList = 262144;
+
+		HpackDecoder();
+		//returns false if the block can't be decoded, which is a connection error
+		bool decode(const std::string& block, std::vector<HeaderField>& headers);
+	private:
+		bool getField(uint64_t index, HeaderField& field) const;
+		void insert(const HeaderField& field);
+		void evict(size_t maxSize);
+
+		//the newest entry is first
+		std::deque<HeaderField> table_;
+		size_t tableSize_;
+		size_t maxTableSize_;
+	};
+
+	//Encodes a header block without the dynamic table and Huffman coding, so the blocks of different
+	//streams can be sent in any order.
+	void encodeHeaders(const std::vector<HeaderField>& headers, std::string& out);
+
+}
@@ -0,0 +1,854 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "http2.h"
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+
+#define FRAME_HEADER_SIZE (9)
+
+#define FRAME_DATA (0x0)
+#define FRAME_HEADERS (0x1)
+#define FRAME_PRIORITY (0x2)
+#define FRAME_RST_STREAM (0x3)
+#define FRAME_SETTINGS (0x4)
+#define FRAME_PUSH_PROMISE (0x5)
+#define FRAME_PING (0x6)
+#define FRAME_GOAWAY (0x7)
+#define FRAME_WINDOW_UPDATE (0x8)
+#define FRAME_CONTINUATION (0x9)
+
+#define FLAG_END_STREAM (0x1)
+#define FLAG_ACK (0x1)
+#define FLAG_END_HEADERS (0x4)
+#define FLAG_PADDED (0x8)
+#define FLAG_PRIORITY (0x20)
+
+#define SETTINGS_HEADER_TABLE_SIZE (0x1)
+#define SETTINGS_ENABLE_PUSH (0x2)
+#define SETTINGS_MAX_CONCURRENT_STREAMS (0x3)
+#define SETTINGS_INITIAL_WINDOW_SIZE (0x4)
+#define SETTINGS_MAX_FRAME_SIZE (0x5)
+#define SETTINGS_MAX_HEADER_LIST_SIZE (0x6)
+
+#define ERROR_NO_ERROR (0x0)
+#define ERROR_PROTOCOL (0x1)
+#define ERROR_FLOW_CONTROL (0x3)
+#define ERROR_STREAM_CLOSED (0x5)
+#define ERROR_FRAME_SIZE (0x6)
+#define ERROR_REFUSED_STREAM (0x7)
+#define ERROR_CANCEL (0x8)
+#define ERROR_COMPRESSION (0x9)
+#define ERROR_ENHANCE_YOUR_CALM (0xb)
+
+#define DEFAULT_WINDOW (65535)
+#define MAX_WINDOW (0x7fffffff)
+
+namespace randomx {
+
+	static uint32_t read32(const char* p) {
+		auto q = (const uint8_t*)p;
+		return (uint32_t)q[0] << 24 | (uint32_t)q[1] << 16 | (uint32_t)q[2] << 8 | q[3];
+	}
+
+	static void append32(std::string& out, uint32_t value) {
+		out += (char)(value >> 24);
+		out += (char)(value >> 16);
+		out += (char)(value >> 8);
+		out += (char)value;
+	}
+
+	static void appendSetting(std::string& out, uint16_t id, uint32_t value) {
+		out += (char)(id >> 8);
+		out += (char)id;
+		append32(out, value);
+	}
+
+	static void appendFrame(std::string& out, uint8_t type, uint8_t flags, uint32_t stream, const char* data, size_t size) {
+		out += (char)(size >> 16);
+		out += (char)(size >> 8);
+		out += (char)size;
+		out += (char)type;
+		out += (char)flags;
+		append32(out, stream);
+		out.append(data, size);
+	}
+
+	//a header block that doesn't fit into one frame continues in CONTINUATION frames
+	static void appendHeaders(std::string& out, uint32_t stream, const std::vector<HeaderField>& headers, bool endStream) {
+		std::string block;
+		encodeHeaders(headers, block);
+		size_t offset = 0;
+		do {
+			auto size = std::min(block.size() - offset, Http2Connection::MaxFrameSize);
+			uint8_t type = offset == 0 ? FRAME_HEADERS : FRAME_CONTINUATION;
+			uint8_t flags = offset + size == block.size() ? FLAG_END_HEADERS : 0;
+			if (offset == 0 && endStream) {
+				flags |= FLAG_END_STREAM;
+			}
+			appendFrame(out, type, flags, stream, block.data() + offset, size);
+			offset += size;
+		} while (offset < block.size());
+	}
+
+	static bool removePadding(uint8_t flags, std::string& payload) {
+		if ((flags & FLAG_PADDED) == 0) {
+			return true;
+		}
+		if (payload.empty() || (uint8_t)payload[0] >= payload.size()) {
+			return false;
+		}
+		payload.resize(payload.size() - (uint8_t)payload[0]);
+		payload.erase(0, 1);
+		return true;
+	}
+
+	//the HTTP2-Settings header of an upgrade request (RFC 7540, section 3.2.1)
+	static bool decodeBase64Url(const std::string& in, std::string& out) {
+		uint32_t bits = 0;
+		int count = 0;
+		for (char c : in) {
+			int value;
+			if (c >= 'A' && c <= 'Z') value = c - 'A';
+			else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+			else if (c >= '0' && c <= '9') value = c - '0' + 52;
+			else if (c == '-' || c == '+') value = 62;
+			else if (c == '_' || c == '/') value = 63;
+			else if (c == '=') break;
+			else return false;
+			bits = bits << 6 | value;
+			count += 6;
+			if (count >= 8) {
+				count -= 8;
+				out += (char)(bits >> count);
+			}
+		}
+		return true;
+	}
+
+	//headers that are specific to HTTP/1.x connections
+	static bool isConnectionHeader(const std::string& name) {
+		return name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+			name == "transfer-encoding" || name == "upgrade";
+	}
+
+	Http2Connection::Http2Connection(Http2Hub& hub, socket_t sock, RequestHandler handler, const httplib::Request* upgrade) :
+		HubConnection(hub, sock),
+		connections_(hub),
+		handler_(std::move(handler)),
+		remoteAddr_(httplib::detail::get_remote_addr(sock)),
+		//the request line of the preface has been read by the HTTP/1.x server
+		preface_(upgrade != nullptr ? "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n" : "\r\nSM\r\n\r\n"),
+		lastStream_(0),
+		continuation_(0),
+		continuationEnd_(false),
+		pendingData_(0),
+		window_(DEFAULT_WINDOW),
+		initialWindow_(DEFAULT_WINDOW),
+		buffered_(0),
+		withheld_(0)
+	{
+		if (upgrade != nullptr) {
+			upgrade_ = std::make_shared<httplib::Request>(*upgrade);
+		}
+	}
+
+	bool Http2Connection::start(const std::shared_ptr<Http2Connection>& self) {
+		std::string settings;
+		appendSetting(settings, SETTINGS_MAX_CONCURRENT_STREAMS, MaxStreams);
+		appendSetting(settings, SETTINGS_MAX_HEADER_LIST_SIZE, HpackDecoder::MaxHeaderList);
+		if (!sendFrame(FRAME_SETTINGS, 0, 0, settings, false)) {
+			return false;
+		}
+		if (upgrade_) {
+			//the settings of the upgrade request are acknowledged implicitly
+			std::string clientSettings;
+			if (!decodeBase64Url(upgrade_->get_header_value("HTTP2-Settings"), clientSettings) ||
+				clientSettings.size() % 6 != 0 || !processSettings(clientSettings)) {
+				return error(ERROR_PROTOCOL);
+			}
+			auto req = std::move(upgrade_);
+			req->version = "HTTP/2.0";
+			req->read_body = nullptr;
+			buffered_ = req->body.size();
+			lastStream_ = 1;
+			receiving_[1] = req;
+			dispatch(self, 1);
+		}
+		return true;
+	}
+
+	bool Http2Connection::respond(uint32_t stream, const httplib::Request& req, httplib::Response& res) {
+		std::vector<HeaderField> headers;
+		headers.push_back({ ":status", std::to_string(res.status) });
+		for (auto& header : res.headers) {
+			std::string name = header.first;
+			std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+			if (!isConnectionHeader(name) && name != "content-length") {
+				headers.push_back({ name, header.second });
+			}
+		}
+		if (res.status != 204 && !res.has_header("Content-Type")) {
+			headers.push_back({ "content-type", "text/plain" });
+		}
+		bool chunked = res.body.empty() && res.content_provider && res.content_provider_resource_length == 0;
+		if (!chunked && res.status != 204) {
+			auto length = res.body.empty() ? res.content_provider_resource_length : res.body.size();
+			headers.push_back({ "content-length", std::to_string(length) });
+		}
+		bool noBody = req.method == "HEAD" || (res.body.empty() && !res.content_provider);
+		std::string head;
+		appendHeaders(head, stream, headers, noBody);
+		bool ok;
+		if (noBody) {
+			closeStream(stream);
+			ok = write(head, true);
+		}
+		else if (!res.body.empty()) {
+			ok = sendData(stream, std::move(head), res.body.data(), res.body.size(), true);
+		}
+		else if (!chunked) {
+			ok = write(head, true);
+			size_t offset = 0;
+			auto length = res.content_provider_resource_length;
+			while (ok && offset < length) {
+				res.content_provider(offset, length - offset,
+					[&](const char* data, size_t size) {
+						offset += size;
+						ok = ok && sendData(stream, std::string(), data, size, offset >= length);
+					},
+					[&] { ok = false; });
+			}
+		}
+		else {
+			ok = write(head, true);
+			size_t offset = 0;
+			bool available = true;
+			while (ok && available) {
+				res.content_provider(offset, 0,
+					[&](const char* data, size_t size) {
+						available = size > 0;
+						offset += size;
+						ok = ok && sendData(stream, std::string(), data, size, !available);
+					},
+					[&] {
+						available = false;
+						ok = ok && sendData(stream, std::string(), nullptr, 0, true);
+					});
+			}
+		}
+		closeStream(stream);
+		return ok;
+	}
+
+	bool Http2Connection::respond(uint32_t stream, int status, int retryAfter) {
+		std::vector<HeaderField> headers;
+		headers.push_back({ ":status", std::to_string(status) });
+		if (retryAfter > 0) {
+			headers.push_back({ "retry-after", std::to_string(retryAfter) });
+		}
+		headers.push_back({ "content-length", "0" });
+		std::string head;
+		appendHeaders(head, stream, headers, true);
+		closeStream(stream);
+		//the hub thread may answer a stream, so the response is queued if the socket is full
+		return write(head, false);
+	}
+
+	bool Http2Connection::isReset(uint32_t stream) {
+		if (isClosed()) {
+			return true;
+		}
+		std::unique_lock<std::mutex> lock(flowMutex_);
+		auto it = sending_.find(stream);
+		return it == sending_.end() || it->second.reset;
+	}
+
+	//Sends as much of the data as the flow control windows allow. The rest is queued and sent by
+	//the hub thread when the client opens the windows, so a worker never waits for the client.
+	bool Http2Connection::sendData(uint32_t stream, std::string&& head, const char* data, size_t size, bool endStream) {
+		size_t buffered = 0;
+		bool overflow = false;
+		{
+			std::unique_lock<std::mutex> lock(flowMutex_);
+			auto it = sending_.find(stream);
+			if (it == sending_.end() || it->second.reset) {
+				return false;
+			}
+			auto& sending = it->second;
+			//the queued data must be sent first
+			bool waiting = !sending.pending.empty();
+			size_t framed = waiting ? 0 : frameData(stream, sending, data, size, endStream, head);
+			if (waiting || framed < size) {
+				overflow = pendingData_ + size - framed > MaxBuffered;
+				if (!overflow) {
+					sending.pending.append(data + framed, size - framed);
+					sending.ending = endStream;
+					pendingData_ += size - framed;
+				}
+			}
+			else if (endStream) {
+				//the client may open another stream as soon as this one ends
+				buffered = sending.buffered;
+				sending_.erase(it);
+			}
+			//the frames are written in the order of the window they have taken
+			if (!head.empty() && !write(head, false)) {
+				return false;
+			}
+		}
+		if (buffered > 0) {
+			release(buffered);
+		}
+		if (overflow) {
+			resetStream(stream, ERROR_CANCEL);
+			return false;
+		}
+		return waitOutput();
+	}
+
+	//Appends the DATA frames the flow control windows allow and returns the size of the data
+	//they carry. Must be called with flowMutex_ locked.
+	size_t Http2Connection::frameData(uint32_t stream, SendStream& sending, const char* data, size_t size, bool endStream, std::string& frames) {
+		size_t offset = 0;
+		while (offset < size && window_ > 0 && sending.window > 0) {
+			size_t length = (size_t)std::min<int64_t>({ (int64_t)(size - offset), (int64_t)MaxFrameSize, window_, sending.window });
+			window_ -= length;
+			sending.window -= length;
+			offset += length;
+			appendFrame(frames, FRAME_DATA, endStream && offset == size ? FLAG_END_STREAM : 0, stream, data + offset - length, length);
+		}
+		if (size == 0 && endStream) {
+			appendFrame(frames, FRAME_DATA, FLAG_END_STREAM, stream, nullptr, 0);
+		}
+		return offset;
+	}
+
+	//Frames the queued data after a window has been opened. Must be called with flowMutex_
+	//locked; returns the request data of the streams that have ended.
+	size_t Http2Connection::framePending(std::string& frames) {
+		size_t buffered = 0;
+		for (auto it = sending_.begin(); it != sending_.end() && window_ > 0;) {
+			auto& sending = it->second;
+			if (sending.pending.empty()) {
+				++it;
+				continue;
+			}
+			auto framed = frameData(it->first, sending, sending.pending.data(), sending.pending.size(), sending.ending, frames);
+			sending.pending.erase(0, framed);
+			pendingData_ -= framed;
+			if (sending.pending.empty() && sending.ending) {
+				buffered += sending.buffered;
+				it = sending_.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+		return buffered;
+	}
+
+	//called by the hub thread when the client opens a window
+	bool Http2Connection::sendPending() {
+		std::string frames;
+		size_t buffered;
+		{
+			std::unique_lock<std::mutex> lock(flowMutex_);
+			buffered = framePending(frames);
+			if (!frames.empty() && !write(frames, false)) {
+				return false;
+			}
+		}
+		if (buffered > 0) {
+			release(buffered);
+		}
+		return true;
+	}
+
+	//Drops the queued data of a reset stream. Must be called with flowMutex_ locked; returns
+	//the request data if the stream has ended.
+	size_t Http2Connection::cancelStream(uint32_t stream) {
+		auto it = sending_.find(stream);
+		if (it == sending_.end()) {
+			return 0;
+		}
+		auto& sending = it->second;
+		sending.reset = true;
+		pendingData_ -= sending.pending.size();
+		std::string().swap(sending.pending);
+		if (!sending.ending) {
+			return 0;
+		}
+		//the response has been queued entirely, so the stream isn't closed by its worker
+		auto buffered = sending.buffered;
+		sending_.erase(it);
+		return buffered;
+	}
+
+	void Http2Connection::closeStream(uint32_t stream) {
+		size_t buffered = 0;
+		{
+			std::unique_lock<std::mutex> lock(flowMutex_);
+			auto it = sending_.find(stream);
+			if (it == sending_.end()) {
+				return;
+			}
+			buffered = it->second.buffered;
+			it->second.buffered = 0;
+			//a complete response ends when its queued data has been sent
+			if (!it->second.ending || it->second.pending.empty() || it->second.reset) {
+				pendingData_ -= it->second.pending.size();
+				sending_.erase(it);
+			}
+		}
+		release(buffered);
+	}
+
+	void Http2Connection::release(size_t buffered) {
+		uint32_t credit = 0;
+		{
+			std::unique_lock<std::mutex> lock(flowMutex_);
+			buffered_ -= buffered;
+			if (buffered_ <= MaxBuffered) {
+				std::swap(credit, withheld_);
+			}
+		}
+		if (credit > 0) {
+			std::string increment;
+			append32(increment, credit);
+			sendFrame(FRAME_WINDOW_UPDATE, 0, 0, increment, false);
+		}
+	}
+
+	bool Http2Connection::parse(const std::shared_ptr<HubConnection>& connection) {
+		auto self = std::static_pointer_cast<Http2Connection>(connection);
+		if (!preface_.empty()) {
+			auto size = std::min(preface_.size(), input_.size());
+			if (input_.compare(0, size, preface_, 0, size) != 0) {
+				return false;
+			}
+			preface_.erase(0, size);
+			input_.erase(0, size);
+			if (!preface_.empty()) {
+				return true;
+			}
+		}
+		size_t pos = 0;
+		while (input_.size() - pos >= FRAME_HEADER_SIZE) {
+			auto p = (const uint8_t*)input_.data() + pos;
+			size_t length = (size_t)p[0] << 16 | (size_t)p[1] << 8 | p[2];
+			uint8_t type = p[3];
+			uint8_t flags = p[4];
+			uint32_t stream = read32((const char*)p + 5) & MAX_WINDOW;
+			if (length > MaxFrameSize) {
+				return error(ERROR_FRAME_SIZE);
+			}
+			if (input_.size() - pos - FRAME_HEADER_SIZE < length) {
+				break;
+			}
+			std::string payload(input_, pos + FRAME_HEADER_SIZE, length);
+			pos += FRAME_HEADER_SIZE + length;
+			if (!processFrame(self, type, flags, stream, payload)) {
+				return false;
+			}
+		}
+		input_.erase(0, pos);
+		return true;
+	}
+
+	bool Http2Connection::processFrame(const std::shared_ptr<Http2Connection>& self, uint8_t type, uint8_t flags, uint32_t stream, std::string& payload) {
+		//a header block must not be interrupted by other frames
+		if ((continuation_ != 0) != (type == FRAME_CONTINUATION) || (continuation_ != 0 && stream != continuation_)) {
+			return error(ERROR_PROTOCOL);
+		}
+		bool connectionFrame = type == FRAME_SETTINGS || type == FRAME_PING || type == FRAME_GOAWAY;
+		if (type <= FRAME_CONTINUATION && type != FRAME_WINDOW_UPDATE && (stream == 0) != connectionFrame) {
+			return error(ERROR_PROTOCOL);
+		}
+		switch (type) {
+		case FRAME_DATA: {
+			size_t size = payload.size();
+			if (!removePadding(flags, payload)) {
+				return error(ERROR_PROTOCOL);
+			}
+			if (stream > lastStream_) {
+				return error(ERROR_PROTOCOL);
+			}
+			auto it = receiving_.find(stream);
+			bool open = it != receiving_.end();
+			bool tooLarge = false;
+			if (open) {
+				auto& req = *it->second;
+				tooLarge = payload.size() > connections_.getPayloadLimit(req.path) - std::min(connections_.getPayloadLimit(req.path), req.body.size());
+				if (!tooLarge) {
+					req.body += payload;
+				}
+			}
+			//the flow control window is replenished unless too much is buffered
+			std::string updates;
+			if (size > 0) {
+				std::string increment;
+				append32(increment, (uint32_t)size);
+				{
+					std::unique_lock<std::mutex> lock(flowMutex_);
+					if (open && !tooLarge) {
+						buffered_ += payload.size();
+					}
+					if (buffered_ > MaxBuffered) {
+						withheld_ += (uint32_t)size;
+					}
+					else {
+						appendFrame(updates, FRAME_WINDOW_UPDATE, 0, 0, increment.data(), increment.size());
+					}
+				}
+				if (open && !tooLarge && (flags & FLAG_END_STREAM) == 0) {
+					appendFrame(updates, FRAME_WINDOW_UPDATE, 0, stream, increment.data(), increment.size());
+				}
+			}
+			if (!updates.empty() && !write(updates, false)) {
+				return false;
+			}
+			//the rest of a stream that has been reset or answered is discarded
+			if (!open) {
+				return true;
+			}
+			if (tooLarge) {
+				//the client is told to stop sending the body after the response
+				release(it->second->body.size());
+				receiving_.erase(it);
+				{
+					std::unique_lock<std::mutex> lock(flowMutex_);
+					sending_[stream] = SendStream{ initialWindow_, false, 0, std::string(), false };
+				}
+				respond(stream, 413);
+				resetStream(stream, ERROR_NO_ERROR);
+			}
+			else if (flags & FLAG_END_STREAM) {
+				dispatch(self, stream);
+			}
+			return true;
+		}
+		case FRAME_HEADERS:
+			if (!removePadding(flags, payload)) {
+				return error(ERROR_PROTOCOL);
+			}
+			if (flags & FLAG_PRIORITY) {
+				if (payload.size() < 5) {
+					return error(ERROR_PROTOCOL);
+				}
+				payload.erase(0, 5);
+			}
+			headerBlock_ = std::move(payload);
+			continuationEnd_ = (flags & FLAG_END_STREAM) != 0;
+			if (flags & FLAG_END_HEADERS) {
+				return processHeaders(self, stream, continuationEnd_);
+			}
+			continuation_ = stream;
+			return true;
+		case FRAME_CONTINUATION:
+			if (headerBlock_.size() + payload.size() > HpackDecoder::MaxHeaderList) {
+				return error(ERROR_ENHANCE_YOUR_CALM);
+			}
+			headerBlock_ += payload;
+			if (flags & FLAG_END_HEADERS) {
+				continuation_ = 0;
+				return processHeaders(self, stream, continuationEnd_);
+			}
+			return true;
+		case FRAME_PRIORITY:
+			//all streams are served in the order of the worker queue
+			if (payload.size() != 5) {
+				resetStream(stream, ERROR_FRAME_SIZE);
+			}
+			return true;
+		case FRAME_RST_STREAM: {
+			if (payload.size() != 4) {
+				return error(ERROR_FRAME_SIZE);
+			}
+			if (stream > lastStream_) {
+				return error(ERROR_PROTOCOL);
+			}
+			auto it = receiving_.find(stream);
+			if (it != receiving_.end()) {
+				release(it->second->body.size());
+				receiving_.erase(it);
+			}
+			size_t buffered;
+			{
+				std::unique_lock<std::mutex> lock(flowMutex_);
+				buffered = cancelStream(stream);
+			}
+			if (buffered > 0) {
+				release(buffered);
+			}
+			return true;
+		}
+		case FRAME_SETTINGS:
+			if (flags & FLAG_ACK) {
+				return payload.empty() || error(ERROR_FRAME_SIZE);
+			}
+			if (payload.size() % 6 != 0) {
+				return error(ERROR_FRAME_SIZE);
+			}
+			return processSettings(payload) && sendFrame(FRAME_SETTINGS, FLAG_ACK, 0, std::string(), false);
+		case FRAME_PUSH_PROMISE:
+			//clients can't push
+			return error(ERROR_PROTOCOL);
+		case FRAME_PING:
+			if (payload.size() != 8) {
+				return error(ERROR_FRAME_SIZE);
+			}
+			return (flags & FLAG_ACK) || sendFrame(FRAME_PING, FLAG_ACK, 0, payload, false);
+		case FRAME_GOAWAY:
+			//the client closes the connection when it has received its responses
+			return true;
+		case FRAME_WINDOW_UPDATE: {
+			if (payload.size() != 4) {
+				return error(ERROR_FRAME_SIZE);
+			}
+			int64_t increment = read32(payload.data()) & MAX_WINDOW;
+			if (stream == 0) {
+				std::unique_lock<std::mutex> lock(flowMutex_);
+				window_ += increment;
+				bool valid = increment > 0 && window_ <= MAX_WINDOW;
+				lock.unlock();
+				return valid ? sendPending() : error(increment > 0 ? ERROR_FLOW_CONTROL : ERROR_PROTOCOL);
+			}
+			if (stream > lastStream_) {
+				return error(ERROR_PROTOCOL);
+			}
+			std::unique_lock<std::mutex> lock(flowMutex_);
+			auto it = sending_.find(stream);
+			if (it == sending_.end()) {
+				return true;
+			}
+			it->second.window += increment;
+			bool valid = increment > 0 && it->second.window <= MAX_WINDOW;
+			lock.unlock();
+			if (!valid) {
+				resetStream(stream, increment > 0 ? ERROR_FLOW_CONTROL : ERROR_PROTOCOL);
+				return true;
+			}
+			return sendPending();
+		}
+		default:
+			//unknown frames are ignored
+			return true;
+		}
+	}
+
+	bool Http2Connection::processHeaders(const std::shared_ptr<Http2Connection>& self, uint32_t stream, bool endStream) {
+		//the block must be decoded even if the stream is refused to keep the dynamic table in sync
+		std::vector<HeaderField> fields;
+		std::string block;
+		block.swap(headerBlock_);
+		if (!decoder_.decode(block, fields)) {
+			return error(ERROR_COMPRESSION);
+		}
+		auto it = receiving_.find(stream);
+		if (it != receiving_.end()) {
+			//trailers are ignored, but they must end the request
+			if (!endStream) {
+				release(it->second->body.size());
+				receiving_.erase(it);
+				resetStream(stream, ERROR_PROTOCOL);
+				return true;
+			}
+			dispatch(self, stream);
+			return true;
+		}
+		if (stream <= lastStream_) {
+			resetStream(stream, ERROR_STREAM_CLOSED);
+			return true;
+		}
+		if ((stream & 1) == 0) {
+			return error(ERROR_PROTOCOL);
+		}
+		lastStream_ = stream;
+		size_t streams;
+		{
+			std::unique_lock<std::mutex> lock(flowMutex_);
+			streams = receiving_.size() + sending_.size();
+		}
+		if (streams >= MaxStreams) {
+			resetStream(stream, ERROR_REFUSED_STREAM);
+			return true;
+		}
+		auto req = std::make_shared<httplib::Request>();
+		req->version = "HTTP/2.0";
+		req->remote_addr = remoteAddr_;
+		std::string authority;
+		bool valid = true, regular = false;
+		for (auto& field : fields) {
+			if (!field.name.empty() && field.name[0] == ':') {
+				//pseudo-headers must precede the regular headers
+				valid = valid && !regular;
+				if (field.name == ":method") {
+					req->method = field.value;
+				}
+				else if (field.name == ":path") {
+					req->target = field.value;
+				}
+				else if (field.name == ":authority") {
+					authority = field.value;
+				}
+				else if (field.name != ":scheme") {
+					valid = false;
+				}
+			}
+			else {
+				regular = true;
+				valid = valid && !isConnectionHeader(field.name) &&
+					std::none_of(field.name.begin(), field.name.end(), [](char c) { return c >= 'A' && c <= 'Z'; });
+				req->headers.emplace(field.name, field.value);
+			}
+		}
+		if (!valid || req->method.empty() || req->target.empty()) {
+			resetStream(stream, ERROR_PROTOCOL);
+			return true;
+		}
+		if (!authority.empty() && !req->has_header("Host")) {
+			req->set_header("Host", authority);
+		}
+		auto query = req->target.find('?');
+		req->path = httplib::detail::decode_url(req->target.substr(0, query));
+		if (query != std::string::npos) {
+			httplib::detail::parse_query_text(req->target.substr(query + 1), req->params);
+		}
+		receiving_[stream] = req;
+		if (endStream) {
+			dispatch(self, stream);
+		}
+		return true;
+	}
+
+	bool Http2Connection::processSettings(const std::string& payload) {
+		for (size_t i = 0; i + 6 <= payload.size(); i += 6) {
+			uint16_t id = (uint16_t)((uint8_t)payload[i] << 8 | (uint8_t)payload[i + 1]);
+			uint32_t value = read32(payload.data() + i + 2);
+			switch (id) {
+			case SETTINGS_ENABLE_PUSH:
+				if (value > 1) {
+					return error(ERROR_PROTOCOL);
+				}
+				break;
+			case SETTINGS_INITIAL_WINDOW_SIZE: {
+				if (value > MAX_WINDOW) {
+					return error(ERROR_FLOW_CONTROL);
+				}
+				//the change applies to the streams that are being answered
+				std::unique_lock<std::mutex> lock(flowMutex_);
+				auto delta = (int64_t)value - initialWindow_;
+				initialWindow_ = value;
+				for (auto& stream : sending_) {
+					stream.second.window += delta;
+				}
+				lock.unlock();
+				if (delta > 0 && !sendPending()) {
+					return false;
+				}
+				break;
+			}
+			case SETTINGS_MAX_FRAME_SIZE:
+				//frames are sent with the minimum size
+				if (value < MaxFrameSize || value > 16777215) {
+					return error(ERROR_PROTOCOL);
+				}
+				break;
+			default:
+				//the encoder doesn't use the dynamic table
+				break;
+			}
+		}
+		return true;
+	}
+
+	void Http2Connection::dispatch(const std::shared_ptr<Http2Connection>& self, uint32_t stream) {
+		auto it = receiving_.find(stream);
+		auto req = it->second;
+		receiving_.erase(it);
+		req->received = std::chrono::steady_clock::now();
+		{
+			std::unique_lock<std::mutex> lock(flowMutex_);
+			sending_[stream] = SendStream{ initialWindow_, false, req->body.size(), std::string(), false };
+		}
+		std::weak_ptr<Http2Connection> connection = self;
+		req->is_connection_closed = [connection, stream] {
+			auto self = connection.lock();
+			return !self || self->isReset(stream);
+		};
+		handler_(self, stream, req);
+	}
+
+	bool Http2Connection::sendFrame(uint8_t type, uint8_t flags, uint32_t stream, const std::string& payload, bool wait) {
+		std::string frame;
+		appendFrame(frame, type, flags, stream, payload.data(), payload.size());
+		return write(frame, wait);
+	}
+
+	void Http2Connection::resetStream(uint32_t stream, uint32_t error) {
+		size_t buffered;
+		{
+			std::unique_lock<std::mutex> lock(flowMutex_);
+			buffered = cancelStream(stream);
+		}
+		if (buffered > 0) {
+			release(buffered);
+		}
+		std::string code;
+		append32(code, error);
+		sendFrame(FRAME_RST_STREAM, 0, stream, code, false);
+	}
+
+	bool Http2Connection::error(uint32_t code) {
+		std::string payload;
+		append32(payload, lastStream_);
+		append32(payload, code);
+		sendFrame(FRAME_GOAWAY, 0, 0, payload, false);
+		return false;
+	}
+
+	//streams that have been received are still answered
+	void Http2Connection::goAway() {
+		std::string payload;
+		append32(payload, lastStream_);
+		append32(payload, ERROR_NO_ERROR);
+		sendFrame(FRAME_GOAWAY, 0, 0, payload, false);
+	}
+
+	std::shared_ptr<Http2Connection> Http2Hub::add(socket_t sock, Http2Connection::RequestHandler handler, const httplib::Request* upgrade) {
+		auto connection = std::make_shared<Http2Connection>(*this, sock, std::move(handler), upgrade);
+		if (!connection->start(connection) || !ConnectionHub::add(connection)) {
+			return nullptr;
+		}
+		return connection;
+	}
+
+}
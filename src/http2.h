@@ -0,0 +1,141 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include "connection_hub.h"
+#include "hpack.h"
+
+namespace randomx {
+
+	class Http2Hub;
+
+	//A cleartext HTTP/2 connection (RFC 7540). Complete requests are passed to the handler
+	//and may be answered in any order from any thread.
+	class Http2Connection : public HubConnection {
+	public:
+		using RequestHandler = std::function<void(const std::shared_ptr<Http2Connection>& connection, uint32_t stream, const std::shared_ptr<httplib::Request>& req)>;
+		//the number of streams a client may open before the first one is answered
+		static const unsigned MaxStreams = 256;
+		static const size_t MaxFrameSize = 16384;
+		//the request bodies of a connection that are held in memory before its window is exhausted,
+		//and the response data that may wait for the client's windows
+		static const size_t MaxBuffered = 67108864;
+
+		//with an upgrade request, the client preface is expected after the 101 response
+		Http2Connection(Http2Hub& hub, socket_t sock, RequestHandler handler, const httplib::Request* upgrade);
+		//sends the server preface and dispatches the upgrade request as stream 1
+		bool start(const std::shared_ptr<Http2Connection>& self);
+		//sends the response and closes the stream
+		bool respond(uint32_t stream, const httplib::Request& req, httplib::Response& res);
+		//a response without a body, e.g. when the request is rejected by the queue
+		bool respond(uint32_t stream, int status, int retryAfter = 0);
+		//true if the stream has been reset by the client or the connection is closed
+		bool isReset(uint32_t stream);
+		const std::string& getRemoteAddr() const {
+			return remoteAddr_;
+		}
+	protected:
+		virtual bool parse(const std::shared_ptr<HubConnection>& self) override;
+		virtual void goAway() override;
+	private:
+		struct SendStream {
+			int64_t window;
+			bool reset;
+			size_t buffered;
+			//the response data that waits for the flow control windows
+			std::string pending;
+			//the stream ends with the pending data
+			bool ending;
+		};
+
+		bool processFrame(const std::shared_ptr<Http2Connection>& self, uint8_t type, uint8_t flags, uint32_t stream, std::string& payload);
+		bool processHeaders(const std::shared_ptr<Http2Connection>& self, uint32_t stream, bool endStream);
+		bool processSettings(const std::string& payload);
+		void dispatch(const std::shared_ptr<Http2Connection>& self, uint32_t stream);
+		bool sendData(uint32_t stream, std::string&& head, const char* data, size_t size, bool endStream);
+		size_t frameData(uint32_t stream, SendStream& sending, const char* data, size_t size, bool endStream, std::string& frames);
+		size_t framePending(std::string& frames);
+		bool sendPending();
+		size_t cancelStream(uint32_t stream);
+		void closeStream(uint32_t stream);
+		void release(size_t buffered);
+		bool sendFrame(uint8_t type, uint8_t flags, uint32_t stream, const std::string& payload, bool wait);
+		void resetStream(uint32_t stream, uint32_t error);
+		bool error(uint32_t code);
+
+		Http2Hub& connections_;
+		RequestHandler handler_;
+		std::string remoteAddr_;
+		//the rest of the preface the client must send
+		std::string preface_;
+		std::shared_ptr<httplib::Request> upgrade_;
+		//the state of the streams that are being received is only used by the hub thread
+		HpackDecoder decoder_;
+		std::map<uint32_t, std::shared_ptr<httplib::Request>> receiving_;
+		uint32_t lastStream_;
+		uint32_t continuation_;
+		bool continuationEnd_;
+		std::string headerBlock_;
+		//the flow control of the responses is shared with the workers
+		std::mutex flowMutex_;
+		std::map<uint32_t, SendStream> sending_;
+		size_t pendingData_;
+		int64_t window_;
+		int64_t initialWindow_;
+		//request data that hasn't been acknowledged with WINDOW_UPDATE, because too much is buffered
+		size_t buffered_;
+		uint32_t withheld_;
+	};
+
+	class Http2Hub : public ConnectionHub {
+	public:
+		using PayloadLimit = std::function<size_t(const std::string& path)>;
+
+		//returns null if there are too many connections; the socket is closed in that case
+		std::shared_ptr<Http2Connection> add(socket_t sock, Http2Connection::RequestHandler handler, const httplib::Request* upgrade = nullptr);
+		//the maximum size of a request body
+		void setPayloadLimit(PayloadLimit limit) {
+			payloadLimit_ = std::move(limit);
+		}
+		size_t getPayloadLimit(const std::string& path) const {
+			return payloadLimit_ ? payloadLimit_(path) : SIZE_MAX;
+		}
+	private:
+		PayloadLimit payloadLimit_;
+	};
+
+}
@@ -98,6 +98,7 @@ typedef SOCKET socket_t;
 #include <cstring>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #ifdef CPPHTTPLIB_USE_POLL
 #include <poll.h>
 #endif
@@ -105,14 +106,17 @@ typedef SOCKET socket_t;
 #include <signal.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 typedef int socket_t;
 #define INVALID_SOCKET (-1)
 #endif //_WIN32
 
+#include <algorithm>
 #include <assert.h>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <fcntl.h>
 #include <fstream>
@@ -123,6 +127,7 @@ typedef int socket_t;
 #include <mutex>
 #include <random>
 #include <regex>
+#include <set>
 #include <string>
 #include <sys/stat.h>
 #include <thread>
@@ -216,6 +221,14 @@ struct Request {
 
   // for server
   std::string version;
+  // when the request was received; for the first request of a connection,
+  // this is when the connection was accepted
+  std::chrono::steady_clock::time_point received;
+  std::function<bool()> is_connection_closed;
+  // set for the paths from stream_request_body instead of reading the body
+  // into body; the receiver gets the body in pieces as it arrives and the
+  // status is set to 400 or 413 if the body can't be read
+  std::function<bool(ContentReceiver receiver, int &status)> read_body;
   std::string target;
   Params params;
   MultipartFiles files;
@@ -282,6 +295,9 @@ struct Response {
   size_t content_provider_resource_length;
   ContentProvider content_provider;
   std::function<void()> content_provider_resource_releaser;
+  // for server; with status 101, the socket is passed to this function after
+  // the response has been sent instead of being closed
+  std::function<void(socket_t sock)> upgrade;
 };
 
 class Stream {
@@ -292,6 +308,10 @@ public:
   virtual int write(const char *ptr) = 0;
   virtual int write(const std::string &s) = 0;
   virtual std::string get_remote_addr() const = 0;
+  virtual bool is_peer_closed() const { return false; }
+  //Elekto: writes two buffers without joining them; sockets send them with one system call
+  virtual int write_gather(const char *ptr1, size_t size1, const char *ptr2,
+                           size_t size2);
 
   template <typename... Args>
   int write_format(const char *fmt, const Args &... args);
@@ -307,6 +327,11 @@ public:
   virtual int write(const char *ptr);
   virtual int write(const std::string &s);
   virtual std::string get_remote_addr() const;
+  virtual bool is_peer_closed() const;
+#ifndef _WIN32
+  virtual int write_gather(const char *ptr1, size_t size1, const char *ptr2,
+                           size_t size2);
+#endif
 
 private:
   socket_t sock_;
@@ -357,7 +382,17 @@ public:
 
   void set_keep_alive_max_count(size_t count);
   void set_payload_max_length(size_t length);
-
+  // Overrides the limit for requests to one path
+  void set_payload_max_length(const char *path, size_t length);
+  // The body of requests to the path is read by the handler with
+  // Request::read_body
+  void stream_request_body(const char *path);
+  // The queue may peek at these headers of waiting requests to order them by
+  // their deadline and to share the workers fairly among clients
+  void set_timeout_header(const char *name);
+  void set_client_header(const char *name);
+
+  bool bind_to_port(const char *host, int port, int socket_flags = 0);
   int bind_to_any_port(const char *host, int socket_flags = 0);
   bool listen_after_bind();
 
@@ -366,15 +401,38 @@ public:
   bool is_running() const;
   void stop();
 
+  // Used to hand the listening socket over to another process
+  bool adopt_socket(socket_t sock);
+  socket_t get_socket() const { return svr_sock_; }
+  void stop_accepting();
+
+  // Serves the same routes as another server on a different socket
+  void copy_handlers(const Server &other);
+
+  // Cleartext HTTP/2 connections (prior knowledge or 'Upgrade: h2c') are
+  // passed to the handler with the upgrade request, if there is one
+  typedef std::function<void(W &worker, socket_t sock, const Request *upgrade)>
+      H2cHandler;
+  void set_h2c_handler(H2cHandler handler);
+  // Routes a request that has been received with another protocol; the caller
+  // sends the response after it has been logged
+  void handle_request(W &worker, Request &req, Response &res);
+  size_t get_payload_max_length(const std::string &path) const;
+
   std::function<TaskQueue<W> *(void)> new_task_queue;
 
 protected:
   bool process_request(W& worker, Stream &strm, bool last_connection,
                        bool &connection_close,
-                       std::function<void(Request &)> setup_request);
+                       std::function<void(Request &)> setup_request,
+                       std::function<void(socket_t)> *upgrade = nullptr);
 
   size_t keep_alive_max_count_;
   size_t payload_max_length_;
+  std::map<std::string, size_t> path_payload_max_length_;
+  std::set<std::string> streamed_body_paths_;
+  std::string timeout_header_;
+  std::string client_header_;
 
 private:
   typedef std::vector<std::pair<std::regex, Handler>> Handlers;
@@ -395,10 +453,13 @@ private:
                                    Response &res, const std::string &boundary,
                                    const std::string &content_type);
 
-  virtual bool process_and_close_socket(W& worker, socket_t sock);
+  virtual bool process_and_close_socket(W& worker, socket_t sock,
+                                        std::chrono::steady_clock::time_point accepted);
+  void reject_socket(socket_t sock, int status, int retry_after);
 
   std::atomic<bool> is_running_;
   std::atomic<socket_t> svr_sock_;
+  std::atomic<bool> stop_accepting_;
   std::string base_dir_;
   Handler file_request_handler_;
   Handlers get_handlers_;
@@ -409,6 +470,7 @@ private:
   Handlers options_handlers_;
   Handler error_handler_;
   Logger logger_;
+  H2cHandler h2c_handler_;
 };
 
 class Client {
@@ -969,7 +1031,8 @@ inline bool wait_until_socket_is_ready(socket_t sock, time_t sec, time_t usec) {
 
 template <typename T>
 inline bool process_and_close_socket(bool is_client_request, socket_t sock,
-                                     size_t keep_alive_max_count, T callback) {
+                                     size_t keep_alive_max_count, T callback,
+                                     const bool *keep_open = nullptr) {
   assert(keep_alive_max_count > 0);
 
   bool ret = false;
@@ -995,10 +1058,51 @@ inline bool process_and_close_socket(bool is_client_request, socket_t sock,
     ret = callback(strm, true, dummy_connection_close);
   }
 
+  //Elekto: upgraded connections are owned by the caller
+  if (keep_open && *keep_open) { return ret; }
   close_socket(sock);
   return ret;
 }
 
+// Finds a header in the peeked request headers; the name is matched case-insensitively
+inline bool find_peeked_header(const std::string &headers, const std::string &name,
+                               std::string &value) {
+  if (name.empty()) { return false; }
+  auto lower = [](unsigned char c) { return static_cast<char>(::tolower(c)); };
+  auto key = "\r\n" + name + ":";
+  std::transform(key.begin(), key.end(), key.begin(), lower);
+  auto it = std::search(headers.begin(), headers.end(), key.begin(), key.end(),
+                        [&](char a, char b) { return lower(a) == b; });
+  if (it == headers.end()) { return false; }
+  auto begin = headers.find_first_not_of(" \t", (it - headers.begin()) + key.size());
+  auto end = headers.find("\r\n", begin);
+  value = headers.substr(begin, end - begin);
+  return true;
+}
+
+// Reads the scheduling headers without consuming the request; returns false
+// if the headers have not been received yet
+inline bool peek_request_info(socket_t sock, const std::string &timeout_header,
+                              const std::string &client_header, RequestInfo &info) {
+  char buf[4096];
+  if (select_read(sock, 0, 0) <= 0) { return false; }
+  auto n = recv(sock, buf, static_cast<int>(sizeof(buf)), MSG_PEEK);
+  if (n <= 0) { return true; }
+  std::string headers(buf, n);
+  auto end = headers.find("\r\n\r\n");
+  if (end == std::string::npos) {
+    // headers that don't fit into the buffer are not used for scheduling
+    return n == static_cast<int>(sizeof(buf));
+  }
+  headers.resize(end + 2);
+  std::string value;
+  if (find_peeked_header(headers, timeout_header, value)) {
+    info.timeout = parse_request_timeout(value);
+  }
+  find_peeked_header(headers, client_header, info.client);
+  return true;
+}
+
 inline int shutdown_socket(socket_t sock) {
 #ifdef _WIN32
   return shutdown(sock, SD_BOTH);
@@ -1138,8 +1242,10 @@ inline const char *find_content_type(const std::string &path) {
 
 inline const char *status_message(int status) {
   switch (status) {
+  case 101: return "Switching Protocols";
   case 200: return "OK";
   case 201: return "Created";
+  case 202: return "Accepted";
   case 204: return "No Content";
   case 206: return "Partial Content";
   case 301: return "Moved Permanently";
@@ -1157,6 +1263,10 @@ inline const char *status_message(int status) {
   case 416: return "Range Not Satisfiable";
   case 422: return "Unprocessable Entity";
   case 423: return "Locked";
+  case 429: return "Too Many Requests";
+  case 499: return "Client Closed Request";
+  case 503: return "Service Unavailable";
+  case 504: return "Gateway Timeout";
 
   default:
   case 500: return "Internal Server Error";
@@ -2020,6 +2130,14 @@ inline void Response::set_chunked_content_provider(
 }
 
 // Rstream implementation
+inline int Stream::write_gather(const char *ptr1, size_t size1,
+                                const char *ptr2, size_t size2) {
+  auto n1 = write(ptr1, size1);
+  if (n1 < 0) { return n1; }
+  auto n2 = write(ptr2, size2);
+  return n2 < 0 ? n2 : n1 + n2;
+}
+
 template <typename... Args>
 inline int Stream::write_format(const char *fmt, const Args &... args) {
   const auto bufsiz = 2048;
@@ -2075,6 +2193,42 @@ inline int SocketStream::write(const std::string &s) {
   return write(s.data(), s.size());
 }
 
+#ifndef _WIN32
+inline int SocketStream::write_gather(const char *ptr1, size_t size1,
+                                      const char *ptr2, size_t size2) {
+  struct iovec iov[2] = {{const_cast<char *>(ptr1), size1},
+                         {const_cast<char *>(ptr2), size2}};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  size_t left = size1 + size2;
+  while (left > 0) {
+    auto n = sendmsg(sock_, &msg, 0);
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n <= 0) { return -1; }
+    left -= n;
+    // skip the part that has been sent
+    while (msg.msg_iovlen > 0 && static_cast<size_t>(n) >= msg.msg_iov->iov_len) {
+      n -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if (msg.msg_iovlen > 0) {
+      msg.msg_iov->iov_base = static_cast<char *>(msg.msg_iov->iov_base) + n;
+      msg.msg_iov->iov_len -= n;
+    }
+  }
+  return static_cast<int>(size1 + size2);
+}
+#endif
+
+inline bool SocketStream::is_peer_closed() const {
+  if (detail::select_read(sock_, 0, 0) <= 0) { return false; }
+  char c;
+  return recv(sock_, &c, 1, MSG_PEEK) <= 0;
+}
+
 inline std::string SocketStream::get_remote_addr() const {
   return detail::get_remote_addr(sock_);
 }
@@ -2110,7 +2264,7 @@ template<class W>
 inline Server<W>::Server(std::function<TaskQueue<W>*()> tq)
     : keep_alive_max_count_(CPPHTTPLIB_KEEPALIVE_MAX_COUNT),
       payload_max_length_(CPPHTTPLIB_PAYLOAD_MAX_LENGTH), is_running_(false),
-      svr_sock_(INVALID_SOCKET) {
+      svr_sock_(INVALID_SOCKET), stop_accepting_(false) {
 #ifndef _WIN32
   signal(SIGPIPE, SIG_IGN);
 #endif
@@ -2132,6 +2286,12 @@ inline Server<W> &Server<W>::Post(const char *pattern, Handler handler) {
   return *this;
 }
 
+template<class W>
+inline Server<W> &Server<W>::Delete(const char *pattern, Handler handler) {
+  delete_handlers_.push_back(std::make_pair(std::regex(pattern), handler));
+  return *this;
+}
+
 template<class W>
 inline Server<W>& Server<W>::Options(const char* pattern, Handler handler) {
     options_handlers_.push_back(std::make_pair(std::regex(pattern), handler));
@@ -2170,6 +2330,32 @@ inline void Server<W>::set_payload_max_length(size_t length) {
   payload_max_length_ = length;
 }
 
+template<class W>
+inline void Server<W>::set_payload_max_length(const char *path,
+                                              size_t length) {
+  path_payload_max_length_[path] = length;
+}
+
+template<class W>
+inline void Server<W>::stream_request_body(const char *path) {
+  streamed_body_paths_.insert(path);
+}
+
+template<class W>
+inline void Server<W>::set_timeout_header(const char *name) {
+  timeout_header_ = name;
+}
+
+template<class W>
+inline void Server<W>::set_client_header(const char *name) {
+  client_header_ = name;
+}
+
+template<class W>
+inline bool Server<W>::bind_to_port(const char *host, int port, int socket_flags) {
+  return bind_internal(host, port, socket_flags) >= 0;
+}
+
 template<class W>
 inline int Server<W>::bind_to_any_port(const char *host, int socket_flags) {
   return bind_internal(host, 0, socket_flags);
@@ -2197,6 +2383,63 @@ inline void Server<W>::stop() {
   }
 }
 
+template<class W>
+inline bool Server<W>::adopt_socket(socket_t sock) {
+  if (!is_valid() || sock == INVALID_SOCKET) { return false; }
+  svr_sock_ = sock;
+  return true;
+}
+
+// Unlike 'stop', this doesn't shut down the socket, so another process
+// with a copy of the socket can continue accepting connections.
+template<class W>
+inline void Server<W>::stop_accepting() {
+  stop_accepting_ = true;
+}
+
+template<class W>
+inline void Server<W>::copy_handlers(const Server &other) {
+  base_dir_ = other.base_dir_;
+  file_request_handler_ = other.file_request_handler_;
+  get_handlers_ = other.get_handlers_;
+  post_handlers_ = other.post_handlers_;
+  put_handlers_ = other.put_handlers_;
+  patch_handlers_ = other.patch_handlers_;
+  delete_handlers_ = other.delete_handlers_;
+  options_handlers_ = other.options_handlers_;
+  error_handler_ = other.error_handler_;
+  logger_ = other.logger_;
+  h2c_handler_ = other.h2c_handler_;
+  keep_alive_max_count_ = other.keep_alive_max_count_;
+  payload_max_length_ = other.payload_max_length_;
+  path_payload_max_length_ = other.path_payload_max_length_;
+  streamed_body_paths_ = other.streamed_body_paths_;
+  timeout_header_ = other.timeout_header_;
+  client_header_ = other.client_header_;
+}
+
+template<class W>
+inline void Server<W>::set_h2c_handler(H2cHandler handler) {
+  h2c_handler_ = handler;
+}
+
+template<class W>
+inline void Server<W>::handle_request(W &worker, Request &req, Response &res) {
+  if (routing(worker, req, res)) {
+    if (res.status == -1) { res.status = 200; }
+  } else {
+    res.status = 404;
+  }
+  if (400 <= res.status && error_handler_) { error_handler_(worker, req, res); }
+  if (logger_) { logger_(worker, req, res); }
+}
+
+template<class W>
+inline size_t Server<W>::get_payload_max_length(const std::string &path) const {
+  auto it = path_payload_max_length_.find(path);
+  return it != path_payload_max_length_.end() ? it->second : payload_max_length_;
+}
+
 template<class W>
 inline bool Server<W>::parse_request_line(const char *s, Request &req) {
   static std::regex re("(GET|HEAD|POST|PUT|PATCH|DELETE|OPTIONS) "
@@ -2227,21 +2470,25 @@ inline bool Server<W>::write_response(W& worker, Stream &strm, bool last_connect
   if (400 <= res.status && error_handler_) { error_handler_(worker, req, res); }
 
   // Response line
-  if (!strm.write_format("HTTP/1.1 %d %s\r\n", res.status,
-                         detail::status_message(res.status))) {
-    return false;
-  }
+  //Elekto: the response line and the headers are sent with the body in one write,
+  //so TCP_NODELAY doesn't split the response into small segments
+  BufferStream head;
+  head.write_format("HTTP/1.1 %d %s\r\n", res.status,
+                    detail::status_message(res.status));
 
   // Headers
-  if (last_connection || req.get_header_value("Connection") == "close") {
+  if ((last_connection || req.get_header_value("Connection") == "close") &&
+      !res.has_header("Connection")) {
     res.set_header("Connection", "close");
   }
 
-  if (!last_connection && req.get_header_value("Connection") == "Keep-Alive") {
+  if (!last_connection && req.get_header_value("Connection") == "Keep-Alive" &&
+      !res.has_header("Connection")) {
     res.set_header("Connection", "Keep-Alive");
   }
 
-  if (res.status != 204 && !res.has_header("Content-Type")) {
+  //Elekto: a 101 response has no body
+  if (res.status != 101 && res.status != 204 && !res.has_header("Content-Type")) {
     res.set_header("Content-Type", "text/plain");
   }
 
@@ -2287,7 +2534,7 @@ inline bool Server<W>::write_response(W& worker, Stream &strm, bool last_connect
     } else {
       if (res.content_provider) {
         res.set_header("Transfer-Encoding", "chunked");
-      } else if (res.status != 204) {
+      } else if (res.status != 101 && res.status != 204) {
         res.set_header("Content-Length", "0");
       }
     }
@@ -2323,13 +2570,20 @@ inline bool Server<W>::write_response(W& worker, Stream &strm, bool last_connect
     res.set_header("Content-Length", length);
   }
 
-  if (!detail::write_headers(strm, res, Headers())) { return false; }
+  detail::write_headers(head, res, Headers());
 
   // Body
+  if (req.method != "HEAD" && !res.body.empty()) {
+    auto &buffer = head.get_buffer();
+    if (strm.write_gather(buffer.data(), buffer.size(), res.body.data(),
+                          res.body.size()) < 0) {
+      return false;
+    }
+  } else if (strm.write(head.get_buffer()) < 0) {
+    return false;
+  }
   if (req.method != "HEAD") {
-    if (!res.body.empty()) {
-      if (!strm.write(res.body)) { return false; }
-    } else if (res.content_provider) {
+    if (res.content_provider && res.body.empty()) {
       if (!write_content_with_provider(strm, req, res, boundary,
                                        content_type)) {
         return false;
@@ -2447,7 +2701,8 @@ inline bool Server<W>::listen_internal() {
   is_running_ = true;
 
   {
-    std::unique_ptr<TaskQueue<W>> task_queue(new_task_queue());
+    // The task queue is owned by the caller
+    TaskQueue<W> *task_queue = new_task_queue();
 
     for (;;) {
       if (svr_sock_ == INVALID_SOCKET) {
@@ -2455,6 +2710,11 @@ inline bool Server<W>::listen_internal() {
         break;
       }
 
+      if (stop_accepting_) {
+        detail::close_socket(svr_sock_.exchange(INVALID_SOCKET));
+        break;
+      }
+
       auto val = detail::select_read(svr_sock_, 0, 100000);
 
       if (val == 0) { // Timeout
@@ -2473,7 +2733,23 @@ inline bool Server<W>::listen_internal() {
         break;
       }
 
-      task_queue->enqueue([=](W& worker) { process_and_close_socket(worker, sock); });
+      //Elekto: streamed responses are written in small chunks that must not wait for ACKs
+      int nodelay = 1;
+      setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char*>(&nodelay), sizeof(nodelay));
+
+      auto accepted = std::chrono::steady_clock::now();
+      Task<W> task;
+      task.run = [=](W& worker) { process_and_close_socket(worker, sock, accepted); };
+      task.reject = [=](int status, int retry_after) { reject_socket(sock, status, retry_after); };
+      task.remote_addr = detail::get_remote_addr(sock);
+      if (!timeout_header_.empty() || !client_header_.empty()) {
+        auto timeout_header = timeout_header_;
+        auto client_header = client_header_;
+        task.peek = [=](RequestInfo &info) {
+          return detail::peek_request_info(sock, timeout_header, client_header, info);
+        };
+      }
+      task_queue->enqueue(task);
     }
 
     task_queue->shutdown();
@@ -2491,6 +2767,8 @@ inline bool Server<W>::routing(W& worker, Request &req, Response &res) {
     return dispatch_request(worker, req, res, get_handlers_);
   } else if (req.method == "POST") {
     return dispatch_request(worker, req, res, post_handlers_);
+  } else if (req.method == "DELETE") {
+    return dispatch_request(worker, req, res, delete_handlers_);
   } else if (req.method == "OPTIONS") {
     return dispatch_request(worker, req, res, options_handlers_);
   }
@@ -2516,7 +2794,8 @@ template<class W>
 inline bool
 Server<W>::process_request(W& worker, Stream &strm, bool last_connection,
                         bool &connection_close,
-                        std::function<void(Request &)> setup_request) {
+                        std::function<void(Request &)> setup_request,
+                        std::function<void(socket_t)> *upgrade) {
   constexpr auto bufsiz = 2048;
   char buf[bufsiz];
 
@@ -2525,6 +2804,13 @@ Server<W>::process_request(W& worker, Stream &strm, bool last_connection,
   // Connection has been closed on client
   if (!reader.getline()) { return false; }
 
+  //Elekto: the rest of the HTTP/2 preface is read by the h2c handler
+  if (h2c_handler_ && upgrade && !strcmp(reader.ptr(), "PRI * HTTP/2.0\r\n")) {
+    connection_close = true;
+    *upgrade = [this, &worker](socket_t sock) { h2c_handler_(worker, sock, nullptr); };
+    return true;
+  }
+
   Request req;
   Response res;
 
@@ -2557,28 +2843,64 @@ Server<W>::process_request(W& worker, Stream &strm, bool last_connection,
   req.remote_addr = strm.get_remote_addr();
 
   // Body
+  auto body_pending = false;
   if (req.method == "POST" || req.method == "PUT" || req.method == "PATCH") {
-    if (!detail::read_content(strm, req, payload_max_length_, res.status,
-                              Progress(), [&](const char *buf, size_t n) {
-                                if (req.body.size() + n > req.body.max_size()) {
-                                  return false;
-                                }
-                                req.body.append(buf, n);
-                                return true;
-                              })) {
-      return write_response(worker, strm, last_connection, req, res);
+    auto payload_max_length = payload_max_length_;
+    auto it = path_payload_max_length_.find(req.path);
+    if (it != path_payload_max_length_.end()) {
+      payload_max_length = it->second;
     }
+    if (streamed_body_paths_.count(req.path)) {
+      //Elekto: the handler reads the body while it processes it; the
+      //connection is closed if the handler doesn't read the whole body
+      body_pending = detail::is_chunked_transfer_encoding(req.headers) ||
+                     detail::get_header_value_uint64(req.headers, "Content-Length", 0) > 0;
+      req.read_body = [&, payload_max_length](ContentReceiver receiver, int &status) {
+        if (!body_pending) { return true; }
+        auto length = detail::get_header_value_uint64(req.headers, "Content-Length", 0);
+        uint64_t offset = 0;
+        auto too_large = false;
+        auto ret = detail::read_content(strm, req, payload_max_length, status,
+                                        Progress(), [&](const char *buf, size_t n) {
+                                          if (offset + n > payload_max_length) {
+                                            too_large = true;
+                                            return false;
+                                          }
+                                          auto ok = receiver(buf, n, offset, length);
+                                          offset += n;
+                                          return ok;
+                                        });
+        if (too_large) { status = 413; }
+        body_pending = !ret;
+        return ret;
+      };
+    } else {
+      // chunked bodies have no Content-Length to check in advance
+      auto too_large = false;
+      if (!detail::read_content(strm, req, payload_max_length, res.status,
+                                Progress(), [&](const char *buf, size_t n) {
+                                  if (req.body.size() + n > payload_max_length) {
+                                    too_large = true;
+                                    return false;
+                                  }
+                                  req.body.append(buf, n);
+                                  return true;
+                                })) {
+        if (too_large) { res.status = 413; }
+        return write_response(worker, strm, last_connection, req, res);
+      }
 
-    const auto &content_type = req.get_header_value("Content-Type");
+      const auto &content_type = req.get_header_value("Content-Type");
 
-    if (!content_type.find("application/x-www-form-urlencoded")) {
-      detail::parse_query_text(req.body, req.params);
-    } else if (!content_type.find("multipart/form-data")) {
-      std::string boundary;
-      if (!detail::parse_multipart_boundary(content_type, boundary) ||
-          !detail::parse_multipart_formdata(boundary, req.body, req.files)) {
-        res.status = 400;
-        return write_response(worker, strm, last_connection, req, res);
+      if (!content_type.find("application/x-www-form-urlencoded")) {
+        detail::parse_query_text(req.body, req.params);
+      } else if (!content_type.find("multipart/form-data")) {
+        std::string boundary;
+        if (!detail::parse_multipart_boundary(content_type, boundary) ||
+            !detail::parse_multipart_formdata(boundary, req.body, req.files)) {
+          res.status = 400;
+          return write_response(worker, strm, last_connection, req, res);
+        }
       }
     }
   }
@@ -2591,6 +2913,21 @@ Server<W>::process_request(W& worker, Stream &strm, bool last_connection,
     }
   }*/
 
+  //Elekto: the upgrade request is answered on stream 1 of the HTTP/2 connection
+  if (h2c_handler_ && upgrade && !body_pending &&
+      req.get_header_value("Upgrade") == "h2c" && req.has_header("HTTP2-Settings")) {
+    if (strm.write("HTTP/1.1 101 Switching Protocols\r\n"
+                   "Connection: Upgrade\r\nUpgrade: h2c\r\n\r\n") < 0) {
+      return false;
+    }
+    connection_close = true;
+    auto upgrade_req = std::make_shared<Request>(std::move(req));
+    *upgrade = [this, &worker, upgrade_req](socket_t sock) {
+      h2c_handler_(worker, sock, upgrade_req.get());
+    };
+    return true;
+  }
+
   if (setup_request) { setup_request(req); }
 
   if (routing(worker, req, res)) {
@@ -2599,20 +2936,67 @@ Server<W>::process_request(W& worker, Stream &strm, bool last_connection,
     res.status = 404;
   }
 
-  return write_response(worker, strm, last_connection, req, res);
+  if (body_pending && !res.has_header("Connection")) {
+    res.set_header("Connection", "close");
+  }
+
+  if (res.get_header_value("Connection") == "close") {
+    connection_close = true;
+  }
+
+  auto ret = write_response(worker, strm, last_connection, req, res);
+
+  //Elekto: the connection is handed over after the 101 response has been sent
+  if (ret && res.status == 101 && res.upgrade && upgrade) {
+    connection_close = true;
+    *upgrade = std::move(res.upgrade);
+  }
+
+  return ret;
 }
 
 template<class W>
 inline bool Server<W>::is_valid() const { return true; }
 
 template<class W>
-inline bool Server<W>::process_and_close_socket(W& worker, socket_t sock) {
-  return detail::process_and_close_socket(
+inline bool Server<W>::process_and_close_socket(W& worker, socket_t sock,
+                                                std::chrono::steady_clock::time_point accepted) {
+  auto first = true;
+  std::function<void(socket_t)> upgrade;
+  auto upgraded = false;
+  auto ret = detail::process_and_close_socket(
       false, sock, keep_alive_max_count_,
-      [this, &worker](Stream &strm, bool last_connection, bool &connection_close) {
-        return process_request(worker, strm, last_connection, connection_close,
-                               nullptr);
-      });
+      [&](Stream &strm, bool last_connection, bool &connection_close) {
+        // the first request has been waiting since the connection was accepted
+        auto received = first ? accepted : std::chrono::steady_clock::now();
+        first = false;
+        auto ret = process_request(worker, strm, last_connection, connection_close,
+                                   [&](Request &req) {
+                                     req.received = received;
+                                     req.is_connection_closed = [&strm] { return strm.is_peer_closed(); };
+                                   }, &upgrade);
+        upgraded = static_cast<bool>(upgrade);
+        return ret;
+      }, &upgraded);
+  //Elekto: the upgraded connection is passed on with its socket
+  if (upgraded) { upgrade(sock); }
+  return ret;
+}
+
+template<class W>
+inline void Server<W>::reject_socket(socket_t sock, int status, int retry_after) {
+  // Discard the request that has already arrived, so closing the socket
+  // doesn't reset the connection before the client reads the response
+  char buf[4096];
+  while (detail::select_read(sock, 0, 0) > 0 &&
+         recv(sock, buf, static_cast<int>(sizeof(buf)), 0) > 0) {}
+  SocketStream strm(sock);
+  strm.write_format("HTTP/1.1 %d %s\r\n", status, detail::status_message(status));
+  if (retry_after > 0) {
+    strm.write("Retry-After: " + std::to_string(retry_after) + "\r\n");
+  }
+  strm.write("Content-Length: 0\r\nConnection: close\r\n\r\n");
+  detail::close_socket(sock);
 }
 
 // HTTP client implementation
@@ -28,33 +28,91 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <iostream>
 #include <stdexcept>
+#include <vector>
+#include <memory>
 #include "utility.h"
+#include "hex.h"
 #include "service.h"
+#include "upgrade.h"
+#include "resource_limits.h"
 
 void printUsage(const char* exe) {
 	std::cout << "RandomX Service v" RANDOMX_SERVICE_VERSION << std::endl;
 	std::cout << "Usage: " << exe << " [OPTIONS]" << std::endl;
 	std::cout << "Supported options:" << std::endl;
-	std::cout << "  -host <string>     Bind to a specific address (default: localhost)" << std::endl
-		<< "  -port <number>     Bind to a specific port (default: 39093)" << std::endl
-		<< "  -threads <number>  Use a specific number of threads (default: all CPU threads)" << std::endl
-		<< "  -flags <number>    Use specific RandomX flags (default: auto)" << std::endl
-		<< "  -origin <string>   Allow cross-origin requests from a specific web page" << std::endl
-		<< "  -log               Log all HTTP requests to stdout" << std::endl
-		<< "  -help              Display this message" << std::endl;
+	std::cout << "  -host <string>         Bind to a specific address (default: localhost)" << std::endl
+		<< "  -port <number>         Bind to a specific port (default: 39093)" << std::endl
+		<< "  -threads <number>      Use a specific number of threads (default: available CPUs)" << std::endl
+		<< "  -flags <number>        Use specific RandomX flags (default: auto)" << std::endl
+		<< "  -partitions <list>     Split the threads into partitions with their own ports (see README)" << std::endl
+		<< "  -origin <string>       Allow cross-origin requests from a specific web page" << std::endl
+		<< "  -affinity              Pin worker threads to CPU cores" << std::endl
+		<< "  -autotune <objective>  Select threads and flags for the best hashrate or latency, enables POST /autotune" << std::endl
+		<< "  -autotune-file <path>  Save the autotuning result and reuse it on the next start" << std::endl
+		<< "  -seed <hex>            Initialize the service with a seed before binding" << std::endl
+		<< "  -dataset-dir <path>    Save initialized datasets to a directory and reuse them" << std::endl
+		<< "  -shared-dataset <path> Share the dataset with other processes using the same directory" << std::endl
+		<< "  -pages <1g|2m|thp|4k>  Largest page size tried for the dataset (default: 1g)" << std::endl
+		<< "  -mlock                 Lock the dataset and cache in memory" << std::endl
+		<< "  -idle-timeout <min>    Release the dataset after a number of minutes without hash requests" << std::endl
+		<< "  -idle-mode <mode>      Use light mode (light) or release all memory (sleep) when idle" << std::endl
+		<< "  -queue-limit <number>  Limit the number of connections waiting for a worker (default: 0 = unlimited)" << std::endl
+		<< "  -queue-policy <policy> Reject new connections (reject) or the oldest pending one (drop-oldest)" << std::endl
+		<< "  -max-batch <number>    Maximum number of inputs in a batch (default: 256)" << std::endl
+		<< "  -max-payload <bytes>   Maximum size of a batch request (default: 20000)" << std::endl
+		<< "  -max-job <number>      Maximum number of inputs in a bulk job (default: 1048576)" << std::endl
+		<< "  -job-payload <bytes>   Maximum size of a bulk job request (default: 67108864)" << std::endl
+		<< "  -cache <entries>       Cache recent hashes and merge identical requests (default: 0 = off)" << std::endl
+		<< "  -spin <microseconds>   Idle workers wait actively before they sleep (default: 0)" << std::endl
+		<< "  -fair-share <identity> Share the workers among clients by address, key or listener (default)" << std::endl
+		<< "  -max-conns <number>    Limit the number of connections of each client (default: 0 = unlimited)" << std::endl
+		<< "  -max-hashrate <number> Limit the hashes per second of each client (default: 0 = unlimited)" << std::endl
+		<< "  -upgrade               Enable upgrades with SIGUSR2 or POST /upgrade" << std::endl
+		<< "  -early-bind            Accept requests while the seed is initialized (see -seed)" << std::endl
+		<< "  -h2c                   Accept HTTP/2 connections without TLS (see README)" << std::endl
+		<< "  -log                   Log all HTTP requests to stdout" << std::endl
+		<< "  -help                  Display this message" << std::endl;
 }
 
 int main(int argc, char** argv) {
-	std::string host, origin;
-	int port, threads, flags;
-	bool help, log;
+	std::string host, origin, seedHex, datasetDir, pages, autotune, tuneFile, idleMode, partitionList, queuePolicy, fairShare;
+	std::vector<randomx::PartitionOptions> partitions;
+	randomx::MemoryOptions memory;
+	int port, threads, flags, idleTimeout, queueLimit, spinTime, maxBatch, maxPayload, maxJob, jobPayload, cacheSize, maxConns, maxHashrate;
+	bool help, log, affinity, earlyBind, upgrade, h2c;
 
 	readStringOption("-host", argc, argv, host, "localhost");
 	readIntOption("-port", argc, argv, port, 39093);
-	readIntOption("-threads", argc, argv, threads, randomx::Service::getMachineThreads());
+	readIntOption("-threads", argc, argv, threads, 0);
+	readStringOption("-partitions", argc, argv, partitionList, "");
 	readIntOption("-flags", argc, argv, flags, randomx::Service::getAutoFlags());
 	readStringOption("-origin", argc, argv, origin, "");
+	readStringOption("-seed", argc, argv, seedHex, "");
+	readStringOption("-dataset-dir", argc, argv, datasetDir, "");
+	readStringOption("-shared-dataset", argc, argv, memory.sharedDatasetDir, "");
+	readStringOption("-pages", argc, argv, pages, "1g");
+	readOption("-mlock", argc, argv, memory.lock);
+	readOption("-affinity", argc, argv, affinity);
+	readStringOption("-autotune", argc, argv, autotune, "");
+	readStringOption("-autotune-file", argc, argv, tuneFile, "");
+	readIntOption("-idle-timeout", argc, argv, idleTimeout, 0);
+	readStringOption("-idle-mode", argc, argv, idleMode, "light");
+	readIntOption("-queue-limit", argc, argv, queueLimit, 0);
+	readStringOption("-queue-policy", argc, argv, queuePolicy, "reject");
+	readIntOption("-spin", argc, argv, spinTime, 0);
+	readIntOption("-max-batch", argc, argv, maxBatch, SERVICE_MAX_BATCH_SIZE);
+	readIntOption("-max-payload", argc, argv, maxPayload, SERVICE_MAX_PAYLOAD);
+	readIntOption("-max-job", argc, argv, maxJob, SERVICE_MAX_JOB_SIZE);
+	readIntOption("-job-payload", argc, argv, jobPayload, SERVICE_MAX_JOB_PAYLOAD);
+	readIntOption("-cache", argc, argv, cacheSize, 0);
+	readStringOption("-fair-share", argc, argv, fairShare, "listener");
+	readIntOption("-max-conns", argc, argv, maxConns, 0);
+	readIntOption("-max-hashrate", argc, argv, maxHashrate, 0);
+	readOption("-early-bind", argc, argv, earlyBind);
+	readOption("-upgrade", argc, argv, upgrade);
+	readIntOption("-upgrade-fd", argc, argv, memory.upgradeFd, -1);
 	readOption("-log", argc, argv, log);
+	readOption("-h2c", argc, argv, h2c);
 	readOption("-help", argc, argv, help);
 
 	if (help) {
@@ -62,10 +120,91 @@ int main(int argc, char** argv) {
 		return 0;
 	}
 
+	if (!randomx::parsePageStrategy(pages, memory.pages)) {
+		std::cout << "ERROR: Invalid page size " << pages << std::endl;
+		return 1;
+	}
+
+	if (!partitionList.empty()) {
+		if (!randomx::parsePartitions(partitionList, partitions)) {
+			std::cout << "ERROR: Invalid partitions " << partitionList << std::endl;
+			return 1;
+		}
+		if (upgrade) {
+			std::cout << "ERROR: -upgrade is not supported with -partitions" << std::endl;
+			return 1;
+		}
+		threads = 0;
+		for (auto& partition : partitions) {
+			threads += partition.threads;
+		}
+	}
+
+	if (threads == 0) {
+		auto limits = randomx::getResourceLimits();
+		threads = limits.getThreads();
+		std::cout << "Available CPUs: " << limits.cpus;
+		if (limits.cpuCgroup > 0) {
+			std::cout << ", CPU quota: " << limits.cpuQuota << " (cgroup v" << limits.cpuCgroup << ")";
+		}
+		std::cout << std::endl;
+	}
+
+	randomx::TuneObjective objective = randomx::TuneObjective::Hashrate;
+	if (!autotune.empty() && !randomx::parseTuneObjective(autotune, objective)) {
+		std::cout << "ERROR: Invalid autotune objective " << autotune << std::endl;
+		return 1;
+	}
+
+	if (idleMode != "light" && idleMode != "sleep") {
+		std::cout << "ERROR: Invalid idle mode " << idleMode << std::endl;
+		return 1;
+	}
+
+	if (queueLimit < 0 || (queuePolicy != "reject" && queuePolicy != "drop-oldest")) {
+		std::cout << "ERROR: Invalid queue limit " << queueLimit << " or policy " << queuePolicy << std::endl;
+		return 1;
+	}
+
+	if (maxBatch <= 0 || maxPayload <= 0) {
+		std::cout << "ERROR: Invalid batch limits " << maxBatch << ", " << maxPayload << std::endl;
+		return 1;
+	}
+
+	if (maxJob <= 0 || jobPayload <= 0) {
+		std::cout << "ERROR: Invalid job limits " << maxJob << ", " << jobPayload << std::endl;
+		return 1;
+	}
+
+	if (cacheSize < 0 || cacheSize > 16777216) {
+		std::cout << "ERROR: Invalid cache size " << cacheSize << std::endl;
+		return 1;
+	}
+
+	if (spinTime < 0 || spinTime > 1000000) {
+		std::cout << "ERROR: Invalid spin time " << spinTime << std::endl;
+		return 1;
+	}
+
+	randomx::ClientLimits clientLimits;
+	if (!randomx::parseClientIdentity(fairShare, clientLimits.identity) || maxConns < 0 || maxHashrate < 0) {
+		std::cout << "ERROR: Invalid client identity " << fairShare << " or limits" << std::endl;
+		return 1;
+	}
+	clientLimits.connections = maxConns;
+	clientLimits.hashrate = maxHashrate;
+
+	if (upgrade) {
+		randomx::UpgradeSignal::block();
+	}
+
 	try {
 		std::cout << "Initializing service..." << std::endl;
-		randomx::Service svc(threads, flags);
+		randomx::Service svc(threads, flags, memory, partitions);
 		std::cout << "Threads: " << threads << ", Flags: " << svc.getFlags() << std::endl;
+		for (auto& partition : partitions) {
+			std::cout << "Partition " << partition.name << ": " << partition.threads << " threads" << (partition.light ? ", light mode" : "") << std::endl;
+		}
 		if (!origin.empty()) {
 			std::cout << "Setting origin to " << origin << std::endl;
 			svc.setOrigin(origin);
@@ -74,9 +213,110 @@ int main(int argc, char** argv) {
 			std::cout << "Logging is enabled" << std::endl;
 			svc.enableLog();
 		}
-		std::cout << "Binding to " << host << ":" << port << "..." << std::endl;
-		if (!svc.run(host.data(), port)) {
-			throw std::runtime_error("Failed to bind");
+		if (h2c) {
+			std::cout << "Accepting HTTP/2 connections without TLS" << std::endl;
+			svc.enableH2c();
+		}
+		if (affinity) {
+			std::cout << "Pinning threads to CPU cores" << std::endl;
+			svc.pinThreads();
+		}
+		if (!memory.sharedDatasetDir.empty()) {
+			std::cout << "Shared dataset directory: " << memory.sharedDatasetDir << std::endl;
+		}
+		if (!datasetDir.empty()) {
+			std::cout << "Dataset directory: " << datasetDir << std::endl;
+			svc.setDatasetDir(datasetDir);
+		}
+		if (idleTimeout > 0) {
+			std::cout << "Idle timeout: " << idleTimeout << " minutes (" << idleMode << ")" << std::endl;
+			svc.enableIdleRelease(idleTimeout, idleMode == "sleep");
+		}
+		if (queueLimit > 0) {
+			std::cout << "Queue limit: " << queueLimit << " connections (" << queuePolicy << ")" << std::endl;
+			svc.setQueueLimit(queueLimit, queuePolicy == "drop-oldest");
+		}
+		if (maxBatch != SERVICE_MAX_BATCH_SIZE || maxPayload != SERVICE_MAX_PAYLOAD) {
+			std::cout << "Batch limits: " << maxBatch << " inputs, " << maxPayload << " bytes" << std::endl;
+		}
+		svc.setBatchLimits(maxBatch, maxPayload);
+		svc.setJobLimits(maxJob, jobPayload);
+		if (cacheSize > 0) {
+			std::cout << "Hash cache: " << cacheSize << " entries" << std::endl;
+			svc.enableHashCache(cacheSize);
+		}
+		if (spinTime > 0) {
+			std::cout << "Idle workers spin for " << spinTime << " us" << std::endl;
+			svc.setSpinTime(spinTime);
+			if (threads >= randomx::Service::getMachineThreads()) {
+				std::cout << "WARNING: The workers use all available CPUs, so spinning workers delay the other threads" << std::endl;
+			}
+		}
+		if (clientLimits.identity != randomx::ClientIdentity::Listener || maxConns > 0 || maxHashrate > 0) {
+			std::cout << "Fair share by " << fairShare << ", connections: " << maxConns << ", hashes per second: " << maxHashrate << " (0 = unlimited)" << std::endl;
+		}
+		if (clientLimits.identity == randomx::ClientIdentity::Listener && (maxConns > 0 || maxHashrate > 0)) {
+			std::cout << "WARNING: With -fair-share listener, the limits apply to each partition as a whole, not to each client" << std::endl;
+		}
+		svc.setClientLimits(clientLimits);
+		bool tuned = false;
+		if (!autotune.empty()) {
+			svc.enableAutotune(objective, tuneFile);
+		}
+		if (!autotune.empty() && svc.loadTuning()) {
+			std::cout << "Using the autotuning result from " << tuneFile << std::endl;
+			tuned = true;
+		}
+		std::unique_ptr<randomx::UpgradeSignal> upgradeSignal;
+		if (upgrade) {
+			svc.enableUpgrade(std::vector<std::string>(argv, argv + argc));
+			upgradeSignal.reset(new randomx::UpgradeSignal([&svc] { svc.upgrade(); }));
+		}
+		if (memory.upgradeFd >= 0) {
+			std::cout << "Taking over from the upgraded process..." << std::endl;
+			if (!svc.resumeUpgrade()) {
+				throw std::runtime_error("Failed to take over the listening socket");
+			}
+		}
+		else {
+			if (earlyBind) {
+				std::cout << "Binding to " << host << ":" << port << "..." << std::endl;
+				if (!svc.bind(host.data(), port)) {
+					throw std::runtime_error("Failed to bind");
+				}
+			}
+			if (!seedHex.empty()) {
+				std::vector<char> seed(seedHex.size() / 2);
+				if (!hex2bin(seedHex.data(), seedHex.size(), seed.data()) || seed.size() > 60) {
+					throw std::runtime_error("Invalid seed");
+				}
+				std::cout << "Initializing seed " << seedHex << "..." << std::endl;
+				if (earlyBind) {
+					svc.reseedAsync(std::string(seed.data(), seed.size()));
+				}
+				else {
+					svc.reseed(seed.data(), seed.size());
+				}
+			}
+			if (!autotune.empty() && !tuned) {
+				std::vector<randomx::TuneResult> results;
+				randomx::TuneResult best;
+				if (seedHex.empty() || earlyBind) {
+					std::cout << "Autotuning at startup requires -seed without -early-bind (see POST /autotune)" << std::endl;
+				}
+				else if (!svc.autotune(nullptr, objective, results, best)) {
+					std::cout << "Autotuning was not successful" << std::endl;
+				}
+			}
+			if (!earlyBind) {
+				std::cout << "Binding to " << host << ":" << port << "..." << std::endl;
+				if (!svc.bind(host.data(), port)) {
+					throw std::runtime_error("Failed to bind");
+				}
+			}
+		}
+		if (!svc.run()) {
+			throw std::runtime_error("Failed to listen");
 		}
 	}
 	catch (const std::exception & e) {
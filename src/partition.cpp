@@ -0,0 +1,80 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "partition.h"
+#include <sstream>
+#include <cstdlib>
+
+namespace randomx {
+
+	static bool parseNumber(const std::string& text, int& value) {
+		char* end;
+		long number = std::strtol(text.c_str(), &end, 10);
+		if (text.empty() || *end != '\0' || number <= 0 || number > 65535) {
+			return false;
+		}
+		value = (int)number;
+		return true;
+	}
+
+	bool parsePartitions(const std::string& list, std::vector<PartitionOptions>& partitions) {
+		std::istringstream items(list);
+		std::string item;
+		while (std::getline(items, item, ',')) {
+			std::istringstream fields(item);
+			std::string field;
+			PartitionOptions partition = { "", 0, false, 0 };
+			if (!std::getline(fields, partition.name, ':') || partition.name.empty()) {
+				return false;
+			}
+			if (!std::getline(fields, field, ':') || !parseNumber(field, partition.threads)) {
+				return false;
+			}
+			while (std::getline(fields, field, ':')) {
+				if (field == "light") {
+					partition.light = true;
+				}
+				else if (field == "full") {
+					partition.light = false;
+				}
+				else if (!parseNumber(field, partition.port)) {
+					return false;
+				}
+			}
+			for (auto& other : partitions) {
+				if (other.name == partition.name) {
+					return false;
+				}
+			}
+			partitions.push_back(partition);
+		}
+		return !partitions.empty();
+	}
+
+}
@@ -0,0 +1,259 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "resource_limits.h"
+#include "cpu_topology.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include "../RandomX/src/randomx.h"
+#if defined(__linux__)
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <unistd.h>
+#endif
+
+namespace randomx {
+
+	int ResourceLimits::getThreads() const {
+		int threads = cpus;
+		if (cpuQuota > 0) {
+			threads = std::min(threads, std::max(1, (int)std::ceil(cpuQuota)));
+		}
+		return threads;
+	}
+
+	constexpr uint64_t CacheSize = 256 * 1024 * 1024;
+	//scratchpad, program buffers and JIT code
+	constexpr uint64_t MachineSize = 4 * 1024 * 1024;
+	//the executable, request buffers and other allocations
+	constexpr uint64_t ProcessSize = 64 * 1024 * 1024;
+
+	uint64_t getRequiredMemory(bool fullMem, int threads) {
+		uint64_t size = CacheSize + ProcessSize + (uint64_t)threads * MachineSize;
+		if (fullMem) {
+			size += (uint64_t)randomx_dataset_item_count() * RANDOMX_DATASET_ITEM_SIZE;
+		}
+		return size;
+	}
+
+#if defined(__linux__)
+	struct CgroupMount {
+		std::string root;
+		std::string mountPoint;
+		int version;
+		std::string controllers;
+	};
+
+	static bool hasController(const std::string& list, const std::string& controller) {
+		std::istringstream items(list);
+		std::string item;
+		while (std::getline(items, item, ',')) {
+			if (item == controller) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static std::vector<CgroupMount> getCgroupMounts() {
+		std::vector<CgroupMount> mounts;
+		std::ifstream f("/proc/self/mountinfo");
+		std::string line;
+		while (std::getline(f, line)) {
+			//36 25 0:31 / /sys/fs/cgroup/cpu,cpuacct rw,nosuid - cgroup cgroup rw,cpu,cpuacct
+			auto sep = line.find(" - ");
+			if (sep == std::string::npos) {
+				continue;
+			}
+			std::istringstream mount(line.substr(0, sep)), super(line.substr(sep + 3));
+			std::string id, parent, device, root, mountPoint, type, source, options;
+			mount >> id >> parent >> device >> root >> mountPoint;
+			super >> type >> source >> options;
+			if (type == "cgroup2") {
+				mounts.push_back({ root, mountPoint, 2, "" });
+			}
+			else if (type == "cgroup") {
+				mounts.push_back({ root, mountPoint, 1, options });
+			}
+		}
+		return mounts;
+	}
+
+	//Finds the cgroup directory of this process for a cgroup v1 controller
+	//or for cgroup v2 and returns the directory where the hierarchy is mounted.
+	static bool getCgroupDir(const std::vector<CgroupMount>& mounts, const std::string& controller, int version, std::string& dir, std::string& top) {
+		std::ifstream f("/proc/self/cgroup");
+		std::string line;
+		while (std::getline(f, line)) {
+			//hierarchy-ID:controller-list:cgroup-path
+			auto first = line.find(':');
+			auto second = line.find(':', first + 1);
+			if (first == std::string::npos || second == std::string::npos) {
+				continue;
+			}
+			auto controllers = line.substr(first + 1, second - first - 1);
+			auto path = line.substr(second + 1);
+			if (version == 2 ? !controllers.empty() : !hasController(controllers, controller)) {
+				continue;
+			}
+			for (auto& mount : mounts) {
+				if (mount.version != version || (version == 1 && !hasController(mount.controllers, controller))) {
+					continue;
+				}
+				top = mount.mountPoint;
+				dir = mount.mountPoint;
+				//the path is relative to the root of the mount unless the process is in a different cgroup namespace
+				if (mount.root == "/") {
+					dir += path == "/" ? "" : path;
+				}
+				else if (path.compare(0, mount.root.size(), mount.root) == 0) {
+					dir += path.substr(mount.root.size());
+				}
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//Reads the first number in a file. Returns false for "max" and for missing files.
+	static bool readLimit(const std::string& path, double& value, double& period) {
+		std::ifstream f(path);
+		std::string token;
+		if (!(f >> token) || token == "max") {
+			return false;
+		}
+		value = std::strtod(token.c_str(), nullptr);
+		if (!(f >> period)) {
+			period = 0;
+		}
+		return true;
+	}
+
+	//A limit also applies to all nested cgroups, so the lowest limit in the hierarchy is used.
+	template<typename Read>
+	static bool readHierarchy(std::string dir, const std::string& top, double& limit, Read read) {
+		bool found = false;
+		for (;;) {
+			double value;
+			if (read(dir, value) && (!found || value < limit)) {
+				limit = value;
+				found = true;
+			}
+			if (dir.size() <= top.size()) {
+				break;
+			}
+			dir = dir.substr(0, dir.rfind('/'));
+		}
+		return found;
+	}
+
+	//in hybrid setups, cgroup v2 is mounted without the controllers, so cgroup v1 is checked as well
+	static void getCpuQuota(const std::vector<CgroupMount>& mounts, ResourceLimits& limits) {
+		std::string dir, top;
+		if (getCgroupDir(mounts, "", 2, dir, top) && readHierarchy(dir, top, limits.cpuQuota, [](const std::string& dir, double& value) {
+			double quota, period;
+			if (!readLimit(dir + "/cpu.max", quota, period) || period <= 0) {
+				return false;
+			}
+			value = quota / period;
+			return true;
+		})) {
+			limits.cpuCgroup = 2;
+		}
+		else if (getCgroupDir(mounts, "cpu", 1, dir, top) && readHierarchy(dir, top, limits.cpuQuota, [](const std::string& dir, double& value) {
+			double quota, period, unused;
+			if (!readLimit(dir + "/cpu.cfs_quota_us", quota, unused) || quota <= 0 ||
+				!readLimit(dir + "/cpu.cfs_period_us", period, unused) || period <= 0) {
+				return false;
+			}
+			value = quota / period;
+			return true;
+		})) {
+			limits.cpuCgroup = 1;
+		}
+	}
+
+	static void getMemoryLimit(const std::vector<CgroupMount>& mounts, ResourceLimits& limits) {
+		std::string dir, top;
+		double memory;
+		long pages = sysconf(_SC_PHYS_PAGES);
+		long pageSize = sysconf(_SC_PAGESIZE);
+		if (pages > 0 && pageSize > 0) {
+			limits.memory = (uint64_t)pages * pageSize;
+		}
+		bool found = false;
+		int version = 0;
+		if (getCgroupDir(mounts, "", 2, dir, top) && readHierarchy(dir, top, memory, [](const std::string& dir, double& value) {
+			double unused;
+			return readLimit(dir + "/memory.max", value, unused);
+		})) {
+			found = true;
+			version = 2;
+		}
+		else if (getCgroupDir(mounts, "memory", 1, dir, top) && readHierarchy(dir, top, memory, [](const std::string& dir, double& value) {
+			double unused;
+			return readLimit(dir + "/memory.limit_in_bytes", value, unused);
+		})) {
+			found = true;
+			version = 1;
+		}
+		//cgroup v1 reports a huge number if there is no limit
+		if (found && (limits.memory == 0 || memory < limits.memory)) {
+			limits.memory = (uint64_t)memory;
+			limits.memoryCgroup = version;
+		}
+	}
+
+	ResourceLimits getResourceLimits() {
+		ResourceLimits limits;
+		limits.cpus = (int)getCpuTopology().size();
+		if (limits.cpus == 0) {
+			limits.cpus = std::max(1u, std::thread::hardware_concurrency());
+		}
+		auto mounts = getCgroupMounts();
+		getCpuQuota(mounts, limits);
+		getMemoryLimit(mounts, limits);
+		return limits;
+	}
+#else
+	ResourceLimits getResourceLimits() {
+		ResourceLimits limits;
+		limits.cpus = (int)getCpuTopology().size();
+		if (limits.cpus == 0) {
+			limits.cpus = std::max(1u, std::thread::hardware_concurrency());
+		}
+		return limits;
+	}
+#endif
+
+}
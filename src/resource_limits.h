@@ -0,0 +1,56 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+
+namespace randomx {
+
+	struct ResourceLimits {
+		//CPUs in the affinity mask of the process
+		int cpus = 0;
+		//CPU bandwidth limit of the cgroup in CPUs, 0 if unlimited
+		double cpuQuota = 0;
+		int cpuCgroup = 0;
+		//the lowest of the cgroup memory limit and the physical memory, 0 if unknown
+		uint64_t memory = 0;
+		int memoryCgroup = 0;
+
+		int getThreads() const;
+	};
+
+	//Reads the CPU affinity mask and the cgroup v1 or v2 limits of the process.
+	//cpuCgroup and memoryCgroup are the cgroup versions the limits come from (0 = none).
+	ResourceLimits getResourceLimits();
+
+	//Estimates the memory used by the service in full memory mode or in light mode.
+	uint64_t getRequiredMemory(bool fullMem, int threads);
+
+}
@@ -33,38 +33,115 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "thread_pool.h"
 #include "utility.h"
 #include "hex.h"
+#include "dataset_file.h"
+#include "cpu_topology.h"
+#include "resource_limits.h"
+#include "batch_inputs.h"
 #include <stdexcept>
 #include <locale>
 #include <iostream>
 #include <array>
 #include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
 
 namespace randomx {
 
-#define SERVICE_ALGORITHM "rx/0"
-#define SERVICE_MAX_BATCH_SIZE (256u)
+#define SERVICE_MAX_MINE_COUNT (65536u)
+#define SERVICE_MAX_JOBS (16u)
+#define SERVICE_JOB_TTL (3600)
+#define SERVICE_JOB_PAGE_SIZE (4096u)
+#define SERVICE_MAX_JOB_PAGE_SIZE (65536u)
+#define SERVICE_WATCH_TIMEOUT (30)
+#define SERVICE_WATCH_MAX_TIMEOUT (300)
+#define SERVICE_CLOSED_CHECK_MS (10)
+#define SERVICE_MERGE_WAIT_MS (10)
+#define SERVICE_LIGHT_MERGE_WAIT_MS (100)
 #define HEADER_ACCEPT "Accept"
 #define HEADER_CONTENT "Content-Type"
 #define HEADER_RANDOMX_SEED "RandomX-Seed"
 #define HEADER_ORIGIN "Origin"
 #define HEADER_REFERER "Referer"
+#define HEADER_PREFER "Prefer"
+#define HEADER_RANDOMX_TIMEOUT "RandomX-Timeout"
+#define HEADER_RANDOMX_PARTIAL "RandomX-Partial"
+#define HEADER_RANDOMX_KEY "RandomX-Key"
+#define HEADER_RANDOMX_TARGET "RandomX-Target"
+#define HEADER_RANDOMX_DIFFICULTY "RandomX-Difficulty"
 #define BINARY_FORMAT "application/x.randomx+bin"
 #define HEX_FORMAT "application/x.randomx+hex"
 #define BINARY_FORMAT_BATCH "application/x.randomx.batch+bin"
 #define HEX_FORMAT_BATCH "application/x.randomx.batch+hex"
+#define BINARY_FORMAT_BATCH2 "application/x.randomx.batch2+bin"
+#define BINARY_FORMAT_TEMPLATE "application/x.randomx.template+bin"
+#define BITMAP_FORMAT "application/x.randomx.bitmap+bin"
+#define WEBSOCKET_HASH (0x01)
+#define WEBSOCKET_BATCH (0x02)
+#define WEBSOCKET_MINE (0x03)
+#define WEBSOCKET_SEED (0x10)
+#define WEBSOCKET_RESPONSE (0x80)
+#define WEBSOCKET_HEADER_SIZE (5)
 
 	using RandomxHash = std::array<char, RANDOMX_HASH_SIZE>;
 
 	bool Service::run(const char* hostname, int port) {
-		return data_->server_.listen(hostname, port);
+		return bind(hostname, port) && run();
+	}
+
+	bool Service::bind(const char* hostname, int port) {
+		if (!data_->server_.bind_to_port(hostname, port)) {
+			return false;
+		}
+		data_->partitions_[0].port = port;
+		//the other partitions have their own listening sockets
+		for (size_t i = 1; i < data_->partitions_.size(); ++i) {
+			auto& partition = data_->partitions_[i];
+			if (partition.port == 0) {
+				partition.port = port + (int)i;
+			}
+			auto* queue = &data_->pool_->getPartition(i);
+			std::unique_ptr<httplib::Server<ServiceWorker>> server(new httplib::Server<ServiceWorker>([queue] { return queue; }));
+			server->copy_handlers(data_->server_);
+			std::cout << "Partition " << partition.name << ": binding to " << hostname << ":" << partition.port << "..." << std::endl;
+			if (!server->bind_to_port(hostname, partition.port)) {
+				return false;
+			}
+			data_->partitionServers_.push_back(std::move(server));
+		}
+		return true;
+	}
+
+	bool Service::run() {
+		std::vector<std::thread> listeners;
+		for (auto& server : data_->partitionServers_) {
+			listeners.emplace_back([&server] { server->listen_after_bind(); });
+		}
+		bool result = data_->server_.listen_after_bind();
+		//WebSocket and HTTP/2 clients reconnect to the process that takes over after an upgrade
+		data_->webSockets_.stop();
+		data_->http2_.stop();
+		for (auto& server : data_->partitionServers_) {
+			server->stop();
+		}
+		for (auto& listener : listeners) {
+			listener.join();
+		}
+		return result;
 	}
 
 	Service::~Service() {
 
 	}
 
-	randomx_vm* Service::createMachine() const {
-		auto* machine = randomx_create_vm(data_->flags_, data_->cache_, data_->dataset_);
+	randomx_vm* Service::createMachine(bool light) const {
+		auto* machine = light ?
+			randomx_create_vm((randomx_flags)(data_->flags_ & ~RANDOMX_FLAG_FULL_MEM), data_->cache_, nullptr) :
+			randomx_create_vm(data_->flags_, data_->cache_, data_->dataset_);
 		if (machine == nullptr) {
 			throw std::runtime_error("randomx_create_vm failed");
 		}
@@ -75,42 +152,1080 @@ namespace randomx {
 		randomx_destroy_vm(machine);
 	}
 
-	void Service::refreshMachine(randomx_vm* machine) const {
-		if (data_->flags_ & RANDOMX_FLAG_FULL_MEM) {
+	void Service::refreshMachine(randomx_vm* machine, bool light) const {
+		if ((data_->flags_ & RANDOMX_FLAG_FULL_MEM) && !light) {
 			randomx_vm_set_dataset(machine, data_->dataset_);
 		} else {
 			randomx_vm_set_cache(machine, data_->cache_);
 		}
 	}
 
-	void Service::reinitDataset() {
+	static void setReseedPhase(ServicePrivate& data, ReseedPhase phase) {
+		std::unique_lock<std::mutex> lock(data.statusMutex_);
+		data.phase_ = phase;
+		data.phaseStart_ = std::chrono::steady_clock::now();
+		if (phase == ReseedPhase::Dataset) {
+			data.datasetItemsDone_ = 0;
+		}
+	}
+
+	static const char* getPhaseName(ReseedPhase phase) {
+		switch (phase) {
+		case ReseedPhase::Waiting:
+			return "waiting";
+		case ReseedPhase::Loading:
+			return "loading";
+		case ReseedPhase::Cache:
+			return "cache";
+		case ReseedPhase::Dataset:
+			return "dataset";
+		case ReseedPhase::Attaching:
+			return "attaching";
+		default:
+			return "idle";
+		}
+	}
+
+	//must be called with statusMutex_ locked; eta is -1 if unknown
+	static void getReseedProgress(ServicePrivate& data, double& progress, int64_t& eta) {
+		auto elapsed = (int64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - data.phaseStart_).count();
+		bool fullMem = (data.flags_ & RANDOMX_FLAG_FULL_MEM) != 0;
+		progress = 0;
+		eta = -1;
+		switch (data.phase_) {
+		case ReseedPhase::Idle:
+			progress = 100;
+			eta = 0;
+			break;
+		case ReseedPhase::Waiting:
+		case ReseedPhase::Attaching:
+			break;
+		case ReseedPhase::Loading:
+			if (data.datasetLoaded_) {
+				eta = std::max<int64_t>((int64_t)data.datasetTime_ - elapsed, 0);
+			}
+			break;
+		case ReseedPhase::Cache:
+			if (data.cacheTime_ > 0) {
+				eta = std::max<int64_t>((int64_t)data.cacheTime_ - elapsed, 0) + (fullMem ? (int64_t)data.datasetTime_ : 0);
+			}
+			break;
+		case ReseedPhase::Dataset:
+			uint64_t done = data.datasetItemsDone_;
+			uint64_t total = randomx_dataset_item_count();
+			progress = 100.0 * done / total;
+			if (done > 0) {
+				eta = (int64_t)(elapsed * (double)(total - done) / done);
+			}
+			else if (data.datasetTime_ > 0) {
+				eta = data.datasetTime_;
+			}
+			break;
+		}
+	}
+
+	//must be called with statusMutex_ locked
+	static void outputSeedStatus(ServicePrivate& data, httplib::Response& res) {
+		double progress;
+		int64_t eta;
+		getReseedProgress(data, progress, eta);
+		std::stringstream status;
+		status << "{\n";
+		status << "\t\"epoch\": " << data.epoch_ << ",\n";
+		status << "\t\"seed\": ";
+		if (data.initialized_) {
+			status << "\"" << data.seedHex_ << "\"";
+		}
+		else {
+			status << "null";
+		}
+		status << ",\n\t\"pending_epoch\": ";
+		if (data.lastEpoch_ != data.epoch_) {
+			status << data.lastEpoch_;
+		}
+		else {
+			status << "null";
+		}
+		status << ",\n\t\"phase\": \"" << getPhaseName(data.phase_) << "\",\n";
+		status.setf(std::ios::fixed);
+		status.precision(1);
+		status << "\t\"progress\": " << progress << ",\n";
+		status << "\t\"eta_ms\": ";
+		if (eta >= 0) {
+			status << eta;
+		}
+		else {
+			status << "null";
+		}
+		status << "\n}\n";
+		res.set_content(status.str(), "application/json");
+	}
+
+	static bool isSeedPending(ServicePrivate& data) {
+		std::unique_lock<std::mutex> lock(data.statusMutex_);
+		return data.lastEpoch_ != data.epoch_;
+	}
+
+	//Used for requests that can't be served until a reseed has finished. The connection
+	//is closed, so the client reconnects to a regular worker.
+	static void serviceUnavailable(ServicePrivate& data, httplib::Response& res) {
+		double progress;
+		int64_t eta;
+		{
+			std::unique_lock<std::mutex> lock(data.statusMutex_);
+			getReseedProgress(data, progress, eta);
+		}
+		res.status = 503;
+		res.set_header("Retry-After", std::to_string(std::max<int64_t>((eta + 999) / 1000, 1)));
+		res.set_header("Connection", "close");
+	}
+
+	//client ids contain the keys and addresses sent by the clients
+	static std::string escapeJson(const std::string& value) {
+		std::string escaped;
+		for (char c : value) {
+			if (c == '"' || c == '\\') {
+				escaped += '\\';
+				escaped += c;
+			}
+			else if ((unsigned char)c < 0x20 || (unsigned char)c >= 0x7f) {
+				char buffer[8];
+				snprintf(buffer, sizeof(buffer), "\\u%04x", (unsigned char)c);
+				escaped += buffer;
+			}
+			else {
+				escaped += c;
+			}
+		}
+		return escaped;
+	}
+
+	//The RandomX-Timeout header is the number of milliseconds after which the client no longer needs
+	//the result. It's measured from when the request was received, including the time the connection
+	//waited for a worker. Requests without a timeout get the maximum of one hour.
+	static std::chrono::steady_clock::time_point getDeadline(const httplib::Request& req) {
+		auto timeout = httplib::max_request_timeout;
+		if (req.has_header(HEADER_RANDOMX_TIMEOUT)) {
+			auto value = httplib::parse_request_timeout(req.get_header_value(HEADER_RANDOMX_TIMEOUT));
+			if (value > 0) {
+				timeout = value;
+			}
+		}
+		return req.received + std::chrono::milliseconds(timeout);
+	}
+
+	static void deadlineExpired(ServiceWorker& w, httplib::Response& res) {
+		w.partition_->expired_.fetch_add(1);
+		res.status = 504;
+	}
+
+	static bool checkQuota(ServicePrivate& data, ServiceWorker& w, httplib::Response& res) {
+		int retryAfter;
+		if (!data.pool_->checkQuota(w, retryAfter)) {
+			res.status = 429;
+			res.set_header("Retry-After", std::to_string(retryAfter));
+			return false;
+		}
+		return true;
+	}
+
+	static void countHashes(ServicePrivate& data, ServiceWorker& w, size_t hashes) {
+		data.hashes_.fetch_add(hashes);
+		w.partition_->hashes_.fetch_add(hashes);
+		data.pool_->chargeHashes(w, hashes);
+	}
+
+	//the nonces start, ..., start + count - 1 must fit into nonceSize bytes
+	static bool checkNonceRange(uint64_t nonceSize, uint64_t start, uint64_t count) {
+		uint64_t maxNonce = nonceSize == 8 ? UINT64_MAX : (1ULL << (8 * nonceSize)) - 1;
+		return count > 0 && start <= maxNonce && count - 1 <= maxNonce - start;
+	}
+
+	//A disconnect is detected with system calls, so the hashing loops check it every few milliseconds.
+	static bool checkClosed(const httplib::Request& req, std::chrono::steady_clock::time_point now, std::chrono::steady_clock::time_point& next) {
+		if (now < next || !req.is_connection_closed) {
+			return false;
+		}
+		next = now + std::chrono::milliseconds(SERVICE_CLOSED_CHECK_MS);
+		return req.is_connection_closed();
+	}
+
+	//Calculates the hashes of count inputs until the RandomX-Timeout expires or the client disconnects.
+	//input(i) returns the i-th input and output(i, hash) receives its hash. Returns false if the
+	//request has been answered with an error, otherwise done is the number of calculated hashes.
+	//Requests longer than a batch (/mine) are charged after each batch and stopped when the client's
+	//hash rate quota is used up, so they can't exceed it by more than one batch.
+	template<typename Input, typename Output>
+	static bool calculateHashes(ServicePrivate& data, ServiceWorker& w, const httplib::Request& req, httplib::Response& res, size_t count, Input input, Output output, size_t& done) {
+		auto deadline = getDeadline(req);
+		if (std::chrono::steady_clock::now() >= deadline) {
+			deadlineExpired(w, res);
+			return false;
+		}
+		if (!checkQuota(data, w, res)) {
+			return false;
+		}
+		RandomxHash hash;
+		done = count;
+		bool closed = false, exhausted = false;
+		size_t charged = 0;
+		auto closedCheck = std::chrono::steady_clock::now() + std::chrono::milliseconds(SERVICE_CLOSED_CHECK_MS);
+		const std::vector<char>& first = input(0);
+		randomx_calculate_hash_first(w.vm_, first.data(), first.size());
+		for (size_t i = 1; i < count; ++i) {
+			auto now = std::chrono::steady_clock::now();
+			//stop when nobody is waiting for the rest of the hashes
+			closed = checkClosed(req, now, closedCheck);
+			if (i - 1 - charged >= data.maxBatch_) {
+				int retryAfter;
+				countHashes(data, w, i - 1 - charged);
+				charged = i - 1;
+				exhausted = !data.pool_->checkQuota(w, retryAfter);
+			}
+			if (closed || exhausted || now >= deadline) {
+				done = i - 1;
+				break;
+			}
+			const std::vector<char>& next = input(i);
+			randomx_calculate_hash_next(w.vm_, next.data(), next.size(), hash.data());
+			output(i - 1, hash);
+		}
+		if (done == count) {
+			randomx_calculate_hash_last(w.vm_, hash.data());
+			output(count - 1, hash);
+		}
+		countHashes(data, w, done - charged);
+		if (closed) {
+			w.partition_->cancelled_.fetch_add(1);
+			res.status = 499;
+			return false;
+		}
+		if (done == 0) {
+			deadlineExpired(w, res);
+			return false;
+		}
+		if (done < count) {
+			if (!exhausted) {
+				w.partition_->expired_.fetch_add(1);
+			}
+			res.set_header(HEADER_RANDOMX_PARTIAL, "true");
+		}
+		return true;
+	}
+
+	//Calculates one chunk of a bulk job. Returns false when there is nothing left to calculate.
+	static bool runJobChunk(ServicePrivate& data, ServiceWorker& w, BulkJob& job) {
+		{
+			//a reseed waits until the chunk is finished, so the seed can't change during the chunk
+			std::unique_lock<std::mutex> lock(data.statusMutex_);
+			if (data.seedHex_ != job.getSeed()) {
+				lock.unlock();
+				job.fail("the seed has changed");
+				return false;
+			}
+		}
+		size_t begin, end;
+		if (!job.claimChunk(begin, end)) {
+			return false;
+		}
+		auto& inputs = job.getInputs();
+		std::vector<char> buffer;
+		const std::vector<char>& first = inputs.get(begin, buffer);
+		randomx_calculate_hash_first(w.vm_, first.data(), first.size());
+		for (size_t i = begin + 1; i < end; ++i) {
+			const std::vector<char>& next = inputs.get(i, buffer);
+			randomx_calculate_hash_next(w.vm_, next.data(), next.size(), job.getResult(i - 1));
+		}
+		randomx_calculate_hash_last(w.vm_, job.getResult(end - 1));
+		countHashes(data, w, end - begin);
+		job.finishChunk(begin, end);
+		return true;
+	}
+
+	//Each task calculates one chunk and queues the task again, so a job takes turns with the connections
+	//of the partition. Low priority jobs run only when no connections are waiting.
+	static void scheduleJob(Service& svc, ServicePrivate& data, std::shared_ptr<BulkJob> job, WorkerPartition& partition, bool background) {
+		auto* target = &partition;
+		std::function<void(ServiceWorker&)> task = [&svc, &data, job, target](ServiceWorker& w) {
+			svc.recordActivity();
+			//the control worker has no VM; the job continues after the reseed unless the seed changes
+			if (w.vm_ == nullptr) {
+				scheduleJob(svc, data, job, *target, true);
+				return;
+			}
+			if (runJobChunk(data, w, *job)) {
+				scheduleJob(svc, data, job, *target, job->isLowPriority());
+			}
+		};
+		if (background) {
+			data.pool_->enqueueBackground(partition, task);
+		}
+		else {
+			data.pool_->enqueue(partition, { task, nullptr, nullptr, "jobs" });
+		}
+	}
+
+	//must be called with jobsMutex_ locked
+	static void expireJobs(ServicePrivate& data) {
+		auto now = std::chrono::steady_clock::now();
+		for (auto it = data.jobs_.begin(); it != data.jobs_.end();) {
+			if (it->second->isExpired(now, std::chrono::seconds(SERVICE_JOB_TTL))) {
+				it = data.jobs_.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+	}
+
+	static std::shared_ptr<BulkJob> findJob(ServicePrivate& data, const std::string& id) {
+		std::unique_lock<std::mutex> lock(data.jobsMutex_);
+		expireJobs(data);
+		auto it = data.jobs_.find(id);
+		return it != data.jobs_.end() ? it->second : nullptr;
+	}
+
+	//Passes the inputs of a batch to the hash pipeline of a VM, which returns the hash of an input when
+	//the next input is passed. With the result cache, cached inputs and inputs that are repeated in the
+	//batch are not hashed again, so the hashes may become available out of order.
+	class BatchHasher {
+	public:
+		BatchHasher(ServicePrivate& data, ServiceWorker& w, std::vector<RandomxHash>& hashes) :
+			w_(w),
+			cache_(data.hashCache_.get()),
+			generation_(cache_ != nullptr ? cache_->getGeneration() : 0),
+			hashes_(hashes),
+			pending_(None),
+			ready_(0),
+			calculated_(0),
+			duplicates_(0)
+		{
+		}
+
+		~BatchHasher() {
+			if (duplicates_ > 0) {
+				cache_->countDuplicates(duplicates_);
+			}
+		}
+
+		void add(const std::vector<char>& input) {
+			size_t index = hashes_.size();
+			hashes_.emplace_back();
+			done_.push_back(false);
+			if (cache_ != nullptr) {
+				if (cache_->find(generation_, input.data(), input.size(), hashes_[index].data())) {
+					complete(index);
+					return;
+				}
+				std::string key(input.data(), input.size());
+				auto first = unique_.find(key);
+				if (first != unique_.end()) {
+					duplicates_++;
+					if (done_[first->second]) {
+						hashes_[index] = hashes_[first->second];
+						complete(index);
+					}
+					else {
+						copies_.emplace(first->second, index);
+					}
+					return;
+				}
+				unique_.emplace(std::move(key), index);
+			}
+			if (pending_ == None) {
+				randomx_calculate_hash_first(w_.vm_, input.data(), input.size());
+			}
+			else {
+				randomx_calculate_hash_next(w_.vm_, input.data(), input.size(), hashes_[pending_].data());
+				finishPending();
+			}
+			pending_ = index;
+			if (cache_ != nullptr) {
+				pendingInput_ = input;
+			}
+		}
+
+		//calculates the hash of the last input
+		void finish() {
+			if (pending_ != None) {
+				randomx_calculate_hash_last(w_.vm_, hashes_[pending_].data());
+				finishPending();
+				pending_ = None;
+			}
+		}
+
+		//the number of hashes at the start of the batch that are available
+		size_t getReady() const {
+			return ready_;
+		}
+
+		//the number of hashes calculated by the VM
+		size_t getCalculated() const {
+			return calculated_;
+		}
+
+	private:
+		static const size_t None = SIZE_MAX;
+
+		void finishPending() {
+			calculated_++;
+			if (cache_ != nullptr) {
+				cache_->insert(generation_, pendingInput_.data(), pendingInput_.size(), hashes_[pending_].data());
+			}
+			complete(pending_);
+		}
+
+		void complete(size_t index) {
+			done_[index] = true;
+			auto copies = copies_.equal_range(index);
+			for (auto it = copies.first; it != copies.second; ++it) {
+				hashes_[it->second] = hashes_[index];
+				done_[it->second] = true;
+			}
+			copies_.erase(copies.first, copies.second);
+			while (ready_ < done_.size() && done_[ready_]) {
+				ready_++;
+			}
+		}
+
+		ServiceWorker& w_;
+		HashCache* cache_;
+		uint64_t generation_;
+		std::vector<RandomxHash>& hashes_;
+		std::vector<bool> done_;
+		size_t pending_;
+		std::vector<char> pendingInput_;
+		//the first index of each input and the repeated inputs waiting for its hash
+		std::map<std::string, size_t> unique_;
+		std::multimap<size_t, size_t> copies_;
+		size_t ready_;
+		size_t calculated_;
+		size_t duplicates_;
+	};
+
+	//Like calculateHashes, but with the result cache, the hashes of cached and repeated inputs are not calculated.
+	static bool calculateBatch(ServicePrivate& data, ServiceWorker& w, const httplib::Request& req, httplib::Response& res, const BatchInputs& batch, std::vector<RandomxHash>& hashes) {
+		auto deadline = getDeadline(req);
+		if (std::chrono::steady_clock::now() >= deadline) {
+			deadlineExpired(w, res);
+			return false;
+		}
+		if (!checkQuota(data, w, res)) {
+			return false;
+		}
+		std::vector<char> buffer;
+		bool closed = false;
+		bool expired = false;
+		size_t ready;
+		auto closedCheck = std::chrono::steady_clock::now() + std::chrono::milliseconds(SERVICE_CLOSED_CHECK_MS);
+		{
+			BatchHasher hasher(data, w, hashes);
+			for (size_t i = 0; i < batch.size(); ++i) {
+				if (i > 0) {
+					auto now = std::chrono::steady_clock::now();
+					//stop when nobody is waiting for the rest of the hashes
+					closed = checkClosed(req, now, closedCheck);
+					expired = now >= deadline;
+					if (closed || expired) {
+						break;
+					}
+				}
+				hasher.add(batch.get(i, buffer));
+			}
+			if (!closed && !expired) {
+				hasher.finish();
+			}
+			countHashes(data, w, hasher.getCalculated());
+			ready = hasher.getReady();
+		}
+		hashes.resize(ready);
+		if (closed) {
+			w.partition_->cancelled_.fetch_add(1);
+			res.status = 499;
+			return false;
+		}
+		if (ready == 0) {
+			deadlineExpired(w, res);
+			return false;
+		}
+		if (ready < batch.size()) {
+			w.partition_->expired_.fetch_add(1);
+			res.set_header(HEADER_RANDOMX_PARTIAL, "true");
+		}
+		return true;
+	}
+
+	static bool parseUint64(const std::string& str, uint64_t& value) {
+		if (str.empty() || !std::isdigit((unsigned char)str[0])) {
+			return false;
+		}
+		char* end;
+		errno = 0;
+		value = std::strtoull(str.c_str(), &end, 10);
+		return *end == '\0' && errno == 0;
+	}
+
+	static bool readParam(const httplib::Request& req, const char* name, uint64_t& value, uint64_t defaultValue) {
+		if (!req.has_param(name)) {
+			value = defaultValue;
+			return true;
+		}
+		return parseUint64(req.get_param_value(name), value);
+	}
+
+	//Either RandomX-Target (compared with the most significant 64 bits of the hash, like miners do)
+	//or RandomX-Difficulty (the full 256-bit check done by Monero nodes) must be provided.
+	static bool readTarget(const httplib::Request& req, uint64_t& target, bool& difficulty) {
+		difficulty = req.has_header(HEADER_RANDOMX_DIFFICULTY);
+		if (difficulty == req.has_header(HEADER_RANDOMX_TARGET)) {
+			return false;
+		}
+		auto value = req.get_header_value(difficulty ? HEADER_RANDOMX_DIFFICULTY : HEADER_RANDOMX_TARGET);
+		return parseUint64(value, target) && target != 0;
+	}
+
+	static bool meetsTarget(const RandomxHash& hash, uint64_t target, bool difficulty) {
+		auto bytes = (const uint8_t*)hash.data();
+		if (!difficulty) {
+			uint64_t high = 0;
+			for (int i = 7; i >= 0; --i) {
+				high = (high << 8) | bytes[24 + i];
+			}
+			return high < target;
+		}
+		//the hash is a little-endian 256-bit number; hash * difficulty must not overflow 256 bits
+		uint32_t words[8];
+		for (int i = 0; i < 8; ++i) {
+			words[i] = bytes[4 * i] | (bytes[4 * i + 1] << 8) | (bytes[4 * i + 2] << 16) | ((uint32_t)bytes[4 * i + 3] << 24);
+		}
+		uint32_t factor[2] = { (uint32_t)target, (uint32_t)(target >> 32) };
+		uint32_t product[10] = { 0 };
+		for (int i = 0; i < 8; ++i) {
+			uint64_t carry = 0;
+			for (int j = 0; j < 2; ++j) {
+				uint64_t t = (uint64_t)words[i] * factor[j] + product[i + j] + carry;
+				product[i + j] = (uint32_t)t;
+				carry = t >> 32;
+			}
+			product[i + 2] = (uint32_t)carry;
+		}
+		return product[8] == 0 && product[9] == 0;
+	}
+
+	//Splits the dataset into one range per NUMA node. Workers take chunks
+	//from the range of their own node first and then help the other nodes.
+	class DatasetChunks {
+	public:
+		//2 MiB chunks, so each large page is first touched by a single thread
+		static const uint32_t ChunkItems = 2 * 1024 * 1024 / RANDOMX_DATASET_ITEM_SIZE;
+
+		DatasetChunks(uint32_t itemCount, const std::vector<int>& nodes) :
+			nodes_(nodes),
+			ranges_(std::max<size_t>(nodes.size(), 1))
+		{
+			uint64_t chunkCount = (itemCount + ChunkItems - 1) / ChunkItems;
+			uint32_t start = 0;
+			for (size_t i = 0; i < ranges_.size(); ++i) {
+				uint32_t end = (uint32_t)std::min<uint64_t>(chunkCount * (i + 1) / ranges_.size() * ChunkItems, itemCount);
+				ranges_[i].next = start;
+				ranges_[i].end = end;
+				start = end;
+			}
+		}
+
+		bool next(int node, uint32_t& startItem, uint32_t& itemCount) {
+			size_t home = std::find(nodes_.begin(), nodes_.end(), node) - nodes_.begin();
+			for (size_t i = 0; i < ranges_.size(); ++i) {
+				auto& range = ranges_[(home + i) % ranges_.size()];
+				uint64_t start = range.next.fetch_add(ChunkItems);
+				if (start < range.end) {
+					startItem = (uint32_t)start;
+					itemCount = (uint32_t)std::min<uint64_t>(ChunkItems, range.end - start);
+					return true;
+				}
+			}
+			return false;
+		}
+
+	private:
+		struct Range {
+			std::atomic<uint64_t> next;
+			uint32_t end;
+		};
+		std::vector<int> nodes_;
+		std::vector<Range> ranges_;
+	};
+
+	void Service::reinitDataset(ServiceWorker* self) {
 		if (data_->flags_ & RANDOMX_FLAG_FULL_MEM) {
-			uint32_t datasetItemCount = randomx_dataset_item_count();
-			auto threads = data_->threads_;
-			if (threads > 1) {
-				auto perThread = datasetItemCount / threads;
-				auto remainder = datasetItemCount % threads;
-				std::vector<std::thread> workers;
-				uint32_t startItem = 0;
-				for (int i = 0; i < threads; ++i) {
-					auto count = perThread + (i == threads - 1 ? remainder : 0);
-					workers.push_back(std::thread(&randomx_init_dataset, data_->dataset_, data_->cache_, startItem, count));
-					startItem += count;
-				}
-				for (unsigned i = 0; i < workers.size(); ++i) {
-					workers[i].join();
+			DatasetChunks chunks(randomx_dataset_item_count(), data_->pool_->getNodes());
+			data_->pool_->runParallel(self, [this, &chunks](ServiceWorker* w) {
+				uint32_t startItem, itemCount;
+				while (chunks.next(w != nullptr ? w->node_ : -1, startItem, itemCount)) {
+					randomx_init_dataset(data_->dataset_, data_->cache_, startItem, itemCount);
+					data_->datasetItemsDone_.fetch_add(itemCount);
 				}
+			});
+		}
+	}
+
+	static void getIdleSeconds(ServicePrivate& data, int64_t& seconds) {
+		auto last = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(data.lastActivity_.load()));
+		seconds = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - last).count();
+	}
+
+	static const char* getIdleStateName(IdleState state) {
+		switch (state) {
+		case IdleState::Light:
+			return "light";
+		case IdleState::Asleep:
+			return "asleep";
+		default:
+			return "active";
+		}
+	}
+
+	//light mode VMs need the cache even if the dataset was not computed from it
+	static void initLightCache(ServicePrivate& data, const void* seed, size_t seedSize) {
+		std::string key((const char*)seed, seedSize);
+		if (data.cacheSeed_ != key) {
+			randomx_init_cache(data.cache_, seed, seedSize);
+			data.cacheSeed_ = key;
+		}
+	}
+
+	//must be called from ThreadPool::runExclusive
+	static void releaseIdleMemory(ServicePrivate& data) {
+		int64_t idle;
+		getIdleSeconds(data, idle);
+		std::string seed;
+		{
+			std::unique_lock<std::mutex> lock(data.statusMutex_);
+			//a request or a reseed may have arrived in the meantime
+			if (data.idleState_ != IdleState::Active || idle < data.idleTimeout_ * 60 ||
+				data.phase_ != ReseedPhase::Idle || data.epoch_ != data.lastEpoch_ || data.upgraded_) {
+				return;
+			}
+			seed = data.seed_;
+		}
+		data.idleFullMem_ = (data.flags_ & RANDOMX_FLAG_FULL_MEM) != 0;
+		if (!data.idleFullMem_ && !data.idleSleep_) {
+			return;
+		}
+		if (data.saveThread_.joinable()) {
+			data.saveThread_.join();
+		}
+		if (data.idleFullMem_) {
+			//the cache is not initialized if the dataset was loaded from a file or shared
+			if (!data.idleSleep_) {
+				initLightCache(data, seed.data(), seed.size());
+			}
+			if (data.sharedDataset_) {
+				data.sharedDataset_->detach();
 			}
 			else {
-				randomx_init_dataset(data_->dataset_, data_->cache_, 0, datasetItemCount);
+				randomx_release_dataset(data.dataset_);
+				data.dataset_ = nullptr;
+				data.inheritedMapping_ = false;
+			}
+			data.flags_ = (randomx_flags)(data.flags_ & ~RANDOMX_FLAG_FULL_MEM);
+		}
+		IdleState state;
+		if (data.idleSleep_) {
+			data.pool_->releaseMachines();
+			randomx_release_cache(data.cache_);
+			data.cache_ = nullptr;
+			data.cacheSeed_.clear();
+			state = IdleState::Asleep;
+			std::cout << "Idle for " << idle / 60 << " minutes: released the cache, dataset and VMs" << std::endl;
+		}
+		else {
+			data.pool_->recreateMachines();
+			state = IdleState::Light;
+			std::cout << "Idle for " << idle / 60 << " minutes: released the dataset, using light mode" << std::endl;
+		}
+		std::unique_lock<std::mutex> lock(data.statusMutex_);
+		data.idleState_ = state;
+	}
+
+	//must be called from ThreadPool::runExclusive
+	static void restoreIdleMemory(ServicePrivate& data) {
+		{
+			std::unique_lock<std::mutex> lock(data.statusMutex_);
+			if (data.idleState_ == IdleState::Active) {
+				return;
+			}
+		}
+		std::cout << "Reallocating the memory released while idle" << std::endl;
+		if (data.cache_ == nullptr) {
+			data.cache_ = randomx_alloc_cache(data.flags_);
+			if (data.cache_ == nullptr) {
+				throw std::runtime_error("randomx_alloc_cache failed");
+			}
+		}
+		if (data.idleFullMem_) {
+			data.flags_ = (randomx_flags)(data.flags_ | RANDOMX_FLAG_FULL_MEM);
+			if (!data.sharedDataset_) {
+				data.dataset_ = allocDataset(data.pages_, data.flags_);
+				data.datasetPages_ = getPageStrategyName(data.pages_);
+				if (data.dataset_ == nullptr) {
+					std::cout << "RANDOMX_FLAG_FULL_MEM was not successful" << std::endl;
+					data.flags_ = (randomx_flags)(data.flags_ & ~RANDOMX_FLAG_FULL_MEM);
+					data.datasetPages_ = nullptr;
+				}
+			}
+		}
+		data.pool_->recreateMachines();
+		std::unique_lock<std::mutex> lock(data.statusMutex_);
+		data.idleState_ = IdleState::Active;
+		data.waking_ = false;
+	}
+
+	static void runIdleMonitor(ServicePrivate& data) {
+		auto interval = std::chrono::seconds(std::min(data.idleTimeout_ * 15, 60));
+		std::unique_lock<std::mutex> lock(data.statusMutex_);
+		while (!data.idleStop_) {
+			data.idleCond_.wait_for(lock, interval);
+			int64_t idle;
+			getIdleSeconds(data, idle);
+			if (data.idleStop_ || data.idleState_ != IdleState::Active || !data.initialized_ || idle < data.idleTimeout_ * 60) {
+				continue;
+			}
+			lock.unlock();
+			data.pool_->runExclusive(nullptr, [&data] {
+				releaseIdleMemory(data);
+			});
+			lock.lock();
+		}
+	}
+
+	void Service::enableIdleRelease(int minutes, bool sleep) {
+		data_->idleTimeout_ = minutes;
+		data_->idleSleep_ = sleep;
+		data_->idleThread_ = std::thread(runIdleMonitor, std::ref(*data_));
+	}
+
+	void Service::setQueueLimit(size_t limit, bool dropOldest) {
+		data_->queueLimit_ = limit;
+		data_->dropOldest_ = dropOldest;
+		data_->pool_->setQueueLimit(limit, dropOldest);
+	}
+
+	void Service::setBatchLimits(size_t maxBatch, size_t maxPayload) {
+		data_->maxBatch_ = maxBatch;
+		data_->server_.set_payload_max_length("/batch", maxPayload);
+		data_->server_.set_payload_max_length("/verify", maxPayload);
+		data_->webSockets_.setMaxMessage(WEBSOCKET_HEADER_SIZE + maxPayload);
+	}
+
+	void Service::setJobLimits(size_t maxJob, size_t maxPayload) {
+		data_->maxJob_ = maxJob;
+		data_->server_.set_payload_max_length("/jobs", maxPayload);
+	}
+
+	void Service::enableHashCache(size_t entries) {
+		data_->hashCache_.reset(new HashCache(entries));
+	}
+
+	void Service::setSpinTime(unsigned microseconds) {
+		data_->spinTime_ = microseconds;
+		data_->pool_->setSpinTime(microseconds);
+	}
+
+	void Service::setClientLimits(const ClientLimits& limits) {
+		data_->clientLimits_ = limits;
+		data_->pool_->setClientLimits(limits);
+		if (limits.identity == ClientIdentity::Key) {
+			data_->server_.set_client_header(HEADER_RANDOMX_KEY);
+		}
+	}
+
+	//must be called with statusMutex_ locked
+	static void startReseedThread(Service* service, ServicePrivate& data) {
+		if (data.reseedThread_.joinable()) {
+			return;
+		}
+		data.reseedThread_ = std::thread([service, &data] {
+			std::unique_lock<std::mutex> lock(data.statusMutex_);
+			for (;;) {
+				data.reseedCond_.wait(lock, [&] { return data.pendingEpoch_ != 0 || data.wakePending_ || data.reseedStop_; });
+				if (data.reseedStop_) {
+					break;
+				}
+				//a pending seed is installed first; it restores the memory too
+				if (data.pendingEpoch_ != 0) {
+					std::string seed;
+					seed.swap(data.pendingSeed_);
+					uint64_t epoch = data.pendingEpoch_;
+					data.pendingEpoch_ = 0;
+					lock.unlock();
+					service->reseed(nullptr, seed, epoch);
+				}
+				else {
+					data.wakePending_ = false;
+					lock.unlock();
+					service->restoreMemory();
+				}
+				lock.lock();
+			}
+		});
+	}
+
+	void Service::recordActivity() {
+		data_->lastActivity_ = std::chrono::steady_clock::now().time_since_epoch().count();
+		{
+			std::unique_lock<std::mutex> lock(data_->statusMutex_);
+			if (data_->idleState_ == IdleState::Active || data_->waking_) {
+				return;
+			}
+			data_->waking_ = true;
+			data_->wakePending_ = true;
+			startReseedThread(this, *data_);
+		}
+		data_->reseedCond_.notify_all();
+	}
+
+	//rebuilds (or loads from a file) the memory released while idle; the seed and the epoch don't change
+	void Service::restoreMemory() {
+		std::string seed;
+		{
+			std::unique_lock<std::mutex> lock(data_->statusMutex_);
+			if (data_->idleState_ == IdleState::Active || !data_->initialized_) {
+				return;
 			}
+			seed = data_->seed_;
 		}
+		//a reseed may have restored the memory in the meantime
+		data_->pool_->reseed(seed.data(), seed.size(), [this] {
+			std::unique_lock<std::mutex> lock(data_->statusMutex_);
+			return data_->idleState_ != IdleState::Active;
+		});
+		{
+			std::unique_lock<std::mutex> lock(data_->statusMutex_);
+			data_->phase_ = ReseedPhase::Idle;
+		}
+		data_->epochCond_.notify_all();
+	}
+
+	//The dataset received from the upgraded process is a copy in 4 KiB pages. It's only used
+	//until the dataset has to be rebuilt, then it's replaced with one allocated as configured.
+	static void replaceInheritedDataset(ServicePrivate& data) {
+		randomx_release_dataset(data.dataset_);
+		data.inheritedMapping_ = false;
+		data.dataset_ = allocDataset(data.pages_, data.flags_);
+		data.datasetPages_ = getPageStrategyName(data.pages_);
+		if (data.dataset_ == nullptr) {
+			std::cout << "RANDOMX_FLAG_FULL_MEM was not successful" << std::endl;
+			std::cout << "Using light mode" << std::endl;
+			data.flags_ = (randomx_flags)(data.flags_ & ~RANDOMX_FLAG_FULL_MEM);
+			data.datasetPages_ = nullptr;
+			data.datasetFile_.reset();
+			data.pool_->recreateMachines();
+		}
+	}
+
+	//the memory is locked after it has been initialized by the workers, which prefaults it on their NUMA nodes
+	static void lockServiceMemory(ServicePrivate& data) {
+		if (!data.lockMemory_) {
+			return;
+		}
+		auto* dataset = (data.flags_ & RANDOMX_FLAG_FULL_MEM) ? data.dataset_ : nullptr;
+		data.memoryLocked_ = lockMemory(dataset, data.cache_);
+		if (!data.memoryLocked_) {
+			std::cout << "Locking memory was not successful (check RLIMIT_MEMLOCK)" << std::endl;
+		}
+	}
+
+	void Service::reinit(ServiceWorker* self, const void* seed, size_t seedSize) {
+		//the dataset must not change while it's being saved
+		if (data_->saveThread_.joinable()) {
+			data_->saveThread_.join();
+		}
+		restoreIdleMemory(*data_);
+		//the dataset received from the upgraded process is only valid for its seed
+		if (data_->inheritedDataset_ && data_->inherited_.seed != std::string((const char*)seed, seedSize)) {
+			data_->inheritedDataset_ = false;
+		}
+		if (data_->inheritedMapping_ && !data_->inheritedDataset_) {
+			replaceInheritedDataset(*data_);
+		}
+		if (data_->sharedDataset_) {
+			auto start = std::chrono::steady_clock::now();
+			setReseedPhase(*data_, ReseedPhase::Attaching);
+			try {
+				bool attached = data_->sharedDataset_->attach(seed, seedSize, [&] {
+					buildDataset(self, seed, seedSize);
+				});
+				data_->datasetShared_ = attached;
+				if (attached) {
+					setSeed(seed, seedSize);
+					data_->cacheTime_ = 0;
+					data_->datasetTime_ = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+					data_->datasetLoaded_ = false;
+					std::cout << "Reseed: attached to the shared dataset in " << data_->datasetTime_ << " ms" << std::endl;
+				}
+				if (data_->lightMachines_) {
+					initLightCache(*data_, seed, seedSize);
+				}
+				lockServiceMemory(*data_);
+				return;
+			}
+			catch (const std::exception& e) {
+				std::cout << "Shared dataset failed: " << e.what() << std::endl;
+				std::cout << "Using a private dataset" << std::endl;
+			}
+			data_->sharedDataset_.reset();
+			data_->dataset_ = allocDataset(data_->pages_, data_->flags_);
+			data_->datasetPages_ = getPageStrategyName(data_->pages_);
+			if (data_->dataset_ == nullptr) {
+				//this may run on a worker during an asynchronous reseed, so it must not throw
+				std::cout << "RANDOMX_FLAG_FULL_MEM was not successful" << std::endl;
+				std::cout << "Using light mode" << std::endl;
+				data_->flags_ = (randomx_flags)(data_->flags_ & ~RANDOMX_FLAG_FULL_MEM);
+				data_->datasetPages_ = nullptr;
+				data_->datasetFile_.reset();
+				data_->pool_->recreateMachines();
+			}
+		}
+		buildDataset(self, seed, seedSize);
+		if (data_->lightMachines_) {
+			initLightCache(*data_, seed, seedSize);
+		}
+		lockServiceMemory(*data_);
+	}
+
+	void Service::buildDataset(ServiceWorker* self, const void* seed, size_t seedSize) {
+		if (data_->inheritedDataset_) {
+			//the dataset was received from the upgraded process; reinit checked its seed
+			data_->inheritedDataset_ = false;
+			setSeed(seed, seedSize);
+			data_->cacheTime_ = 0;
+			data_->datasetTime_ = 0;
+			data_->datasetLoaded_ = false;
+			std::cout << "Reseed: using the dataset of the upgraded process" << std::endl;
+			return;
+		}
+		auto start = std::chrono::steady_clock::now();
+		setReseedPhase(*data_, ReseedPhase::Loading);
+		if (loadDataset(seed, seedSize)) {
+			data_->cacheTime_ = 0;
+			data_->datasetTime_ = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+			data_->datasetLoaded_ = true;
+			return;
+		}
+		setReseedPhase(*data_, ReseedPhase::Cache);
+		reinitCache(seed, seedSize);
+		auto cacheDone = std::chrono::steady_clock::now();
+		setReseedPhase(*data_, ReseedPhase::Dataset);
+		reinitDataset(self);
+		auto datasetDone = std::chrono::steady_clock::now();
+		data_->cacheTime_ = std::chrono::duration_cast<std::chrono::milliseconds>(cacheDone - start).count();
+		data_->datasetTime_ = std::chrono::duration_cast<std::chrono::milliseconds>(datasetDone - cacheDone).count();
+		data_->datasetLoaded_ = false;
+		std::cout << "Reseed: cache " << data_->cacheTime_ << " ms";
+		if (data_->flags_ & RANDOMX_FLAG_FULL_MEM) {
+			std::cout << ", dataset " << data_->datasetTime_ << " ms";
+		}
+		std::cout << std::endl;
+		saveDataset();
+	}
+
+	void Service::reseed(const void* seed, size_t seedSize) {
+		reseed(nullptr, std::string((const char*)seed, seedSize), newEpoch());
+	}
+
+	void Service::reseed(ServiceWorker* self, const std::string& seed, uint64_t epoch) {
+		{
+			std::unique_lock<std::mutex> lock(data_->statusMutex_);
+			if (data_->phase_ == ReseedPhase::Idle) {
+				data_->phase_ = ReseedPhase::Waiting;
+				data_->phaseStart_ = std::chrono::steady_clock::now();
+			}
+		}
+		//a newer seed may have been installed while this reseed was waiting for the workers
+		auto current = [this, epoch] {
+			std::unique_lock<std::mutex> lock(data_->statusMutex_);
+			return epoch > data_->epoch_;
+		};
+		if (self != nullptr) {
+			data_->pool_->reseed(*self, seed.data(), seed.size(), current);
+		}
+		else {
+			data_->pool_->reseed(seed.data(), seed.size(), current);
+		}
+		{
+			std::unique_lock<std::mutex> lock(data_->statusMutex_);
+			data_->epoch_ = std::max(data_->epoch_, epoch);
+			data_->phase_ = ReseedPhase::Idle;
+		}
+		data_->epochCond_.notify_all();
+	}
+
+	uint64_t Service::reseedAsync(const std::string& seed) {
+		auto epoch = newEpoch();
+		std::unique_lock<std::mutex> lock(data_->statusMutex_);
+		//only the newest pending seed is installed
+		data_->pendingSeed_ = seed;
+		data_->pendingEpoch_ = epoch;
+		startReseedThread(this, *data_);
+		lock.unlock();
+		data_->reseedCond_.notify_all();
+		return epoch;
+	}
+
+	bool Service::isReady() {
+		std::unique_lock<std::mutex> lock(data_->statusMutex_);
+		return data_->initialized_ && data_->phase_ == ReseedPhase::Idle && data_->epoch_ == data_->lastEpoch_ && !data_->tuning_;
+	}
+
+	uint64_t Service::newEpoch() {
+		std::unique_lock<std::mutex> lock(data_->statusMutex_);
+		return ++data_->lastEpoch_;
+	}
+
+	bool Service::loadDataset(const void* seed, size_t seedSize) {
+		if (!data_->datasetFile_) {
+			return false;
+		}
+		auto start = std::chrono::steady_clock::now();
+		if (!data_->datasetFile_->load(seed, seedSize, data_->dataset_)) {
+			return false;
+		}
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+		std::cout << "Reseed: dataset loaded from a file in " << elapsed.count() << " ms" << std::endl;
+		setSeed(seed, seedSize);
+		return true;
+	}
+
+	void Service::saveDataset() {
+		if (!data_->datasetFile_) {
+			return;
+		}
+		//hashing can continue while the dataset is being written
+		data_->saveThread_ = std::thread([this] {
+			const auto& seed = data_->seed_;
+			if (!data_->datasetFile_->save(seed.data(), seed.size(), data_->dataset_)) {
+				std::cout << "Failed to save the dataset to " << data_->datasetFile_->getSlotPath(0) << std::endl;
+			}
+		});
 	}
 
 	void Service::setOrigin(const std::string& origin) {
 		data_->origin_ = origin;
 	}
 
+	void Service::pinThreads() {
+		data_->pool_->pinWorkers(getCpuTopology());
+	}
+
+	void Service::setDatasetDir(const std::string& dir) {
+		if (data_->dataset_ == nullptr) {
+			std::cout << "Dataset files are not supported without RANDOMX_FLAG_FULL_MEM" << std::endl;
+			return;
+		}
+		data_->datasetFile_.reset(new DatasetFile(dir));
+	}
+
 	int Service::getFlags() const {
 		return data_->flags_;
 	}
@@ -119,19 +1234,172 @@ namespace randomx {
 		if (req.has_header(HEADER_ORIGIN) && req.get_header_value(HEADER_ORIGIN) == data_->origin_) {
 			res.set_header("Access-Control-Allow-Origin", data_->origin_);
 			res.set_header("Access-Control-Allow-Methods", method);
-			res.set_header("Access-Control-Allow-Headers", HEADER_ACCEPT ", " HEADER_CONTENT ", " HEADER_RANDOMX_SEED);
+			res.set_header("Access-Control-Allow-Headers", HEADER_ACCEPT ", " HEADER_CONTENT ", " HEADER_RANDOMX_SEED ", " HEADER_PREFER ", " HEADER_RANDOMX_TIMEOUT ", " HEADER_RANDOMX_KEY ", " HEADER_RANDOMX_TARGET ", " HEADER_RANDOMX_DIFFICULTY);
+			res.set_header("Access-Control-Expose-Headers", HEADER_RANDOMX_PARTIAL);
 			res.set_header("Access-Control-Max-Age", "120");
 			return true;
 		}
 		return false;
 	}
 
+	void Service::enableAutotune(TuneObjective objective, const std::string& file) {
+		data_->tuneObjective_ = objective;
+		data_->tuneFile_ = file;
+		data_->autotuneEnabled_ = true;
+	}
+
+	//must be called from ThreadPool::runExclusive
+	static void applyTuning(ServicePrivate& data, unsigned threads, int flags) {
+		data.flags_ = (randomx_flags)flags;
+		data.pool_->recreateMachines();
+		data.pool_->setActiveWorkers(threads);
+		data.threads_ = threads;
+	}
+
+	bool Service::loadTuning() {
+		//the tuned flags and thread count apply to the whole pool
+		if (data_->tuneFile_.empty() || data_->pool_->getPartitionCount() > 1) {
+			return false;
+		}
+		TuneResult result;
+		auto key = getTuneKey(data_->maxThreads_, data_->flags_, data_->tuneObjective_);
+		if (!loadTuneFile(data_->tuneFile_, key, result) || result.threads > data_->maxThreads_) {
+			return false;
+		}
+		data_->pool_->runExclusive(nullptr, [&] {
+			applyTuning(*data_, result.threads, result.flags);
+		});
+		return true;
+	}
+
+	//hashes with the given number of workers for a short time; the other workers are idle
+	static TuneResult calibrate(ServicePrivate& data, ServiceWorker* self, unsigned threads, int flags) {
+		const auto duration = std::chrono::milliseconds(500);
+		std::atomic<uint64_t> hashes(0), busyTime(0);
+		std::atomic<bool> failed(false);
+		std::mutex mutex;
+		std::condition_variable started;
+		//workers parked by /seed/watch don't take part, so the barrier counts the threads that do
+		unsigned participants = data.pool_->getParallelThreads(self);
+		unsigned hashing = 0, ready = 0;
+		std::chrono::steady_clock::time_point deadline;
+		data.pool_->runParallel(self, [&](ServiceWorker* w) {
+			bool measured = false;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				if (w != nullptr && hashing < threads) {
+					hashing++;
+					measured = true;
+				}
+			}
+			randomx_vm* vm = nullptr;
+			if (measured && (vm = randomx_create_vm((randomx_flags)flags, data.cache_, data.dataset_)) == nullptr) {
+				failed = true;
+			}
+			//the timer starts when all threads are running and the hashing ones have created their VMs
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				if (++ready == participants) {
+					deadline = std::chrono::steady_clock::now() + duration;
+					started.notify_all();
+				}
+				started.wait(lock, [&] { return ready == participants; });
+			}
+			if (vm == nullptr) {
+				std::this_thread::sleep_until(deadline);
+				return;
+			}
+			std::array<char, 76> input = {};
+			RandomxHash hash;
+			uint32_t nonce = 0;
+			auto start = std::chrono::steady_clock::now();
+			auto now = start;
+			while (now < deadline) {
+				memcpy(&input[39], &nonce, sizeof(nonce));
+				randomx_calculate_hash(vm, input.data(), input.size(), hash.data());
+				nonce++;
+				now = std::chrono::steady_clock::now();
+			}
+			randomx_destroy_vm(vm);
+			hashes += nonce;
+			busyTime += std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+		});
+		TuneResult result = { threads, flags, 0, 0 };
+		if (!failed && hashing == threads && hashes > 0) {
+			result.hashrate = hashes * 1000.0 / duration.count();
+			result.latency = busyTime / 1000.0 / hashes;
+		}
+		std::cout << "Autotune: threads " << threads << ", flags " << flags << ": ";
+		if (result.hashrate > 0) {
+			std::cout << result.hashrate << " H/s, " << result.latency << " us" << std::endl;
+		}
+		else {
+			std::cout << "failed" << std::endl;
+		}
+		return result;
+	}
+
+	bool Service::autotune(ServiceWorker* self, TuneObjective objective, std::vector<TuneResult>& results, TuneResult& best) {
+		if (data_->pool_->getPartitionCount() > 1) {
+			std::cout << "Autotuning is not supported with partitions" << std::endl;
+			return false;
+		}
+		bool tuned = false;
+		data_->pool_->runExclusive(self, [&] {
+			if (!data_->initialized_ || data_->cache_ == nullptr) {
+				return;
+			}
+			data_->tuning_ = true;
+			//the flags are compared with all threads for the hashrate and with one thread for the latency;
+			//workers parked by /seed/watch can't be measured
+			unsigned available = data_->pool_->getParallelThreads(self) - (self == nullptr ? 1 : 0);
+			unsigned flagThreads = objective == TuneObjective::Hashrate ? std::min<unsigned>(data_->maxThreads_, available) : 1;
+			std::vector<TuneResult> flagResults;
+			for (int flags : getTuneFlags(data_->flags_)) {
+				auto result = calibrate(*data_, self, flagThreads, flags);
+				if (result.hashrate > 0) {
+					flagResults.push_back(result);
+					results.push_back(result);
+				}
+			}
+			if (!flagResults.empty()) {
+				int flags = selectTuneResult(flagResults, objective).flags;
+				std::vector<TuneResult> threadResults;
+				for (unsigned threads : getTuneThreads(data_->maxThreads_)) {
+					auto it = std::find_if(results.begin(), results.end(), [&](const TuneResult& r) {
+						return r.threads == threads && r.flags == flags;
+					});
+					if (it != results.end()) {
+						threadResults.push_back(*it);
+						continue;
+					}
+					auto result = calibrate(*data_, self, threads, flags);
+					if (result.hashrate > 0) {
+						threadResults.push_back(result);
+						results.push_back(result);
+					}
+				}
+				best = selectTuneResult(threadResults, objective);
+				applyTuning(*data_, best.threads, best.flags);
+				tuned = true;
+			}
+			data_->tuning_ = false;
+		});
+		if (tuned) {
+			std::cout << "Autotune (" << getTuneObjectiveName(objective) << "): using " << best.threads << " threads, flags " << best.flags << std::endl;
+			if (!data_->tuneFile_.empty() && !saveTuneFile(data_->tuneFile_, getTuneKey(data_->maxThreads_, best.flags, objective), best)) {
+				std::cout << "Failed to save " << data_->tuneFile_ << std::endl;
+			}
+		}
+		return tuned;
+	}
+
 	int Service::getAutoFlags() {
 		return ServicePrivate::AutoFlags;
 	}
 
 	int Service::getMachineThreads() {
-		return std::thread::hardware_concurrency();
+		return getResourceLimits().getThreads();
 	}
 
 	bool readRequestBody(const httplib::Request& req, httplib::Response& res, std::vector<char>& body) {
@@ -158,15 +1426,154 @@ namespace randomx {
 		return false;
 	}
 
-	bool readRequestBatch(const httplib::Request& req, httplib::Response& res, std::vector<std::vector<char>>& batch) {
+	//Splits "type; name=value" into the media type and the value of one parameter.
+	static std::string getMediaType(const std::string& ct, const char* name, std::string& param) {
+		auto semicolon = ct.find(';');
+		auto type = ct.substr(0, semicolon);
+		while (!type.empty() && type.back() == ' ') {
+			type.pop_back();
+		}
+		std::string prefix = std::string(name) + "=";
+		while (semicolon != std::string::npos) {
+			auto start = ct.find_first_not_of(' ', semicolon + 1);
+			semicolon = ct.find(';', start);
+			if (start != std::string::npos && !ct.compare(start, prefix.size(), prefix)) {
+				param = ct.substr(start + prefix.size(), semicolon == std::string::npos ? std::string::npos : semicolon - start - prefix.size());
+			}
+		}
+		return type;
+	}
+
+	static bool readVarint(const std::string& input, size_t& pos, uint64_t& value) {
+		value = 0;
+		for (int shift = 0; pos < input.size(); shift += 7) {
+			uint8_t byte = input[pos++];
+			//a 64-bit value has at most 10 bytes and the last one has only 1 bit
+			if (shift >= 64 || (shift == 63 && byte > 1)) {
+				return false;
+			}
+			value |= (uint64_t)(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//varint blob length, blob, varint nonce offset, nonce size (1-8), then either mode 0 and a list
+	//of little-endian nonces or mode 1, the first nonce and the varint number of nonces
+	static bool readTemplateBatch(const std::string& input, BatchInputs& batch, size_t maxBatch, int& status) {
+		status = 400;
+		size_t pos = 0;
+		uint64_t blobSize, nonceOffset, nonceSize;
+		if (!readVarint(input, pos, blobSize) || blobSize > input.size() - pos) {
+			return false;
+		}
+		std::vector<char> blob(input.data() + pos, input.data() + pos + blobSize);
+		pos += blobSize;
+		if (!readVarint(input, pos, nonceOffset) || input.size() - pos < 2) {
+			return false;
+		}
+		nonceSize = (uint8_t)input[pos++];
+		auto mode = input[pos++];
+		if (nonceSize == 0 || nonceSize > 8 || nonceOffset > blobSize || nonceSize > blobSize - nonceOffset) {
+			return false;
+		}
+		uint64_t count;
+		if (mode == 0) {
+			if ((input.size() - pos) % nonceSize != 0) {
+				return false;
+			}
+			count = (input.size() - pos) / nonceSize;
+			if (count > maxBatch) {
+				status = 413;
+				return false;
+			}
+			batch.setTemplate(std::move(blob), nonceOffset, nonceSize, input.substr(pos), 0, count);
+			return true;
+		}
+		if (mode == 1 && input.size() - pos >= nonceSize) {
+			uint64_t start = 0;
+			for (size_t j = nonceSize; j > 0; --j) {
+				start = (start << 8) | (uint8_t)input[pos + j - 1];
+			}
+			pos += nonceSize;
+			if (!readVarint(input, pos, count) || pos != input.size() || !checkNonceRange(nonceSize, start, count)) {
+				return false;
+			}
+			if (count > maxBatch) {
+				status = 413;
+				return false;
+			}
+			batch.setTemplate(std::move(blob), nonceOffset, nonceSize, std::string(), start, count);
+			return true;
+		}
+		return false;
+	}
+
+	static bool readStreamedBody(const httplib::Request& req, httplib::Response& res, std::string& body) {
+		int status = 400;
+		if (!req.read_body([&](const char* data, size_t size, size_t, uint64_t) { body.append(data, size); return true; }, status)) {
+			res.status = status;
+			return false;
+		}
+		return true;
+	}
+
+	bool readRequestBatch(const httplib::Request& req, httplib::Response& res, BatchInputs& batch, size_t maxBatch) {
 		if (!req.has_header(HEADER_CONTENT)) {
 			res.status = 415;
 			return false;
 		}
 		const auto ct = req.get_header_value(HEADER_CONTENT);
-		const auto& input = req.body;
+		//a streamed body that is not hashed while it arrives is read at once
+		std::string streamedBody;
+		if (req.read_body && !readStreamedBody(req, res, streamedBody)) {
+			return false;
+		}
+		const auto& input = req.read_body ? streamedBody : req.body;
 		size_t pos = 0;
-		if (ct == HEX_FORMAT_BATCH) {
+		std::string strideParam;
+		auto mediaType = getMediaType(ct, "stride", strideParam);
+		if (ct == BINARY_FORMAT_TEMPLATE) {
+			int status;
+			if (!readTemplateBatch(input, batch, maxBatch, status)) {
+				res.status = status;
+				return false;
+			}
+		}
+		else if (mediaType == BINARY_FORMAT_BATCH2 && !strideParam.empty()) {
+			//all inputs have the same length
+			uint64_t stride;
+			if (!parseUint64(strideParam, stride) || stride == 0 || input.size() % stride != 0) {
+				res.status = 400;
+				return false;
+			}
+			if (input.size() / stride > maxBatch) {
+				res.status = 413;
+				return false;
+			}
+			for (; pos < input.size(); pos += stride) {
+				batch.add(std::vector<char>(input.data() + pos, input.data() + pos + stride));
+			}
+		}
+		else if (mediaType == BINARY_FORMAT_BATCH2) {
+			//each input is prefixed by its length as an unsigned LEB128 number
+			while (pos < input.size()) {
+				uint64_t segmentSize;
+				if (!readVarint(input, pos, segmentSize) || segmentSize > input.size() - pos) {
+					res.status = 400;
+					return false;
+				}
+				if (batch.size() == maxBatch) {
+					res.status = 413;
+					return false;
+				}
+				batch.add(std::vector<char>(input.data() + pos, input.data() + pos + segmentSize));
+				pos += segmentSize;
+			}
+		}
+		else if (ct == HEX_FORMAT_BATCH) {
 			while (pos < input.size()) {
 				std::vector<char> body;
 				auto space = input.find(' ', pos);
@@ -179,7 +1586,7 @@ namespace randomx {
 					res.status = 400;
 					return false;
 				}
-				batch.push_back(body);
+				batch.add(std::move(body));
 				pos = space + 1;
 			}
 		}
@@ -191,30 +1598,347 @@ namespace randomx {
 					res.status = 400;
 					return false;
 				}
-				pos++;
-				if (pos + segmentSize > input.size()) {
-					res.status = 400;
-					return false;
+				pos++;
+				if (pos + segmentSize > input.size()) {
+					res.status = 400;
+					return false;
+				}
+				body.resize(segmentSize);
+				memcpy(body.data(), input.data() + pos, segmentSize);
+				batch.add(std::move(body));
+				pos += segmentSize;
+			}
+		}
+		else {
+			res.status = 415;
+			return false;
+		}
+		if (batch.size() == 0) {
+			res.status = 400;
+			return false;
+		}
+		if (batch.size() > maxBatch) {
+			res.status = 413;
+			return false;
+		}
+		return true;
+	}
+
+	//Splits the body of a batch into inputs as it arrives, so the first inputs can be hashed before the
+	//rest of the body has been received. The formats are the same as for readRequestBatch, except for
+	//template batches, which are small enough to be read at once.
+	class BatchReader {
+	public:
+		BatchReader() : format_(Format::Hex), stride_(0), pos_(0), scan_(0) {}
+
+		bool init(const std::string& ct) {
+			std::string strideParam;
+			auto mediaType = getMediaType(ct, "stride", strideParam);
+			if (mediaType == BINARY_FORMAT_BATCH2 && !strideParam.empty()) {
+				format_ = Format::Stride;
+				return parseUint64(strideParam, stride_) && stride_ > 0;
+			}
+			if (mediaType == BINARY_FORMAT_BATCH2) {
+				format_ = Format::Varint;
+				return true;
+			}
+			if (ct == HEX_FORMAT_BATCH) {
+				format_ = Format::Hex;
+				return true;
+			}
+			if (ct == BINARY_FORMAT_BATCH) {
+				format_ = Format::Binary;
+				return true;
+			}
+			return false;
+		}
+
+		void append(const char* data, size_t size) {
+			//the inputs that have been read are dropped from time to time
+			if (pos_ > 0 && pos_ >= buffer_.size() / 2) {
+				buffer_.erase(0, pos_);
+				scan_ = scan_ > pos_ ? scan_ - pos_ : 0;
+				pos_ = 0;
+			}
+			buffer_.append(data, size);
+		}
+
+		//Returns 1 and the next input, 0 if the next input has not been received completely or -1 if
+		//the body is malformed. At the end of the body, the rest of the buffer must be complete inputs.
+		int next(std::vector<char>& input, bool end) {
+			size_t available = buffer_.size() - pos_;
+			if (available == 0) {
+				return 0;
+			}
+			const char* data = buffer_.data() + pos_;
+			size_t prefix = 0;
+			uint64_t size = 0;
+			switch (format_) {
+			case Format::Hex: {
+				//a long input arrives in several chunks; the part without a space is not searched again
+				auto space = buffer_.find(' ', std::max(pos_, scan_));
+				if (space == std::string::npos) {
+					if (!end) {
+						scan_ = buffer_.size();
+						return 0;
+					}
+					space = buffer_.size();
+				}
+				size = space - pos_;
+				input.resize(size / 2);
+				if (!hex2bin(data, size, input.data())) {
+					return -1;
+				}
+				pos_ = std::min(space + 1, buffer_.size());
+				return 1;
+			}
+			case Format::Binary:
+				if ((int8_t)data[0] < 0) {
+					return -1;
+				}
+				prefix = 1;
+				size = (uint8_t)data[0];
+				break;
+			case Format::Varint:
+				for (int shift = 0;; shift += 7) {
+					if (prefix == available) {
+						return end ? -1 : 0;
+					}
+					uint8_t byte = data[prefix++];
+					if (shift >= 64 || (shift == 63 && byte > 1)) {
+						return -1;
+					}
+					size |= (uint64_t)(byte & 0x7f) << shift;
+					if (!(byte & 0x80)) {
+						break;
+					}
+				}
+				break;
+			case Format::Stride:
+				size = stride_;
+				break;
+			}
+			if (size > available - prefix) {
+				return end ? -1 : 0;
+			}
+			input.assign(data + prefix, data + prefix + size);
+			pos_ += prefix + size;
+			return 1;
+		}
+
+	private:
+		enum class Format { Hex, Binary, Varint, Stride };
+		Format format_;
+		uint64_t stride_;
+		std::string buffer_;
+		size_t pos_;
+		//where the search for the next space continues
+		size_t scan_;
+	};
+
+	//Hashes the inputs of a batch while the body is received, so reading the socket and hashing overlap.
+	//Returns false if the request has been answered with an error.
+	static bool calculateIncomingBatch(ServicePrivate& data, ServiceWorker& w, const httplib::Request& req, httplib::Response& res, BatchReader& reader, size_t maxBatch, std::vector<RandomxHash>& hashes) {
+		auto deadline = getDeadline(req);
+		if (std::chrono::steady_clock::now() >= deadline) {
+			deadlineExpired(w, res);
+			return false;
+		}
+		if (!checkQuota(data, w, res)) {
+			return false;
+		}
+		std::vector<char> input;
+		size_t inputs = 0;
+		int status = 0;
+		bool expired = false;
+		BatchHasher hasher(data, w, hashes);
+		auto consume = [&](bool end) {
+			int result;
+			while ((result = reader.next(input, end)) > 0) {
+				if (inputs == maxBatch) {
+					status = 413;
+					return false;
+				}
+				hasher.add(input);
+				inputs++;
+				if (std::chrono::steady_clock::now() >= deadline) {
+					expired = true;
+					return false;
+				}
+			}
+			if (result < 0) {
+				status = 400;
+				return false;
+			}
+			return true;
+		};
+		int readStatus = 400;
+		bool ok = req.read_body([&](const char* buf, size_t size, size_t, uint64_t) {
+			reader.append(buf, size);
+			return consume(false);
+		}, readStatus) && consume(true);
+		if (ok) {
+			hasher.finish();
+		}
+		countHashes(data, w, hasher.getCalculated());
+		hashes.resize(hasher.getReady());
+		if (expired) {
+			//the rest of the body is not read, so the connection is closed
+			if (hashes.empty()) {
+				deadlineExpired(w, res);
+				return false;
+			}
+			w.partition_->expired_.fetch_add(1);
+			res.set_header(HEADER_RANDOMX_PARTIAL, "true");
+			return true;
+		}
+		if (!ok || inputs == 0) {
+			res.status = status != 0 ? status : readStatus;
+			return false;
+		}
+		return true;
+	}
+
+	//With the result cache, identical requests that arrive while the hash is calculated wait for it.
+	//The waiting worker holds its VM, so it gives up after a few hash times and calculates the hash
+	//itself; a slow request can't tie up many workers or delay a reseed.
+	static void calculateHash(ServicePrivate& data, ServiceWorker& w, const httplib::Request& req, const std::vector<char>& input, RandomxHash& hash) {
+		auto cache = data.hashCache_.get();
+		if (cache != nullptr) {
+			auto generation = cache->getGeneration();
+			bool light = w.partition_->light_ || !(data.flags_ & RANDOMX_FLAG_FULL_MEM);
+			auto wait = std::chrono::steady_clock::now() + std::chrono::milliseconds(light ? SERVICE_LIGHT_MERGE_WAIT_MS : SERVICE_MERGE_WAIT_MS);
+			if (cache->find(generation, input.data(), input.size(), hash.data()) || cache->acquire(generation, input.data(), input.size(), hash.data(), std::min(wait, getDeadline(req)))) {
+				return;
+			}
+			randomx_calculate_hash(w.vm_, input.data(), input.size(), hash.data());
+			cache->release(generation, input.data(), input.size(), hash.data());
+		}
+		else {
+			randomx_calculate_hash(w.vm_, input.data(), input.size(), hash.data());
+		}
+		countHashes(data, w, 1);
+	}
+
+	static void appendVarint(uint64_t value, std::string& out) {
+		while (value >= 0x80) {
+			out += (char)(value | 0x80);
+			value >>= 7;
+		}
+		out += (char)value;
+	}
+
+	//a WebSocket message starts with the type and a little-endian request id
+	static bool readWebSocketHeader(const std::string& message, uint8_t& type, uint32_t& id) {
+		if (message.size() < WEBSOCKET_HEADER_SIZE) {
+			return false;
+		}
+		type = message[0];
+		id = 0;
+		for (int i = 4; i >= 1; --i) {
+			id = (id << 8) | (uint8_t)message[i];
+		}
+		return true;
+	}
+
+	//a response repeats the type with the high bit set and the request id, followed by the status code
+	static std::string getWebSocketHeader(uint8_t type, uint32_t id, int status) {
+		std::string header;
+		header += (char)(type | WEBSOCKET_RESPONSE);
+		for (int i = 0; i < 4; ++i) {
+			header += (char)(id >> (8 * i));
+		}
+		header += (char)status;
+		header += (char)(status >> 8);
+		return header;
+	}
+
+	static std::string getWebSocketSeed(const std::string& seed) {
+		return getWebSocketHeader(WEBSOCKET_SEED, 0, 200) + seed;
+	}
+
+	//Answers a WebSocket message like the HTTP endpoint of the same kind would answer the request.
+	//The payload of a hash request is the input, a batch is in the format of application/x.randomx.batch2+bin
+	//and a mine request has a byte that selects the target (0) or the difficulty (1), the varint value
+	//and a template batch.
+	static void processWebSocketMessage(Service& svc, ServicePrivate& data, ServiceWorker& w, WebSocketSession& session, const std::string& message, std::chrono::steady_clock::time_point received) {
+		uint8_t type = 0;
+		uint32_t id = 0;
+		httplib::Request req;
+		httplib::Response res;
+		req.received = received;
+		req.is_connection_closed = [&session] { return session.isClosed(); };
+		res.status = 200;
+		std::string out;
+		svc.recordActivity();
+		if (!readWebSocketHeader(message, type, id)) {
+			res.status = 400;
+		}
+		else if (w.vm_ == nullptr) {
+			res.status = 503;
+		}
+		else if (!data.initialized_) {
+			//the first seed may be being initialized
+			res.status = isSeedPending(data) ? 503 : 403;
+		}
+		else if (type == WEBSOCKET_HASH) {
+			std::vector<char> input(message.begin() + WEBSOCKET_HEADER_SIZE, message.end());
+			if (checkQuota(data, w, res)) {
+				RandomxHash hash;
+				calculateHash(data, w, req, input, hash);
+				out.append(hash.data(), hash.size());
+			}
+		}
+		else if (type == WEBSOCKET_BATCH) {
+			req.set_header(HEADER_CONTENT, BINARY_FORMAT_BATCH2);
+			req.body = message.substr(WEBSOCKET_HEADER_SIZE);
+			BatchInputs batch;
+			std::vector<RandomxHash> hashes;
+			if (readRequestBatch(req, res, batch, data.maxBatch_) && calculateBatch(data, w, req, res, batch, hashes)) {
+				for (auto& hash : hashes) {
+					out.append(hash.data(), hash.size());
+				}
+			}
+		}
+		else if (type == WEBSOCKET_MINE) {
+			auto payload = message.substr(WEBSOCKET_HEADER_SIZE);
+			size_t pos = 1;
+			uint64_t target;
+			BatchInputs batch;
+			int status;
+			if (payload.empty() || (uint8_t)payload[0] > 1 || !readVarint(payload, pos, target) || target == 0) {
+				res.status = 400;
+			}
+			else if (!readTemplateBatch(payload.substr(pos), batch, SERVICE_MAX_MINE_COUNT, status)) {
+				res.status = status;
+			}
+			else if (batch.size() == 0) {
+				res.status = 400;
+			}
+			else {
+				//the number of calculated hashes, then the varint nonce and the hash of each hit
+				bool difficulty = payload[0] == 1;
+				std::string hits;
+				std::vector<char> buffer;
+				size_t done;
+				bool ok = calculateHashes(data, w, req, res, batch.size(),
+					[&](size_t i) -> const std::vector<char>& { return batch.get(i, buffer); },
+					[&](size_t i, const RandomxHash& hash) {
+						if (meetsTarget(hash, target, difficulty)) {
+							appendVarint(batch.nonce(i), hits);
+							hits.append(hash.data(), hash.size());
+						}
+					}, done);
+				if (ok) {
+					appendVarint(done, out);
+					out += hits;
 				}
-				body.resize(segmentSize);
-				memcpy(body.data(), input.data() + pos, segmentSize);
-				batch.push_back(body);
-				pos += segmentSize;
 			}
 		}
 		else {
-			res.status = 415;
-			return false;
-		}
-		if (batch.empty()) {
 			res.status = 400;
-			return false;
-		}
-		if (batch.size() > SERVICE_MAX_BATCH_SIZE) {
-			res.status = 413;
-			return false;
 		}
-		return true;
+		session.send(getWebSocketHeader(type, id, res.status) + out);
 	}
 
 	bool Service::checkSeed(const httplib::Request& req) {
@@ -229,9 +1953,79 @@ namespace randomx {
 	}
 
 	void Service::reinitCache(const void* seed, size_t seedSize) {
-		randomx_init_cache(data_->cache_, seed, seedSize);
+		initLightCache(*data_, seed, seedSize);
+		setSeed(seed, seedSize);
+	}
+
+	void Service::setSeed(const void* seed, size_t seedSize) {
+		std::unique_lock<std::mutex> lock(data_->statusMutex_);
+		bool changed = !data_->initialized_ || data_->seed_ != std::string((const char*)seed, seedSize);
+		data_->seed_.assign((const char*)seed, seedSize);
 		data_->seedHex_ = bin2hex((const char*)seed, seedSize);
 		data_->initialized_ = true;
+		//the cached results stay valid when the memory is rebuilt for the same seed
+		if (changed && data_->hashCache_) {
+			data_->hashCache_->clear();
+		}
+		//the workers are stopped, so the WebSocket clients get the seed before any hash calculated with it
+		if (changed) {
+			data_->webSockets_.broadcast(getWebSocketSeed(data_->seed_));
+		}
+	}
+
+	void Service::enableUpgrade(const std::vector<std::string>& args) {
+		data_->upgradeArgs_ = args;
+		data_->upgradeEnabled_ = true;
+	}
+
+	bool Service::upgrade() {
+		std::unique_lock<std::mutex> lock(data_->upgradeMutex_);
+		UpgradeState state;
+		state.listenFd = data_->server_.get_socket();
+		if (!data_->upgradeEnabled_ || data_->upgraded_ || state.listenFd == INVALID_SOCKET) {
+			return false;
+		}
+		std::cout << "Upgrade: starting " << data_->upgradeArgs_[0] << std::endl;
+		//the seed must not change until the new process has taken over
+		data_->pool_->lockReseed();
+		{
+			std::unique_lock<std::mutex> statusLock(data_->statusMutex_);
+			state.initialized = data_->initialized_;
+			state.seed = data_->seed_;
+		}
+		//a shared dataset is attached by the new process itself
+		if (state.initialized && (data_->flags_ & RANDOMX_FLAG_FULL_MEM) && !data_->sharedDataset_) {
+			state.datasetFd = copyDataset(data_->dataset_);
+		}
+		int sock = startUpgrade(data_->upgradeArgs_);
+		bool ok = sock >= 0 && sendUpgradeState(sock, state);
+		if (state.datasetFd >= 0) {
+			closeDescriptor(state.datasetFd);
+		}
+		if (sock >= 0) {
+			ok = waitUpgradeReady(sock) && ok;
+		}
+		if (!ok) {
+			data_->pool_->unlockReseed();
+			std::cout << "Upgrade failed" << std::endl;
+			return false;
+		}
+		data_->upgraded_ = true;
+		data_->pool_->unlockReseed();
+		std::cout << "Upgrade: the new process is ready, draining connections" << std::endl;
+		data_->server_.stop_accepting();
+		return true;
+	}
+
+	bool Service::resumeUpgrade() {
+		auto& state = data_->inherited_;
+		if (state.initialized) {
+			reseed(state.seed.data(), state.seed.size());
+		}
+		if (!data_->server_.adopt_socket(state.listenFd)) {
+			return false;
+		}
+		return sendUpgradeReady(data_->upgradeFd_);
 	}
 
 	void Service::enableLog() {
@@ -247,6 +2041,40 @@ namespace randomx {
 		});
 	}
 
+	void Service::enableH2c() {
+		auto* data = data_.get();
+		data->http2_.setPayloadLimit([data](const std::string& path) {
+			return data->server_.get_payload_max_length(path);
+		});
+		data->server_.set_h2c_handler([data](ServiceWorker& w, socket_t sock, const httplib::Request* upgrade) {
+			auto* partition = w.partition_ != nullptr ? w.partition_ : &data->pool_->getPartition(0);
+			//each stream is queued like a connection of the same client
+			auto handler = [data, partition](const std::shared_ptr<Http2Connection>& connection, uint32_t stream, const std::shared_ptr<httplib::Request>& req) {
+				httplib::Task<ServiceWorker> task;
+				task.run = [data, connection, stream, req](ServiceWorker& w) {
+					httplib::Response res;
+					data->server_.handle_request(w, *req, res);
+					connection->respond(stream, *req, res);
+				};
+				task.reject = [connection, stream](int status, int retryAfter) {
+					connection->respond(stream, status, retryAfter);
+				};
+				auto timeout = req->get_header_value(HEADER_RANDOMX_TIMEOUT);
+				auto client = req->get_header_value(HEADER_RANDOMX_KEY);
+				task.peek = [timeout, client](httplib::RequestInfo& info) {
+					if (!timeout.empty()) {
+						info.timeout = httplib::parse_request_timeout(timeout);
+					}
+					info.client = client;
+					return true;
+				};
+				task.remote_addr = connection->getRemoteAddr();
+				data->pool_->enqueue(*partition, task);
+			};
+			data->http2_.add(sock, handler, upgrade);
+		});
+	}
+
 	inline void outputContentType(bool outputHex, httplib::Response& res) {
 		res.set_header(HEADER_CONTENT, outputHex ? HEX_FORMAT : BINARY_FORMAT);
 	}
@@ -267,18 +2095,18 @@ namespace randomx {
 		}
 	}
 
-	bool getOutputFormat(const httplib::Request& req, const char* binary) {
-		bool outputHex = true;
-		size_t accepts;
-		if (accepts = req.get_header_value_count(HEADER_ACCEPT)) {
-			for (size_t i = 0; i < accepts; ++i) {
-				if (req.get_header_value(HEADER_ACCEPT, i) == binary) {
-					outputHex = false;
-					break;
-				}
+	static bool accepts(const httplib::Request& req, const char* type) {
+		size_t count = req.get_header_value_count(HEADER_ACCEPT);
+		for (size_t i = 0; i < count; ++i) {
+			if (req.get_header_value(HEADER_ACCEPT, i) == type) {
+				return true;
 			}
 		}
-		return outputHex;
+		return false;
+	}
+
+	bool getOutputFormat(const httplib::Request& req, const char* binary) {
+		return !accepts(req, binary);
 	}
 
 	void outputBody(const httplib::Request& req, httplib::Response& res, RandomxHash& hash) {
@@ -288,6 +2116,15 @@ namespace randomx {
 	}
 
 	void outputBody(const httplib::Request& req, httplib::Response& res, std::vector<RandomxHash>& batch) {
+		if (accepts(req, BINARY_FORMAT_BATCH2)) {
+			//the hashes have a fixed size, so they don't need length prefixes
+			res.set_header(HEADER_CONTENT, BINARY_FORMAT_BATCH2 "; stride=32");
+			res.body.reserve(batch.size() * RANDOMX_HASH_SIZE);
+			for (const auto& hash : batch) {
+				res.body.append(hash.data(), hash.size());
+			}
+			return;
+		}
 		bool outputHex = getOutputFormat(req, BINARY_FORMAT_BATCH);
 		outputContentType(outputHex, res);
 		for (const auto& hash : batch) {
@@ -295,9 +2132,137 @@ namespace randomx {
 		}
 	}
 
-	Service::Service(size_t threads, int flags) :
-		data_(new ServicePrivate(*this, threads, flags))
+	static void outputJobStatus(const BulkJob& job, httplib::Response& res) {
+		auto status = job.getStatus();
+		std::stringstream out;
+		out << "{\n";
+		out << "\t\"id\": \"" << job.getId() << "\",\n";
+		out << "\t\"state\": \"" << getJobStateName(status.state) << "\",\n";
+		out << "\t\"priority\": \"" << (job.isLowPriority() ? "low" : "normal") << "\",\n";
+		out << "\t\"hashes\": " << status.hashes << ",\n";
+		out << "\t\"done\": " << status.done << ",\n";
+		out << "\t\"progress\": " << (100.0 * status.done / status.hashes) << ",\n";
+		out << "\t\"seconds\": " << status.seconds << ",\n";
+		out << "\t\"hashrate\": " << (status.seconds > 0 ? status.done / status.seconds : 0) << ",\n";
+		out << "\t\"error\": ";
+		if (status.state == JobState::Failed) {
+			out << "\"" << status.error << "\"\n";
+		}
+		else {
+			out << "null\n";
+		}
+		out << "}\n";
+		res.set_content(out.str(), "application/json");
+	}
+
+	//streamed batches and job results use the formats of /batch; each hash takes the same number of bytes
+	static size_t getHashFormat(const httplib::Request& req, std::string& contentType) {
+		if (accepts(req, BINARY_FORMAT_BATCH2)) {
+			contentType = BINARY_FORMAT_BATCH2 "; stride=32";
+			return RANDOMX_HASH_SIZE;
+		}
+		if (accepts(req, BINARY_FORMAT_BATCH)) {
+			contentType = BINARY_FORMAT;
+			return RANDOMX_HASH_SIZE + 1;
+		}
+		contentType = HEX_FORMAT;
+		return 2 * RANDOMX_HASH_SIZE + 1;
+	}
+
+	static void appendHash(const char* hash, size_t recordSize, std::string& out) {
+		if (recordSize == 2 * RANDOMX_HASH_SIZE + 1) {
+			out += bin2hex(hash, RANDOMX_HASH_SIZE);
+			out += ' ';
+		}
+		else {
+			if (recordSize == RANDOMX_HASH_SIZE + 1) {
+				out += (char)RANDOMX_HASH_SIZE;
+			}
+			out.append(hash, RANDOMX_HASH_SIZE);
+		}
+	}
+
+	static void appendJobResults(const BulkJob& job, size_t begin, size_t end, size_t recordSize, std::string& out) {
+		for (size_t i = begin; i < end; ++i) {
+			appendHash(job.getResult(i), recordSize, out);
+		}
+	}
+
+	//Sends the hashes of a batch with chunked transfer encoding as they are calculated, so the client
+	//can check the first hashes before the last one is done. The content provider runs on the worker
+	//that handles the request when the response is written.
+	static void streamBatch(ServicePrivate& data, ServiceWorker& w, const httplib::Request& req, httplib::Response& res, BatchInputs&& inputs, size_t hashesPerChunk) {
+		struct Stream {
+			Stream(ServicePrivate& data, ServiceWorker& w, BatchInputs&& inputs) :
+				batch(std::move(inputs)), hasher(data, w, hashes), next(0), sent(0), finished(false) {}
+			BatchInputs batch;
+			std::vector<RandomxHash> hashes;
+			BatchHasher hasher;
+			size_t next;
+			size_t sent;
+			bool finished;
+		};
+		std::string contentType;
+		size_t recordSize = getHashFormat(req, contentType);
+		res.set_header(HEADER_CONTENT, contentType);
+		auto stream = std::make_shared<Stream>(data, w, std::move(inputs));
+		auto deadline = getDeadline(req);
+		res.set_chunked_content_provider([&data, &w, &req, stream, deadline, recordSize, hashesPerChunk](size_t offset, httplib::DataSink sink, httplib::Done done) {
+			size_t count = stream->batch.size();
+			if (stream->sent == count) {
+				done();
+				return;
+			}
+			if (req.is_connection_closed && req.is_connection_closed()) {
+				w.partition_->cancelled_.fetch_add(1);
+				done();
+				return;
+			}
+			//the status has been sent, so the client can only tell from the number of hashes
+			if (std::chrono::steady_clock::now() >= deadline) {
+				w.partition_->expired_.fetch_add(1);
+				done();
+				return;
+			}
+			std::vector<char> buffer;
+			auto& hasher = stream->hasher;
+			size_t calculated = hasher.getCalculated();
+			while (hasher.getReady() - stream->sent < hashesPerChunk && !stream->finished) {
+				if (stream->next < count) {
+					hasher.add(stream->batch.get(stream->next++, buffer));
+				}
+				else {
+					hasher.finish();
+					stream->finished = true;
+				}
+			}
+			countHashes(data, w, hasher.getCalculated() - calculated);
+			std::string chunk;
+			for (; stream->sent < hasher.getReady(); ++stream->sent) {
+				appendHash(stream->hashes[stream->sent].data(), recordSize, chunk);
+			}
+			sink(chunk.data(), chunk.size());
+		});
+	}
+
+	Service::Service(size_t threads, int flags, const MemoryOptions& memory, const std::vector<PartitionOptions>& partitions) :
+		data_(new ServicePrivate(*this, threads, flags, memory))
 	{
+		data_->partitions_ = partitions;
+		if (partitions.empty()) {
+			data_->partitions_.push_back({ "default", (int)threads, false, 0 });
+		}
+		for (auto& partition : data_->partitions_) {
+			if (partition.light && (data_->flags_ & RANDOMX_FLAG_FULL_MEM)) {
+				data_->lightMachines_ = true;
+			}
+		}
+		data_->pool_.reset(new ThreadPool(*this, data_->partitions_));
+		data_->server_.set_timeout_header(HEADER_RANDOMX_TIMEOUT);
+		data_->server_.set_payload_max_length("/jobs", SERVICE_MAX_JOB_PAYLOAD);
+		data_->server_.stream_request_body("/batch");
+		data_->webSockets_.setMaxMessage(WEBSOCKET_HEADER_SIZE + SERVICE_MAX_PAYLOAD);
+
 		auto options = [&](ServiceWorker& w, const httplib::Request& req, httplib::Response& res) {
 			if (!allowCors("POST", req, res)) {
 				res.status = 403;
@@ -314,7 +2279,9 @@ namespace randomx {
 				info << "{\n";
 				info << "\t\"randomx_service\": \"v" RANDOMX_SERVICE_VERSION "\",\n";
 				info << "\t\"algorithm\": \"" SERVICE_ALGORITHM "\",\n";
-				info << "\t\"threads\": " << data_->threads_ << ",\n";
+				info << "\t\"threads\": " << data_->threads_.load() << ",\n";
+				std::unique_lock<std::mutex> lock(data_->statusMutex_);
+				info << "\t\"epoch\": " << data_->epoch_ << ",\n";
 				info << "\t\"seed\": ";
 				if (data_->initialized_) {
 					info << "\"" << data_->seedHex_ << "\"";
@@ -322,7 +2289,92 @@ namespace randomx {
 				else {
 					info << "null";
 				}
-				info << ",\n\t\"hashes\": " << data_->hashes_.load() << "\n";
+				lock.unlock();
+				info << ",\n\t\"hashes\": " << data_->hashes_.load() << ",\n";
+				info << "\t\"reseed\": {\n";
+				info << "\t\t\"cache_ms\": " << data_->cacheTime_ << ",\n";
+				info << "\t\t\"dataset_ms\": " << data_->datasetTime_ << ",\n";
+				info << "\t\t\"dataset_file\": " << (data_->datasetLoaded_ ? "true" : "false") << ",\n";
+				info << "\t\t\"dataset_shared\": " << (data_->datasetShared_ ? "true" : "false") << "\n";
+				info << "\t},\n";
+				info << "\t\"memory\": {\n";
+				info << "\t\t\"dataset_pages\": ";
+				if (data_->datasetPages_ != nullptr) {
+					info << "\"" << data_->datasetPages_ << "\"";
+				}
+				else {
+					info << "null";
+				}
+				info << ",\n\t\t\"cache_pages\": \"" << ((data_->flags_ & RANDOMX_FLAG_LARGE_PAGES) ? "2m" : "4k") << "\",\n";
+				info << "\t\t\"locked\": " << (data_->memoryLocked_ ? "true" : "false") << "\n";
+				info << "\t},\n";
+				int64_t idle;
+				getIdleSeconds(*data_, idle);
+				lock.lock();
+				info << "\t\"idle\": {\n";
+				info << "\t\t\"timeout_minutes\": " << data_->idleTimeout_ << ",\n";
+				info << "\t\t\"mode\": \"" << (data_->idleSleep_ ? "sleep" : "light") << "\",\n";
+				info << "\t\t\"state\": \"" << getIdleStateName(data_->idleState_) << "\",\n";
+				info << "\t\t\"idle_seconds\": " << idle << "\n";
+				lock.unlock();
+				info << "\t},\n";
+				info << "\t\"queue\": {\n";
+				info << "\t\t\"limit\": " << data_->queueLimit_ << ",\n";
+				info << "\t\t\"policy\": \"" << (data_->dropOldest_ ? "drop-oldest" : "reject") << "\",\n";
+				info << "\t\t\"spin_us\": " << data_->spinTime_ << "\n";
+				info << "\t},\n";
+				info << "\t\"cache\": ";
+				if (data_->hashCache_) {
+					auto stats = data_->hashCache_->getStats();
+					info << "{\n";
+					info << "\t\t\"capacity\": " << stats.capacity << ",\n";
+					info << "\t\t\"lookups\": " << stats.lookups << ",\n";
+					info << "\t\t\"hits\": " << stats.hits << ",\n";
+					info << "\t\t\"hit_rate\": " << (stats.lookups > 0 ? (double)stats.hits / stats.lookups : 0) << ",\n";
+					info << "\t\t\"merged\": " << stats.merged << ",\n";
+					info << "\t\t\"duplicates\": " << stats.duplicates << "\n";
+					info << "\t},\n";
+				}
+				else {
+					info << "null,\n";
+				}
+				info << "\t\"partitions\": [\n";
+				for (size_t i = 0; i < data_->partitions_.size(); ++i) {
+					auto& options = data_->partitions_[i];
+					auto& partition = data_->pool_->getPartition(i);
+					auto queue = data_->pool_->getQueueStats(partition);
+					bool light = options.light || !(data_->flags_ & RANDOMX_FLAG_FULL_MEM);
+					info << "\t\t{ \"name\": \"" << options.name << "\", \"threads\": " << options.threads;
+					info << ", \"mode\": \"" << (light ? "light" : "full") << "\", \"port\": " << options.port;
+					info << ", \"busy\": " << partition.busy_.load() << ", \"queued\": " << queue.queued;
+					info << ", \"queue_wait_ms\": " << (int64_t)(queue.waitAvg + 0.5) << ", \"queue_wait_max_ms\": " << (int64_t)(queue.waitMax + 0.5);
+					info << ", \"rejected\": " << queue.rejected << ", \"dropped\": " << queue.dropped;
+					info << ", \"expired\": " << queue.expired << ", \"cancelled\": " << queue.cancelled;
+					info << ", \"hashes\": " << partition.hashes_.load() << " }" << (i + 1 < data_->partitions_.size() ? ",\n" : "\n");
+				}
+				info << "\t]\n";
+				info << "}\n";
+				res.set_content(info.str(), "application/json");
+			})
+			.Get("/clients", [&](ServiceWorker& w, const httplib::Request& req, httplib::Response& res) {
+				allowCors("GET", req, res);
+				std::stringstream info;
+				info << "{\n";
+				info << "\t\"identity\": \"" << getClientIdentityName(data_->clientLimits_.identity) << "\",\n";
+				info << "\t\"max_connections\": " << data_->clientLimits_.connections << ",\n";
+				info << "\t\"max_hashrate\": " << data_->clientLimits_.hashrate << ",\n";
+				info << "\t\"clients\": [";
+				bool first = true;
+				for (size_t i = 0; i < data_->partitions_.size(); ++i) {
+					for (auto& client : data_->pool_->getClientUsage(data_->pool_->getPartition(i))) {
+						info << (first ? "\n" : ",\n");
+						info << "\t\t{ \"partition\": \"" << escapeJson(data_->partitions_[i].name) << "\", \"client\": \"" << escapeJson(client.client) << "\"";
+						info << ", \"connections\": " << client.connections << ", \"queued\": " << client.queued;
+						info << ", \"requests\": " << client.requests << ", \"hashes\": " << client.hashes << ", \"rejected\": " << client.rejected << " }";
+						first = false;
+					}
+				}
+				info << (first ? "]\n" : "\n\t]\n");
 				info << "}\n";
 				res.set_content(info.str(), "application/json");
 			})
@@ -336,13 +2388,155 @@ namespace randomx {
 					res.status = 413;
 					return;
 				}
-				w.pool_.reseed(w, body.data(), body.size());
+				if (data_->upgraded_) {
+					//the new process has the seed of this process; the client must reconnect
+					serviceUnavailable(*data_, res);
+					return;
+				}
+				std::string seed(body.data(), body.size());
+				bool async = req.get_header_value(HEADER_PREFER) == "respond-async";
+				if (!async && w.control_) {
+					serviceUnavailable(*data_, res);
+					return;
+				}
+				if (async) {
+					auto epoch = reseedAsync(seed);
+					res.status = 202;
+					res.set_header("Location", "/seed/status");
+					res.set_content("{\n\t\"epoch\": " + std::to_string(epoch) + "\n}\n", "application/json");
+					return;
+				}
+				auto epoch = newEpoch();
+				reseed(&w, seed, epoch);
+				res.status = 204;
+			})
+			.Get("/live", [&](ServiceWorker& w, const httplib::Request& req, httplib::Response& res) {
+				res.status = 204;
+			})
+			.Get("/ready", [&](ServiceWorker& w, const httplib::Request& req, httplib::Response& res) {
+				if (!isReady()) {
+					serviceUnavailable(*data_, res);
+					return;
+				}
 				res.status = 204;
 			})
+			.Get("/seed/status", [&](ServiceWorker& w, const httplib::Request& req, httplib::Response& res) {
+				allowCors("GET", req, res);
+				std::unique_lock<std::mutex> lock(data_->statusMutex_);
+				outputSeedStatus(*data_, res);
+			})
+			.Get("/seed/watch", [&](ServiceWorker& w, const httplib::Request& req, httplib::Response& res) {
+				allowCors("GET", req, res);
+				std::unique_lock<std::mutex> lock(data_->statusMutex_);
+				uint64_t epoch = data_->epoch_;
+				int timeout = SERVICE_WATCH_TIMEOUT;
+				if (req.has_param("epoch")) {
+					epoch = std::strtoull(req.get_param_value("epoch").c_str(), nullptr, 10);
+				}
+				if (req.has_param("timeout")) {
+					timeout = std::min(std::atoi(req.get_param_value("timeout").c_str()), SERVICE_WATCH_MAX_TIMEOUT);
+				}
+				if (epoch == data_->epoch_ && timeout > 0) {
+					if (w.control_) {
+						lock.unlock();
+						serviceUnavailable(*data_, res);
+						return;
+					}
+					//each watcher occupies a worker thread, so at least half of them are kept for hashing
+					if (data_->watchers_ + 1 > std::max<size_t>(1, data_->threads_ / 2)) {
+						res.status = 503;
+						res.set_header("Retry-After", std::to_string(timeout));
+						return;
+					}
+					data_->watchers_++;
+					w.pool_.park(w);
+					data_->epochCond_.wait_for(lock, std::chrono::seconds(timeout), [&] { return epoch != data_->epoch_; });
+					data_->watchers_--;
+					lock.unlock();
+					w.pool_.unpark(w);
+					lock.lock();
+				}
+				if (epoch == data_->epoch_) {
+					res.status = 204;
+					return;
+				}
+				outputSeedStatus(*data_, res);
+			})
+			.Get("/ws", [&](ServiceWorker& w, const httplib::Request& req, httplib::Response& res) {
+				//browsers send the origin of the page, which must be allowed with -origin
+				if (req.has_header(HEADER_ORIGIN) && req.get_header_value(HEADER_ORIGIN) != data_->origin_) {
+					res.status = 403;
+					return;
+				}
+				std::string acceptKey;
+				if (!WebSocketHub::getAcceptKey(req, acceptKey)) {
+					res.status = 400;
+					return;
+				}
+				if (data_->webSockets_.size() >= WebSocketHub::MaxConnections) {
+					res.status = 503;
+					return;
+				}
+				res.status = 101;
+				res.set_header("Upgrade", "websocket");
+				res.set_header("Connection", "Upgrade");
+				res.set_header("Sec-WebSocket-Accept", acceptKey);
+				//browsers can't set headers, so the client key may be passed as a parameter
+				auto client = req.has_param("key") ? req.get_param_value("key") : req.get_header_value(HEADER_RANDOMX_KEY);
+				auto remoteAddr = req.remote_addr;
+				auto* partition = w.partition_ != nullptr ? w.partition_ : &data_->pool_->getPartition(0);
+				auto* data = data_.get();
+				res.upgrade = [this, data, partition, client, remoteAddr](socket_t sock) {
+					//each message is queued like a connection of the same client
+					auto handler = [this, data, partition, client, remoteAddr](const std::shared_ptr<WebSocketSession>& session, std::string&& message) {
+						auto received = std::chrono::steady_clock::now();
+						auto shared = std::make_shared<std::string>(std::move(message));
+						httplib::Task<ServiceWorker> task;
+						task.run = [this, data, session, shared, received](ServiceWorker& w) {
+							if (!session->isClosed()) {
+								processWebSocketMessage(*this, *data, w, *session, *shared, received);
+							}
+							session->finish();
+						};
+						task.reject = [session, shared](int status, int retryAfter) {
+							uint8_t type = 0;
+							uint32_t id = 0;
+							readWebSocketHeader(*shared, type, id);
+							session->send(getWebSocketHeader(type, id, status), false);
+							session->finish();
+						};
+						if (!client.empty()) {
+							task.peek = [client](httplib::RequestInfo& info) {
+								info.client = client;
+								return true;
+							};
+						}
+						task.remote_addr = remoteAddr;
+						data->pool_->enqueue(*partition, task);
+					};
+					//a seed change can't be sent between the current seed and the new session
+					std::unique_lock<std::mutex> lock(data->statusMutex_);
+					auto session = data->webSockets_.add(sock, handler);
+					if (session && data->initialized_) {
+						session->send(getWebSocketSeed(data->seed_), false);
+					}
+				};
+			})
 			.Post("/hash", [&](ServiceWorker& w, const httplib::Request& req, httplib::Response& res) {
 				allowCors("POST", req, res);
+				recordActivity();
+				if (w.vm_ == nullptr) {
+					serviceUnavailable(*data_, res);
+					return;
+				}
 				if (!data_->initialized_) {
-					res.status = 403;
+					if (isSeedPending(*data_)) {
+						//the first seed is being initialized
+						serviceUnavailable(*data_, res);
+					}
+					else {
+						res.status = 403;
+					}
 					return;
 				}
 				std::vector<char> body;
@@ -353,37 +2547,397 @@ namespace randomx {
 					res.status = 422;
 					return;
 				}
+				if (std::chrono::steady_clock::now() >= getDeadline(req)) {
+					deadlineExpired(w, res);
+					return;
+				}
+				if (!checkQuota(*data_, w, res)) {
+					return;
+				}
 				RandomxHash hash;
-				randomx_calculate_hash(w.vm_, body.data(), body.size(), hash.data());
-				data_->hashes_.fetch_add(1);
+				calculateHash(*data_, w, req, body, hash);
 				outputBody(req, res, hash);
 			})
 			.Post("/batch", [&](ServiceWorker& w, const httplib::Request& req, httplib::Response& res) {
 				allowCors("POST", req, res);
+				recordActivity();
+				if (w.vm_ == nullptr) {
+					serviceUnavailable(*data_, res);
+					return;
+				}
 				if (!data_->initialized_) {
-					res.status = 403;
+					if (isSeedPending(*data_)) {
+						//the first seed is being initialized
+						serviceUnavailable(*data_, res);
+					}
+					else {
+						res.status = 403;
+					}
+					return;
+				}
+				//the inputs are hashed while the body is received, unless the response is streamed
+				//or the body has already been received (HTTP/2)
+				BatchReader reader;
+				if (req.read_body && !req.has_param("stream") && reader.init(req.get_header_value(HEADER_CONTENT))) {
+					if (!checkSeed(req)) {
+						res.status = 422;
+						return;
+					}
+					std::vector<RandomxHash> hashes;
+					if (!calculateIncomingBatch(*data_, w, req, res, reader, data_->maxBatch_, hashes)) {
+						return;
+					}
+					outputBody(req, res, hashes);
 					return;
 				}
-				std::vector<std::vector<char>> batch;
-				if (!readRequestBatch(req, res, batch)) {
+				BatchInputs batch;
+				if (!readRequestBatch(req, res, batch, data_->maxBatch_)) {
 					return;
 				}
 				if (!checkSeed(req)) {
 					res.status = 422;
 					return;
 				}
+				//chunked responses need HTTP/1.1
+				if (req.has_param("stream") && req.version != "HTTP/1.0") {
+					uint64_t hashesPerChunk;
+					if (!parseUint64(req.get_param_value("stream"), hashesPerChunk) || hashesPerChunk == 0) {
+						res.status = 400;
+						return;
+					}
+					if (std::chrono::steady_clock::now() >= getDeadline(req)) {
+						deadlineExpired(w, res);
+						return;
+					}
+					if (!checkQuota(*data_, w, res)) {
+						return;
+					}
+					hashesPerChunk = std::min<uint64_t>(hashesPerChunk, batch.size());
+					streamBatch(*data_, w, req, res, std::move(batch), (size_t)hashesPerChunk);
+					return;
+				}
 				std::vector<RandomxHash> hashes;
-				hashes.resize(batch.size());
-				randomx_calculate_hash_first(w.vm_, batch[0].data(), batch[0].size());
-				for (int i = 1; i < batch.size(); ++i) {
-					randomx_calculate_hash_next(w.vm_, batch[i].data(), batch[i].size(), hashes[i - 1].data());
+				if (!calculateBatch(*data_, w, req, res, batch, hashes)) {
+					return;
 				}
-				randomx_calculate_hash_last(w.vm_, hashes.back().data());
-				data_->hashes_.fetch_add(hashes.size());
 				outputBody(req, res, hashes);
 			})
+			.Post("/verify", [&](ServiceWorker& w, const httplib::Request& req, httplib::Response& res) {
+				allowCors("POST", req, res);
+				recordActivity();
+				if (w.vm_ == nullptr) {
+					serviceUnavailable(*data_, res);
+					return;
+				}
+				if (!data_->initialized_) {
+					if (isSeedPending(*data_)) {
+						//the first seed is being initialized
+						serviceUnavailable(*data_, res);
+					}
+					else {
+						res.status = 403;
+					}
+					return;
+				}
+				//a single input or a batch, depending on the Content-Type
+				BatchInputs batch;
+				auto ct = req.get_header_value(HEADER_CONTENT);
+				if (ct == BINARY_FORMAT || ct == HEX_FORMAT) {
+					std::vector<char> body;
+					if (!readRequestBody(req, res, body)) {
+						return;
+					}
+					batch.add(std::move(body));
+				}
+				else {
+					if (!readRequestBatch(req, res, batch, data_->maxBatch_)) {
+						return;
+					}
+				}
+				uint64_t target = 0;
+				bool difficulty = false;
+				if (!readTarget(req, target, difficulty)) {
+					res.status = 400;
+					return;
+				}
+				if (!checkSeed(req)) {
+					res.status = 422;
+					return;
+				}
+				std::vector<RandomxHash> hashes;
+				if (!calculateBatch(*data_, w, req, res, batch, hashes)) {
+					return;
+				}
+				//JSON with the passing hashes unless the bitmap is requested
+				bool json = getOutputFormat(req, BITMAP_FORMAT);
+				if (!json) {
+					std::string bitmap((hashes.size() + 7) / 8, '\0');
+					for (size_t i = 0; i < hashes.size(); ++i) {
+						if (meetsTarget(hashes[i], target, difficulty)) {
+							bitmap[i / 8] |= 1 << (i % 8);
+						}
+					}
+					res.set_content(bitmap, BITMAP_FORMAT);
+					return;
+				}
+				std::stringstream out;
+				out << "{\n\t\"hashes\": " << hashes.size() << ",\n\t\"hits\": [";
+				bool first = true;
+				for (size_t i = 0; i < hashes.size(); ++i) {
+					if (meetsTarget(hashes[i], target, difficulty)) {
+						out << (first ? "\n" : ",\n") << "\t\t{ \"index\": " << i << ", \"hash\": \"" << bin2hex(hashes[i].data(), hashes[i].size()) << "\" }";
+						first = false;
+					}
+				}
+				out << (first ? "]\n}\n" : "\n\t]\n}\n");
+				res.set_content(out.str(), "application/json");
+			})
+			.Post("/mine", [&](ServiceWorker& w, const httplib::Request& req, httplib::Response& res) {
+				allowCors("POST", req, res);
+				recordActivity();
+				if (w.vm_ == nullptr) {
+					serviceUnavailable(*data_, res);
+					return;
+				}
+				if (!data_->initialized_) {
+					if (isSeedPending(*data_)) {
+						//the first seed is being initialized
+						serviceUnavailable(*data_, res);
+					}
+					else {
+						res.status = 403;
+					}
+					return;
+				}
+				std::vector<char> blob;
+				if (!readRequestBody(req, res, blob)) {
+					return;
+				}
+				uint64_t offset, size, start, count, target = 0;
+				bool difficulty = false;
+				if (!readParam(req, "nonce_offset", offset, 39) || !readParam(req, "nonce_size", size, 4) ||
+					!readParam(req, "start", start, 0) || !readParam(req, "count", count, SERVICE_MAX_BATCH_SIZE) ||
+					size == 0 || size > 8 || offset > blob.size() || size > blob.size() - offset || !readTarget(req, target, difficulty)) {
+					res.status = 400;
+					return;
+				}
+				if (!checkNonceRange(size, start, count)) {
+					res.status = 400;
+					return;
+				}
+				if (count > SERVICE_MAX_MINE_COUNT) {
+					res.status = 413;
+					return;
+				}
+				if (!checkSeed(req)) {
+					res.status = 422;
+					return;
+				}
+				BatchInputs batch;
+				batch.setTemplate(std::move(blob), offset, size, std::string(), start, count);
+				std::stringstream out;
+				bool first = true;
+				size_t done;
+				std::vector<char> buffer;
+				bool ok = calculateHashes(*data_, w, req, res, count,
+					[&](size_t i) -> const std::vector<char>& { return batch.get(i, buffer); },
+					[&](size_t i, const RandomxHash& hash) {
+						if (meetsTarget(hash, target, difficulty)) {
+							out << (first ? "\n" : ",\n") << "\t\t{ \"nonce\": " << batch.nonce(i) << ", \"hash\": \"" << bin2hex(hash.data(), hash.size()) << "\" }";
+							first = false;
+						}
+					}, done);
+				if (!ok) {
+					return;
+				}
+				std::stringstream result;
+				result << "{\n\t\"hashes\": " << done << ",\n\t\"hits\": [" << out.str() << (first ? "]\n}\n" : "\n\t]\n}\n");
+				res.set_content(result.str(), "application/json");
+			})
+			.Post("/jobs", [&](ServiceWorker& w, const httplib::Request& req, httplib::Response& res) {
+				allowCors("POST", req, res);
+				if (!data_->initialized_ || isSeedPending(*data_)) {
+					if (isSeedPending(*data_)) {
+						serviceUnavailable(*data_, res);
+					}
+					else {
+						res.status = 403;
+					}
+					return;
+				}
+				BatchInputs batch;
+				if (!readRequestBatch(req, res, batch, data_->maxJob_)) {
+					return;
+				}
+				if (!checkSeed(req)) {
+					res.status = 422;
+					return;
+				}
+				auto priority = req.has_param("priority") ? req.get_param_value("priority") : "low";
+				if (priority != "low" && priority != "normal") {
+					res.status = 400;
+					return;
+				}
+				std::string seed;
+				{
+					std::unique_lock<std::mutex> lock(data_->statusMutex_);
+					seed = data_->seedHex_;
+				}
+				std::shared_ptr<BulkJob> job;
+				{
+					std::unique_lock<std::mutex> lock(data_->jobsMutex_);
+					expireJobs(*data_);
+					if (data_->jobs_.size() >= SERVICE_MAX_JOBS) {
+						res.status = 503;
+						return;
+					}
+					//the id is the only credential needed to read or cancel a job
+					std::string id;
+					do {
+						uint64_t random[2] = { data_->jobIds_(), data_->jobIds_() };
+						id = bin2hex((const char*)random, sizeof(random));
+					} while (data_->jobs_.count(id) != 0);
+					job = std::make_shared<BulkJob>(id, std::move(batch), seed, priority == "low");
+					data_->jobs_[id] = job;
+				}
+				//one chain of chunks per worker
+				size_t chains = (job->size() + BulkJob::ChunkSize - 1) / BulkJob::ChunkSize;
+				for (size_t i = 0; i < data_->partitions_.size() && chains > 0; ++i) {
+					auto& partition = data_->pool_->getPartition(i);
+					for (int j = 0; j < data_->partitions_[i].threads && chains > 0; ++j, --chains) {
+						scheduleJob(*this, *data_, job, partition, job->isLowPriority());
+					}
+				}
+				res.status = 202;
+				res.set_header("Location", "/jobs/" + job->getId());
+				outputJobStatus(*job, res);
+			})
+			.Get(R"(/jobs/([0-9a-f]+))", [&](ServiceWorker& w, const httplib::Request& req, httplib::Response& res) {
+				allowCors("GET", req, res);
+				auto job = findJob(*data_, req.matches[1]);
+				if (!job) {
+					res.status = 404;
+					return;
+				}
+				outputJobStatus(*job, res);
+			})
+			.Get(R"(/jobs/([0-9a-f]+)/results)", [&](ServiceWorker& w, const httplib::Request& req, httplib::Response& res) {
+				allowCors("GET", req, res);
+				auto job = findJob(*data_, req.matches[1]);
+				if (!job) {
+					res.status = 404;
+					return;
+				}
+				std::string contentType;
+				size_t recordSize = getHashFormat(req, contentType);
+				if (req.has_param("offset") || req.has_param("count")) {
+					//a page with the hashes that have been calculated so far
+					uint64_t offset, count;
+					if (!readParam(req, "offset", offset, 0) || !readParam(req, "count", count, SERVICE_JOB_PAGE_SIZE)) {
+						res.status = 400;
+						return;
+					}
+					count = std::min<uint64_t>(count, SERVICE_MAX_JOB_PAGE_SIZE);
+					offset = std::min<uint64_t>(offset, job->size());
+					std::string body;
+					appendJobResults(*job, offset, offset + job->getAvailable(offset, count), recordSize, body);
+					res.set_content(body, contentType.c_str());
+					return;
+				}
+				//the whole result is streamed from memory without copying it
+				if (job->getStatus().state != JobState::Done) {
+					res.status = 409;
+					return;
+				}
+				res.set_header(HEADER_CONTENT, contentType);
+				res.set_content_provider(job->size() * recordSize, [job, recordSize](size_t offset, size_t length, httplib::DataSink sink) {
+					size_t begin = offset / recordSize;
+					size_t end = std::min(begin + SERVICE_JOB_PAGE_SIZE, job->size());
+					std::string chunk;
+					appendJobResults(*job, begin, end, recordSize, chunk);
+					sink(chunk.data(), chunk.size());
+				});
+			})
+			.Delete(R"(/jobs/([0-9a-f]+))", [&](ServiceWorker& w, const httplib::Request& req, httplib::Response& res) {
+				allowCors("DELETE", req, res);
+				std::unique_lock<std::mutex> lock(data_->jobsMutex_);
+				auto it = data_->jobs_.find(req.matches[1]);
+				if (it == data_->jobs_.end()) {
+					res.status = 404;
+					return;
+				}
+				//chunks that are being calculated keep the job alive until they are finished
+				it->second->cancel();
+				data_->jobs_.erase(it);
+				res.status = 204;
+			})
+			.Post("/autotune", [&](ServiceWorker& w, const httplib::Request& req, httplib::Response& res) {
+				if (!data_->autotuneEnabled_) {
+					res.status = 404;
+					return;
+				}
+				if (w.vm_ == nullptr) {
+					serviceUnavailable(*data_, res);
+					return;
+				}
+				if (!data_->initialized_) {
+					if (isSeedPending(*data_)) {
+						serviceUnavailable(*data_, res);
+					}
+					else {
+						res.status = 403;
+					}
+					return;
+				}
+				auto objective = data_->tuneObjective_;
+				if (req.has_param("objective") && !parseTuneObjective(req.get_param_value("objective"), objective)) {
+					res.status = 400;
+					return;
+				}
+				std::vector<TuneResult> results;
+				TuneResult best;
+				if (!autotune(&w, objective, results, best)) {
+					res.status = 500;
+					return;
+				}
+				std::stringstream out;
+				out << "{\n";
+				out << "\t\"objective\": \"" << getTuneObjectiveName(objective) << "\",\n";
+				out << "\t\"threads\": " << best.threads << ",\n";
+				out << "\t\"flags\": " << best.flags << ",\n";
+				out << "\t\"results\": [\n";
+				for (size_t i = 0; i < results.size(); ++i) {
+					auto& result = results[i];
+					out << "\t\t{ \"threads\": " << result.threads << ", \"flags\": " << result.flags;
+					out << ", \"hashrate\": " << result.hashrate << ", \"latency_us\": " << result.latency << " }";
+					out << (i + 1 < results.size() ? ",\n" : "\n");
+				}
+				out << "\t]\n";
+				out << "}\n";
+				//this worker may no longer be one of the active workers
+				res.set_header("Connection", "close");
+				res.set_content(out.str(), "application/json");
+			})
+			.Post("/upgrade", [&](ServiceWorker& w, const httplib::Request& req, httplib::Response& res) {
+				if (!data_->upgradeEnabled_) {
+					res.status = 404;
+					return;
+				}
+				res.status = upgrade() ? 204 : 500;
+			})
 			.Options("/seed", options)
 			.Options("/hash", options)
-			.Options("/batch", options);
+			.Options("/batch", options)
+			.Options("/verify", options)
+			.Options("/mine", options)
+			.Options("/jobs", options)
+			.Options(R"(/jobs/([0-9a-f]+))", [&](ServiceWorker& w, const httplib::Request& req, httplib::Response& res) {
+				if (!allowCors("GET, DELETE", req, res)) {
+					res.status = 403;
+				}
+				else {
+					res.status = 204;
+				}
+			});
 	}
 }
@@ -29,9 +29,20 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #pragma once
 
 #include <string>
+#include <vector>
 #include <memory>
+#include <cstdint>
+#include "dataset_memory.h"
+#include "autotune.h"
+#include "partition.h"
+#include "client_queue.h"
 
 #define RANDOMX_SERVICE_VERSION "1.0.2"
+#define SERVICE_ALGORITHM "rx/0"
+#define SERVICE_MAX_BATCH_SIZE (256u)
+#define SERVICE_MAX_PAYLOAD (20000u)
+#define SERVICE_MAX_JOB_SIZE (1048576u)
+#define SERVICE_MAX_JOB_PAYLOAD (67108864u)
 
 namespace httplib {
 	struct Request;
@@ -45,19 +56,61 @@ namespace randomx {
 	struct ServiceWorker;
 	struct ServicePrivate;
 
+	//options that must be known before the cache and dataset are allocated
+	struct MemoryOptions {
+		std::string sharedDatasetDir;
+		PageStrategy pages = PageStrategy::Huge1G;
+		bool lock = false;
+		//the socket used to receive the state of the process that is being upgraded
+		int upgradeFd = -1;
+	};
+
 	class Service {
 	public:
-		Service(size_t, int);
+		//without partitions, all threads are in one partition
+		Service(size_t, int, const MemoryOptions& memory = MemoryOptions(), const std::vector<PartitionOptions>& partitions = std::vector<PartitionOptions>());
 		~Service();
 		bool run(const char* hostname, int port);
-		randomx_vm* createMachine() const;
+		bool bind(const char* hostname, int port);
+		bool run();
+		randomx_vm* createMachine(bool light = false) const;
 		void destroyMachine(randomx_vm* machine) const;
-		void refreshMachine(randomx_vm* machine) const;
+		void refreshMachine(randomx_vm* machine, bool light = false) const;
+		void setSeed(const void* seed, size_t seedSize);
 		void reinitCache(const void* seed, size_t seedSize);
-		void reinitDataset();
+		void reinitDataset(ServiceWorker* self);
+		void reinit(ServiceWorker* self, const void* seed, size_t seedSize);
+		void buildDataset(ServiceWorker* self, const void* seed, size_t seedSize);
+		void reseed(const void* seed, size_t seedSize);
+		void reseed(ServiceWorker* self, const std::string& seed, uint64_t epoch);
+		uint64_t reseedAsync(const std::string& seed);
+		bool isReady();
+		uint64_t newEpoch();
+		bool loadDataset(const void* seed, size_t seedSize);
+		void saveDataset();
 		bool checkSeed(const httplib::Request& req);
 		void setOrigin(const std::string& origin);
+		void setDatasetDir(const std::string& dir);
+		void pinThreads();
 		void enableLog();
+		void enableH2c();
+		void enableUpgrade(const std::vector<std::string>& args);
+		bool upgrade();
+		bool resumeUpgrade();
+		void enableAutotune(TuneObjective objective, const std::string& file);
+		bool loadTuning();
+		bool autotune(ServiceWorker* self, TuneObjective objective, std::vector<TuneResult>& results, TuneResult& best);
+		void enableIdleRelease(int minutes, bool sleep);
+		void setQueueLimit(size_t limit, bool dropOldest);
+		void setSpinTime(unsigned microseconds);
+		//limits of the /batch and /verify requests
+		void setBatchLimits(size_t maxBatch, size_t maxPayload);
+		//limits of the requests that submit bulk jobs
+		void setJobLimits(size_t maxJob, size_t maxPayload);
+		void enableHashCache(size_t entries);
+		void setClientLimits(const ClientLimits& limits);
+		void recordActivity();
+		void restoreMemory();
 		bool allowCors(const char* method, const httplib::Request& req, httplib::Response& res);
 		static int getAutoFlags();
 		static int getMachineThreads();
@@ -33,28 +33,120 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <iostream>
 #include <climits>
 #include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <map>
+#include <random>
 #include "../RandomX/src/randomx.h"
 #include "httplib.h"
 #include "thread_pool.h"
+#include "dataset_file.h"
+#include "shared_dataset.h"
+#include "upgrade.h"
+#include "resource_limits.h"
+#include "bulk_job.h"
+#include "hash_cache.h"
+#include "websocket.h"
+#include "http2.h"
 
 namespace randomx {
 
 	class Service;
 	class ServiceWorker;
 
+	enum class ReseedPhase {
+		Idle,
+		Waiting,
+		Loading,
+		Cache,
+		Dataset,
+		Attaching
+	};
+
+	//memory state after a period without hash requests
+	enum class IdleState {
+		Active,
+		Light,
+		Asleep
+	};
+
 	struct ServicePrivate {
 		static const int AutoFlags = INT_MAX;
-		ServicePrivate(Service& svc, int threads, int flags)
+		ServicePrivate(Service& svc, int threads, int flags, const MemoryOptions& memory)
 			:
-			server_([&svc, threads] { return new ThreadPool(svc, threads); }),
+			server_([this] { return pool_.get(); }),
 			cache_(nullptr),
 			dataset_(nullptr),
 			threads_(threads),
-			initialized_(false)
+			maxThreads_(threads),
+			initialized_(false),
+			hashes_(0),
+			cacheTime_(0),
+			datasetTime_(0),
+			datasetLoaded_(false),
+			datasetShared_(false),
+			inheritedDataset_(false),
+			inheritedMapping_(false),
+			upgradeFd_(memory.upgradeFd),
+			upgradeEnabled_(false),
+			upgraded_(false),
+			pages_(memory.pages),
+			datasetPages_(nullptr),
+			lockMemory_(memory.lock),
+			memoryLocked_(false),
+			tuneObjective_(TuneObjective::Hashrate),
+			autotuneEnabled_(false),
+			tuning_(false),
+			lightMachines_(false),
+			queueLimit_(0),
+			dropOldest_(false),
+			spinTime_(0),
+			maxBatch_(SERVICE_MAX_BATCH_SIZE),
+			maxJob_(SERVICE_MAX_JOB_SIZE),
+			idleTimeout_(0),
+			idleSleep_(false),
+			idleState_(IdleState::Active),
+			idleFullMem_(false),
+			idleStop_(false),
+			waking_(false),
+			lastActivity_(std::chrono::steady_clock::now().time_since_epoch().count()),
+			epoch_(0),
+			lastEpoch_(0),
+			pendingEpoch_(0),
+			wakePending_(false),
+			reseedStop_(false),
+			phase_(ReseedPhase::Idle),
+			datasetItemsDone_(0),
+			watchers_(0)
 		{
+			std::random_device device;
+			std::seed_seq jobSeed = { device(), device(), device(), device(), device(), device(), device(), device() };
+			jobIds_.seed(jobSeed);
 			bool autoFlags = flags == AutoFlags;
 			if (autoFlags) {
-				flags = randomx_get_flags() | RANDOMX_FLAG_FULL_MEM | RANDOMX_FLAG_LARGE_PAGES;
+				flags = randomx_get_flags() | RANDOMX_FLAG_FULL_MEM;
+				if (memory.pages != PageStrategy::Small) {
+					flags |= RANDOMX_FLAG_LARGE_PAGES;
+				}
+				auto limits = getResourceLimits();
+				auto required = getRequiredMemory(true, threads);
+				if (limits.memory > 0) {
+					std::cout << "Memory limit: " << (limits.memory >> 20) << " MiB (";
+					if (limits.memoryCgroup > 0) {
+						std::cout << "cgroup v" << limits.memoryCgroup;
+					}
+					else {
+						std::cout << "physical memory";
+					}
+					std::cout << "), full memory mode needs " << (required >> 20) << " MiB" << std::endl;
+					if (limits.memory < required) {
+						std::cout << "Using light mode because the dataset does not fit in the memory limit" << std::endl;
+						flags &= ~RANDOMX_FLAG_FULL_MEM;
+					}
+				}
 			}
 			cache_ = randomx_alloc_cache((randomx_flags)flags);
 			if (autoFlags && cache_ == nullptr) {
@@ -65,31 +157,80 @@ namespace randomx {
 			if (cache_ == nullptr) {
 				throw std::runtime_error("randomx_alloc_cache failed");
 			}
-			if (flags & RANDOMX_FLAG_FULL_MEM) {
-				dataset_ = randomx_alloc_dataset((randomx_flags)flags);
+			if (upgradeFd_ >= 0 && !receiveUpgradeState(upgradeFd_, inherited_)) {
+				throw std::runtime_error("Failed to receive the state of the upgraded process");
+			}
+			if ((flags & RANDOMX_FLAG_FULL_MEM) && !memory.sharedDatasetDir.empty()) {
+				//the dataset memory is mapped when the seed is set
+				sharedDataset_.reset(new SharedDataset(memory.sharedDatasetDir));
+				dataset_ = sharedDataset_->getDataset();
+				datasetPages_ = "shared";
+			}
+			else if ((flags & RANDOMX_FLAG_FULL_MEM) && inherited_.datasetFd >= 0 && (dataset_ = mapDataset(inherited_.datasetFd)) != nullptr) {
+				inheritedDataset_ = true;
+				inheritedMapping_ = true;
+				datasetPages_ = "inherited";
+			}
+			else if (flags & RANDOMX_FLAG_FULL_MEM) {
+				dataset_ = allocDataset(pages_, (randomx_flags)flags);
 				if (dataset_ == nullptr) {
 					if (autoFlags) {
-						std::cout << "RANDOMX_FLAG_LARGE_PAGES was not successful (randomx_dataset)" << std::endl;
-						flags &= ~RANDOMX_FLAG_LARGE_PAGES;
-						dataset_ = randomx_alloc_dataset((randomx_flags)flags);
-						if (dataset_ == nullptr) {
-							std::cout << "RANDOMX_FLAG_FULL_MEM was not successful" << std::endl;
-							flags &= ~RANDOMX_FLAG_FULL_MEM;
-						}
+						std::cout << "RANDOMX_FLAG_FULL_MEM was not successful" << std::endl;
+						flags &= ~RANDOMX_FLAG_FULL_MEM;
 					}
 					else {
 						throw std::runtime_error("randomx_alloc_dataset failed");
 					}
 				}
+				else {
+					if (pages_ != memory.pages) {
+						std::cout << "Dataset pages " << getPageStrategyName(memory.pages) << " were not successful" << std::endl;
+					}
+					std::cout << "Dataset pages: " << getPageStrategyName(pages_) << std::endl;
+					datasetPages_ = getPageStrategyName(pages_);
+				}
+			}
+			if (inherited_.datasetFd >= 0) {
+				closeDescriptor(inherited_.datasetFd);
+				inherited_.datasetFd = -1;
+			}
+			if (!sharedDataset_ && !memory.sharedDatasetDir.empty()) {
+				std::cout << "The shared dataset is only used with RANDOMX_FLAG_FULL_MEM" << std::endl;
 			}
 			flags_ = (randomx_flags)flags;
 		}
 
 		~ServicePrivate() {
+			//the sessions must not enqueue requests once the pool is gone
+			webSockets_.stop();
+			http2_.stop();
+			{
+				std::unique_lock<std::mutex> lock(statusMutex_);
+				idleStop_ = true;
+			}
+			idleCond_.notify_all();
+			if (idleThread_.joinable()) {
+				idleThread_.join();
+			}
+			{
+				std::unique_lock<std::mutex> lock(statusMutex_);
+				reseedStop_ = true;
+			}
+			reseedCond_.notify_all();
+			if (reseedThread_.joinable()) {
+				reseedThread_.join();
+			}
+			if (saveThread_.joinable()) {
+				saveThread_.join();
+			}
+			pool_.reset();
 			if (cache_ != nullptr) {
 				randomx_release_cache(cache_);
 			}
-			if (dataset_ != nullptr) {
+			if (sharedDataset_) {
+				sharedDataset_.reset();
+			}
+			else if (dataset_ != nullptr) {
 				randomx_release_dataset(dataset_);
 			}
 		}
@@ -97,12 +238,85 @@ namespace randomx {
 		randomx_dataset* dataset_;
 		randomx_cache* cache_;
 		httplib::Server<ServiceWorker> server_;
+		std::unique_ptr<ThreadPool> pool_;
 		randomx_flags flags_;
-		size_t threads_;
+		//the number of workers that process requests; autotuning may use fewer than maxThreads_
+		std::atomic<size_t> threads_;
+		size_t maxThreads_;
+		std::string seed_;
 		std::string seedHex_;
 		std::string origin_;
 		bool initialized_;
 		std::atomic<uint64_t> hashes_;
+		std::unique_ptr<DatasetFile> datasetFile_;
+		std::thread saveThread_;
+		uint64_t cacheTime_;
+		uint64_t datasetTime_;
+		bool datasetLoaded_;
+		bool datasetShared_;
+		std::unique_ptr<SharedDataset> sharedDataset_;
+		UpgradeState inherited_;
+		bool inheritedDataset_;
+		bool inheritedMapping_;
+		int upgradeFd_;
+		std::vector<std::string> upgradeArgs_;
+		bool upgradeEnabled_;
+		std::atomic<bool> upgraded_;
+		std::mutex upgradeMutex_;
+		PageStrategy pages_;
+		const char* datasetPages_;
+		bool lockMemory_;
+		bool memoryLocked_;
+		TuneObjective tuneObjective_;
+		//POST /autotune stops hashing and rewrites the tune file, so it's only enabled by -autotune
+		bool autotuneEnabled_;
+		std::string tuneFile_;
+		std::atomic<bool> tuning_;
+		std::vector<PartitionOptions> partitions_;
+		//servers of the partitions after the first one, which uses server_
+		std::vector<std::unique_ptr<httplib::Server<ServiceWorker>>> partitionServers_;
+		bool lightMachines_;
+		//the seed the cache was initialized with; empty if it's not initialized
+		std::string cacheSeed_;
+		size_t queueLimit_;
+		bool dropOldest_;
+		unsigned spinTime_;
+		size_t maxBatch_;
+		size_t maxJob_;
+		//bulk jobs by their random ids
+		std::mutex jobsMutex_;
+		std::map<std::string, std::shared_ptr<BulkJob>> jobs_;
+		std::mt19937_64 jobIds_;
+		//recent hashes; null unless enabled with -cache
+		std::unique_ptr<HashCache> hashCache_;
+		//sessions upgraded on /ws
+		WebSocketHub webSockets_;
+		Http2Hub http2_;
+		ClientLimits clientLimits_;
+		int idleTimeout_;
+		bool idleSleep_;
+		IdleState idleState_;
+		bool idleFullMem_;
+		bool idleStop_;
+		bool waking_;
+		std::atomic<std::chrono::steady_clock::rep> lastActivity_;
+		std::thread idleThread_;
+		std::condition_variable idleCond_;
+		std::mutex statusMutex_;
+		std::condition_variable epochCond_;
+		uint64_t epoch_;
+		uint64_t lastEpoch_;
+		//asynchronous reseeds run on their own thread, so they don't occupy a worker
+		std::thread reseedThread_;
+		std::condition_variable reseedCond_;
+		std::string pendingSeed_;
+		uint64_t pendingEpoch_;
+		bool wakePending_;
+		bool reseedStop_;
+		ReseedPhase phase_;
+		std::chrono::steady_clock::time_point phaseStart_;
+		std::atomic<uint64_t> datasetItemsDone_;
+		size_t watchers_;
 	};
 
 }
\ No newline at end of file
@@ -29,19 +29,40 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "service_worker.h"
 #include "thread_pool.h"
 #include "service.h"
+#include <algorithm>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define cpuRelax() _mm_pause()
+#elif defined(__aarch64__)
+#define cpuRelax() asm volatile("yield")
+#else
+#define cpuRelax()
+#endif
 
 namespace randomx {
 
-	ServiceWorker::ServiceWorker(ThreadPool& pool, unsigned id) :
+	ServiceWorker::ServiceWorker(ThreadPool& pool, unsigned id, WorkerPartition* partition) :
 		pool_(pool), 
-		vm_(pool.getService().createMachine()),
+		vm_(partition == nullptr ? nullptr : pool.getService().createMachine(partition->light_)),
+		partition_(partition),
+		control_(partition == nullptr),
 		idle_(true),
-		id_(id)
+		id_(id),
+		node_(-1),
+		taskGeneration_(0),
+		client_(nullptr),
+		clientQueue_(nullptr),
+		signaled_(false),
+		parked_(false),
+		standby_(false)
 	{
 	}
 
 	ServiceWorker::~ServiceWorker() {
-		pool_.getService().destroyMachine(vm_);
+		if (vm_ != nullptr) {
+			pool_.getService().destroyMachine(vm_);
+		}
 	}
 
 	void ServiceWorker::operator()() {
@@ -52,18 +73,100 @@ namespace randomx {
 				cond_.notify_one();
 			}
 			std::function<void(ServiceWorker&)> fn;
-			{
+			bool busy = false;
+			if (control_) {
 				std::unique_lock<std::mutex> lock(pool_.mutex_);
-				pool_.cond_.wait(
-					lock, [&] { return (!pool_.reseeding_ && !pool_.jobs_.empty()) || pool_.shutdown_; });
+				WorkerPartition* partition = nullptr;
+				//requests from all partitions are served while reseeding
+				pool_.controlCond_.wait(
+					lock, [&] {
+						for (auto& p : pool_.partitions_) {
+							if (p->queue_.size() > 0) {
+								partition = p.get();
+								break;
+							}
+						}
+						return (pool_.reseeding_ && partition != nullptr) || pool_.shutdown_;
+					});
+
+				if (pool_.shutdown_) { break; }
+
+				fn = pool_.takeJob(*partition, *this);
+			}
+			else {
+				std::unique_lock<std::mutex> lock(pool_.mutex_);
+				//inactive workers wait separately, so they are not woken up for new requests
+				pool_.inactiveCond_.wait(
+					lock, [&] { return id_ < pool_.activeWorkers_ || pool_.shutdown_ || pool_.taskGeneration_ != taskGeneration_; });
+				waitForWork(lock);
+
+				if (pool_.taskGeneration_ != taskGeneration_) {
+					taskGeneration_ = pool_.taskGeneration_;
+					if (!pool_.task_) {
+						continue;
+					}
+					//the pool clears task_ before the other workers are done
+					auto task = pool_.task_;
+					fn = [task](ServiceWorker& w) {
+						task(&w);
+						std::unique_lock<std::mutex> lock(w.pool_.mutex_);
+						w.pool_.taskActive_--;
+						w.pool_.taskCond_.notify_all();
+					};
+					pool_.taskActive_++;
+				}
+				else if (id_ >= pool_.activeWorkers_ && !pool_.shutdown_) {
+					continue;
+				}
+				else {
+					if (pool_.shutdown_ && partition_->queue_.size() == 0) { break; }
 
-				if (pool_.shutdown_ && pool_.jobs_.empty()) { break; }
+					fn = pool_.takeJob(*partition_, *this);
+					idle_ = false;
+					busy = true;
+					partition_->busy_++;
+				}
+			}
+			if (fn) {
+				fn(*this);
+			}
+			if (client_ != nullptr) {
+				pool_.finishJob(*this);
+			}
+			if (busy) {
+				partition_->busy_--;
+			}
+		}
+	}
 
-				fn = pool_.jobs_.front();
-				pool_.jobs_.pop_front();
-				idle_ = false;
+	//An idle worker is registered with its partition, which hands the next connection directly
+	//to it. The worker spins for the configured time before it sleeps, so a request on a quiet
+	//service doesn't have to wait until the scheduler runs the worker again.
+	void ServiceWorker::waitForWork(std::unique_lock<std::mutex>& lock) {
+		auto ready = [&] { return (!pool_.reseeding_ && (partition_->queue_.size() > 0 || !partition_->background_.empty())) || pool_.shutdown_ || pool_.taskGeneration_ != taskGeneration_ || id_ >= pool_.activeWorkers_; };
+		while (!ready()) {
+			signaled_.store(false, std::memory_order_relaxed);
+			partition_->idle_.push_back(this);
+			auto spinTime = pool_.spinTime_.load();
+			if (spinTime > 0) {
+				lock.unlock();
+				auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(spinTime);
+				for (unsigned i = 1; !signaled_.load(std::memory_order_acquire); ++i) {
+					cpuRelax();
+					if (i % 64 == 0 && std::chrono::steady_clock::now() >= until) {
+						break;
+					}
+				}
+				lock.lock();
+			}
+			parked_ = true;
+			wakeCond_.wait(
+				lock, [&] { return signaled_.load(std::memory_order_relaxed) || ready(); });
+			parked_ = false;
+			auto idle = std::find(partition_->idle_.begin(), partition_->idle_.end(), this);
+			if (idle != partition_->idle_.end()) {
+				partition_->idle_.erase(idle);
 			}
-			fn(*this);
 		}
 	}
 
@@ -30,15 +30,21 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <cstdint>
 
 struct randomx_vm;
 
 namespace randomx {
 
 	class ThreadPool;
+	class ClientQueue;
+	struct WorkerPartition;
+	struct ClientState;
 
 	struct ServiceWorker {
-		ServiceWorker(ThreadPool& pool, unsigned id);
+		//the control worker has no partition and no VM; it only serves requests while the pool is reseeding
+		ServiceWorker(ThreadPool& pool, unsigned id, WorkerPartition* partition);
 		~ServiceWorker();
 
 		ServiceWorker(const ServiceWorker&) = delete;
@@ -51,10 +57,27 @@ namespace randomx {
 
 		randomx_vm* vm_;
 		ThreadPool& pool_;
+		WorkerPartition* partition_;
+		bool control_;
 		bool idle_;
 		std::condition_variable cond_;
 		std::mutex mutex_;
 		unsigned id_;
+		int node_;
+		uint64_t taskGeneration_;
+		//the client of the connection that is being processed
+		ClientState* client_;
+		ClientQueue* clientQueue_;
+		//set when the worker should check the state of the pool again
+		std::atomic<bool> signaled_;
+		//the worker sleeps on wakeCond_ (guarded by the pool mutex)
+		bool parked_;
+		std::condition_variable wakeCond_;
+		//parked by a request handler with ThreadPool::park (guarded by the pool mutex)
+		bool standby_;
+
+	private:
+		void waitForWork(std::unique_lock<std::mutex>& lock);
 	};
 
 }
\ No newline at end of file
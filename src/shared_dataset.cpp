@@ -0,0 +1,248 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shared_dataset.h"
+#include "dataset_file.h"
+#include "service.h"
+#include "hex.h"
+#include "../RandomX/src/randomx.h"
+#include "dataset_wrapper.h"
+#include <cstring>
+#include <stdexcept>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace randomx {
+
+	static const char sharedDatasetMagic[8] = { 'R', 'X', 'S', 'H', 'A', 'R', 'E', 'D' };
+	static const uint32_t sharedDatasetVersion = 1;
+
+	enum SharedDatasetState : uint32_t {
+		SharedDatasetBuilding = 0,
+		SharedDatasetReady = 1
+	};
+
+	struct SharedDatasetHeader {
+		char magic[8];
+		uint32_t formatVersion;
+		uint32_t state;
+		uint64_t itemCount;
+		char algorithm[8];
+		uint32_t seedSize;
+		char seed[60];
+	};
+
+#ifndef _WIN32
+	SharedDataset::SharedDataset(const std::string& dir) :
+		dir_(dir),
+		dataset_(wrapDataset(nullptr, nullptr)),
+		fd_(-1),
+		mapping_(nullptr),
+		mappingSize_(0)
+	{
+		struct stat st;
+		if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+			freeDatasetWrapper(dataset_);
+			throw std::runtime_error("Shared dataset directory " + dir + " doesn't exist");
+		}
+	}
+
+	SharedDataset::~SharedDataset() {
+		detach();
+		freeDatasetWrapper(dataset_);
+	}
+
+	static bool isSameFile(int fd, const std::string& path) {
+		struct stat a, b;
+		return fstat(fd, &a) == 0 && stat(path.c_str(), &b) == 0 && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+	}
+
+	int SharedDataset::openFile(const std::string& path, int lock) {
+		for (;;) {
+			int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+			if (fd < 0) {
+				throw std::runtime_error("Cannot open " + path + ": " + strerror(errno));
+			}
+			if (flock(fd, lock) != 0) {
+				close(fd);
+				throw std::runtime_error("Cannot lock " + path + ": " + strerror(errno));
+			}
+			//the file may have been deleted by its last user while we were waiting for the lock
+			if (isSameFile(fd, path)) {
+				return fd;
+			}
+			close(fd);
+		}
+	}
+
+	void SharedDataset::map(bool writable) {
+		int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+		mapping_ = mmap(nullptr, mappingSize_, prot, MAP_SHARED, fd_, 0);
+		if (mapping_ == MAP_FAILED) {
+			mapping_ = nullptr;
+			throw std::runtime_error("Cannot map " + path_ + ": " + strerror(errno));
+		}
+		setDatasetMemory(dataset_, (uint8_t*)mapping_ + DatasetFileAlignment);
+	}
+
+	bool SharedDataset::attach(const void* seed, size_t seedSize, std::function<void()> build) {
+		detach();
+		SharedDatasetHeader header;
+		if (seedSize > sizeof(header.seed)) {
+			throw std::runtime_error("Seed is too long");
+		}
+		path_ = dir_ + "/randomx-shared-" + bin2hex((const char*)seed, seedSize);
+		//the files must have a size that is a multiple of the page size on hugetlbfs
+		struct statvfs fs;
+		uint64_t pageSize = statvfs(dir_.c_str(), &fs) == 0 && fs.f_bsize > 0 ? fs.f_bsize : 4096;
+		uint64_t size = DatasetFileAlignment + (uint64_t)randomx_dataset_item_count() * RANDOMX_DATASET_ITEM_SIZE;
+		mappingSize_ = (size_t)((size + pageSize - 1) / pageSize * pageSize);
+
+		fd_ = openFile(path_, LOCK_SH);
+		try {
+			if (checkReady(seed, seedSize)) {
+				return true;
+			}
+			flock(fd_, LOCK_UN);
+			close(fd_);
+			fd_ = -1;
+			//only one process in the directory builds a dataset at a time
+			int buildFd = openFile(dir_ + "/randomx-shared.lock", LOCK_EX);
+			struct BuildLock {
+				int fd;
+				~BuildLock() {
+					close(fd);
+				}
+			} buildLock{ buildFd };
+			//the dataset may have been built while we were waiting
+			fd_ = openFile(path_, LOCK_SH);
+			if (checkReady(seed, seedSize)) {
+				return true;
+			}
+			//other processes only hold a shared lock briefly while checking the file
+			flock(fd_, LOCK_EX);
+			if (ftruncate(fd_, 0) != 0 || ftruncate(fd_, mappingSize_) != 0) {
+				throw std::runtime_error("Cannot resize " + path_ + ": " + strerror(errno));
+			}
+#ifdef __linux__
+			//allocate the memory now rather than getting SIGBUS when it runs out during the build
+			if (fallocate(fd_, 0, 0, mappingSize_) != 0 && errno != EOPNOTSUPP) {
+				throw std::runtime_error("Cannot allocate " + path_ + ": " + strerror(errno));
+			}
+#endif
+			map(true);
+			memset(&header, 0, sizeof(header));
+			memcpy(header.magic, sharedDatasetMagic, sizeof(header.magic));
+			header.formatVersion = sharedDatasetVersion;
+			header.state = SharedDatasetBuilding;
+			header.itemCount = randomx_dataset_item_count();
+			strncpy(header.algorithm, SERVICE_ALGORITHM, sizeof(header.algorithm));
+			header.seedSize = (uint32_t)seedSize;
+			memcpy(header.seed, seed, seedSize);
+			memcpy(mapping_, &header, sizeof(header));
+			build();
+			((SharedDatasetHeader*)mapping_)->state = SharedDatasetReady;
+			//processes waiting for the lock can map the dataset now
+			flock(fd_, LOCK_SH);
+			return false;
+		}
+		catch (...) {
+			detach();
+			throw;
+		}
+	}
+
+	//maps the file read-only if it contains a complete dataset for the seed
+	bool SharedDataset::checkReady(const void* seed, size_t seedSize) {
+		struct stat st;
+		if (fstat(fd_, &st) != 0 || (uint64_t)st.st_size != mappingSize_) {
+			return false;
+		}
+		map(false);
+		SharedDatasetHeader header;
+		memcpy(&header, mapping_, sizeof(header));
+		if (memcmp(header.magic, sharedDatasetMagic, sizeof(header.magic)) == 0
+			&& header.formatVersion == sharedDatasetVersion
+			&& header.state == SharedDatasetReady
+			&& header.itemCount == randomx_dataset_item_count()
+			&& strncmp(header.algorithm, SERVICE_ALGORITHM, sizeof(header.algorithm)) == 0
+			&& header.seedSize == seedSize && memcmp(header.seed, seed, seedSize) == 0) {
+			return true;
+		}
+		munmap(mapping_, mappingSize_);
+		mapping_ = nullptr;
+		setDatasetMemory(dataset_, nullptr);
+		return false;
+	}
+
+	void SharedDataset::detach() {
+		if (mapping_ != nullptr) {
+			munmap(mapping_, mappingSize_);
+			mapping_ = nullptr;
+			setDatasetMemory(dataset_, nullptr);
+		}
+		if (fd_ >= 0) {
+			flock(fd_, LOCK_UN);
+			//delete the file if no other process is using it
+			if (flock(fd_, LOCK_EX | LOCK_NB) == 0) {
+				if (isSameFile(fd_, path_)) {
+					unlink(path_.c_str());
+				}
+				flock(fd_, LOCK_UN);
+			}
+			close(fd_);
+			fd_ = -1;
+		}
+	}
+#else
+	SharedDataset::SharedDataset(const std::string& dir) {
+		throw std::runtime_error("Shared datasets are not supported on this platform");
+	}
+
+	SharedDataset::~SharedDataset() {
+	}
+
+	bool SharedDataset::attach(const void* seed, size_t seedSize, std::function<void()> build) {
+		return false;
+	}
+
+	bool SharedDataset::checkReady(const void* seed, size_t seedSize) {
+		return false;
+	}
+
+	void SharedDataset::detach() {
+	}
+#endif
+}
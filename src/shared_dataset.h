@@ -0,0 +1,77 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <functional>
+
+struct randomx_dataset;
+
+namespace randomx {
+
+	//A dataset that is shared by all service processes using the same directory
+	//(a hugetlbfs mount or /dev/shm). There is one file per seed. The first process
+	//that needs a seed builds the dataset, the others wait and map it read-only.
+	//Processes hold a shared lock on the file while they use it; the builder holds
+	//an exclusive lock until the dataset is ready. The last user deletes the file.
+	class SharedDataset {
+	public:
+		SharedDataset(const std::string& dir);
+		~SharedDataset();
+
+		SharedDataset(const SharedDataset&) = delete;
+
+		//Maps the dataset for the seed. If it doesn't exist yet, build is called
+		//to initialize getDataset(). Returns false if the dataset was built by this process.
+		bool attach(const void* seed, size_t seedSize, std::function<void()> build);
+		void detach();
+
+		randomx_dataset* getDataset() {
+			return dataset_;
+		}
+		std::string getPath() const {
+			return path_;
+		}
+
+	private:
+		int openFile(const std::string& path, int lock);
+		bool checkReady(const void* seed, size_t seedSize);
+		void map(bool writable);
+
+		std::string dir_;
+		std::string path_;
+		randomx_dataset* dataset_;
+		int fd_;
+		void* mapping_;
+		size_t mappingSize_;
+	};
+
+}
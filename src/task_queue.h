@@ -29,15 +29,48 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #pragma once
 
 #include <functional>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
 
 namespace httplib {
 
+    // the scheduling headers of a request (see Server::set_timeout_header and Server::set_client_header)
+    struct RequestInfo {
+        int64_t timeout = 0;
+        std::string client;
+    };
+
+    // timeouts are clamped to an hour, which is also the deadline of requests without a timeout
+    const int64_t max_request_timeout = 3600 * 1000;
+
+    inline int64_t parse_request_timeout(const std::string &value) {
+        auto timeout = std::strtoll(value.c_str(), nullptr, 10);
+        return std::min<int64_t>(std::max<int64_t>(timeout, 0), max_request_timeout);
+    }
+
+    template<class W>
+    struct Task {
+        std::function<void(W&)> run;
+        // answers the client instead of running the task; the arguments are the
+        // status code and the number of seconds after which the client should retry (0 = none)
+        std::function<void(int, int)> reject;
+        // peeks at the request headers without consuming them; returns false if
+        // they have not been received yet
+        std::function<bool(RequestInfo&)> peek;
+        std::string remote_addr;
+    };
+
     template<class W>
     class TaskQueue {
     public:
         TaskQueue() {}
         virtual ~TaskQueue() {}
         virtual void enqueue(std::function<void(W&)> fn) = 0;
+        virtual void enqueue(Task<W> task) {
+            enqueue(task.run);
+        }
         virtual void shutdown() = 0;
     };
 
@@ -29,30 +29,235 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "thread_pool.h"
 #include "service_worker.h"
 #include "service.h"
+#include <algorithm>
 
 namespace randomx {
 
+	WorkerPartition::WorkerPartition(ThreadPool& pool, const PartitionOptions& options) :
+		pool_(pool),
+		name_(options.name),
+		light_(options.light),
+		queue_(options.name),
+		hashes_(0),
+		busy_(0),
+		expired_(0),
+		cancelled_(0),
+		started_(0),
+		waitAvg_(0),
+		waitMax_(0),
+		rejected_(0),
+		dropped_(0)
+	{
+	}
+
+	void WorkerPartition::enqueue(std::function<void(ServiceWorker&)> fn) {
+		pool_.enqueue(*this, { fn, nullptr, nullptr });
+	}
+
+	void WorkerPartition::enqueue(httplib::Task<ServiceWorker> task) {
+		pool_.enqueue(*this, task);
+	}
+
 	ThreadPool::ThreadPool(Service& svc, size_t n) :
+		ThreadPool(svc, std::vector<PartitionOptions>{ { "default", (int)n, false, 0 } })
+	{
+	}
+
+	ThreadPool::ThreadPool(Service& svc, const std::vector<PartitionOptions>& partitions) :
 		svc_(svc),
 		shutdown_(false),
-		reseeding_(false)
+		reseeding_(false),
+		reseedLocked_(false),
+		activeWorkers_(0),
+		queueLimit_(0),
+		dropOldest_(false),
+		spinTime_(0),
+		taskGeneration_(0),
+		taskActive_(0)
 	{
-		workers_.reserve(n);
-		for (unsigned i = 0; i < n; ++i) {
-			workers_.push_back(std::make_shared<ServiceWorker>(*this, i));
-			auto t = std::make_shared<std::thread>(std::ref(*workers_.back()));
-			threads_.push_back(t);
+		unsigned n = 0;
+		for (auto& options : partitions) {
+			partitions_.emplace_back(new WorkerPartition(*this, options));
+			for (int i = 0; i < options.threads; ++i, ++n) {
+				workers_.push_back(std::make_shared<ServiceWorker>(*this, n, partitions_.back().get()));
+			}
+		}
+		activeWorkers_ = n;
+		for (auto& worker : workers_) {
+			threads_.push_back(std::make_shared<std::thread>(std::ref(*worker)));
 		}
+		control_ = std::make_shared<ServiceWorker>(*this, n, nullptr);
+		controlThread_ = std::make_shared<std::thread>(std::ref(*control_));
 	}
 
 	ThreadPool::~ThreadPool()
 	{
+		shutdown();
 	}
 
 	void ThreadPool::enqueue(std::function<void(ServiceWorker&)> fn) {
+		enqueue(*partitions_.front(), { fn, nullptr, nullptr });
+	}
+
+	void ThreadPool::enqueue(httplib::Task<ServiceWorker> task) {
+		enqueue(*partitions_.front(), task);
+	}
+
+	void ThreadPool::enqueue(WorkerPartition& partition, httplib::Task<ServiceWorker> task) {
+		std::vector<Rejection> rejected;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			bool accepted = true;
+			//jobs that can't be rejected are always accepted
+			if (queueLimit_ > 0 && partition.queue_.size() >= queueLimit_ && task.reject) {
+				int retryAfter = getRetryAfter(partition);
+				PendingJob oldest;
+				if (dropOldest_ && partition.queue_.dropLongest(oldest)) {
+					rejected.push_back({ oldest.task.reject, 503, retryAfter });
+					partition.dropped_++;
+				}
+				else {
+					rejected.push_back({ task.reject, 503, retryAfter });
+					partition.rejected_++;
+					accepted = false;
+				}
+			}
+			if (accepted) {
+				partition.queue_.push({ task, std::chrono::steady_clock::now(), std::chrono::steady_clock::time_point::max(), false, "" }, rejected);
+				wakeWorker(partition);
+				if (reseeding_) {
+					controlCond_.notify_one();
+				}
+			}
+		}
+		for (auto& rejection : rejected) {
+			rejection.reject(rejection.status, rejection.retryAfter);
+		}
+	}
+
+	void ThreadPool::enqueueBackground(WorkerPartition& partition, std::function<void(ServiceWorker&)> fn) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		partition.background_.push_back(std::move(fn));
+		wakeWorker(partition);
+	}
+
+	void ThreadPool::setQueueLimit(size_t limit, bool dropOldest) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		queueLimit_ = limit;
+		dropOldest_ = dropOldest;
+	}
+
+	std::function<void(ServiceWorker&)> ThreadPool::takeJob(WorkerPartition& partition, ServiceWorker& worker) {
+		std::vector<Rejection> rejected;
+		std::function<void(ServiceWorker&)> fn;
+		PendingJob job;
+		ClientState* client;
+		if (partition.queue_.pop(job, client, rejected)) {
+			double wait = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - job.enqueued).count();
+			partition.waitAvg_ = partition.started_ == 0 ? wait : partition.waitAvg_ + (wait - partition.waitAvg_) / 16;
+			partition.waitMax_ = std::max(partition.waitMax_, wait);
+			partition.started_++;
+			worker.client_ = client;
+			worker.clientQueue_ = &partition.queue_;
+			fn = std::move(job.task.run);
+		}
+		else if (!worker.control_ && !partition.background_.empty()) {
+			fn = std::move(partition.background_.front());
+			partition.background_.pop_front();
+		}
+		for (auto& rejection : rejected) {
+			if (rejection.status == 504) {
+				partition.expired_++;
+			}
+		}
+		if (rejected.empty()) {
+			return fn;
+		}
+		//rejected connections are answered by the worker after the pool is unlocked
+		return [rejected, fn](ServiceWorker& w) {
+			for (auto& rejection : rejected) {
+				rejection.reject(rejection.status, rejection.retryAfter);
+			}
+			if (fn) {
+				fn(w);
+			}
+		};
+	}
+
+	void ThreadPool::finishJob(ServiceWorker& worker) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		worker.clientQueue_->finish(worker.client_);
+		worker.client_ = nullptr;
+		worker.clientQueue_ = nullptr;
+	}
+
+	void ThreadPool::setClientLimits(const ClientLimits& limits) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		for (auto& partition : partitions_) {
+			partition->queue_.setLimits(limits);
+		}
+	}
+
+	bool ThreadPool::checkQuota(ServiceWorker& worker, int& retryAfter) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		return worker.client_ == nullptr || worker.clientQueue_->checkQuota(worker.client_, retryAfter);
+	}
+
+	void ThreadPool::chargeHashes(ServiceWorker& worker, uint64_t hashes) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (worker.client_ != nullptr) {
+			worker.clientQueue_->charge(worker.client_, hashes);
+		}
+	}
+
+	std::vector<ClientUsage> ThreadPool::getClientUsage(const WorkerPartition& partition) {
 		std::unique_lock<std::mutex> lock(mutex_);
-		jobs_.push_back(fn);
-		cond_.notify_one();
+		return partition.queue_.getUsage();
+	}
+
+	//a new connection waits about as long as the oldest pending connection has already waited
+	int ThreadPool::getRetryAfter(const WorkerPartition& partition) {
+		auto age = std::chrono::steady_clock::now() - partition.queue_.getOldest();
+		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(age).count();
+		return std::max<int>((int)((ms + 999) / 1000), 1);
+	}
+
+	QueueStats ThreadPool::getQueueStats(const WorkerPartition& partition) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		QueueStats stats;
+		stats.queued = partition.queue_.size();
+		stats.started = partition.started_;
+		stats.waitAvg = partition.waitAvg_;
+		stats.waitMax = partition.waitMax_;
+		stats.rejected = partition.rejected_;
+		stats.dropped = partition.dropped_;
+		stats.expired = partition.expired_;
+		stats.cancelled = partition.cancelled_;
+		return stats;
+	}
+
+	//Hands the connection over to a specific idle worker. A spinning worker
+	//notices it without a system call; a sleeping one is woken up alone.
+	void ThreadPool::wakeWorker(WorkerPartition& partition) {
+		if (partition.idle_.empty()) {
+			return;
+		}
+		//the last worker is the most likely one to be still spinning and to have a warm cache
+		auto worker = partition.idle_.back();
+		partition.idle_.pop_back();
+		worker->signaled_.store(true, std::memory_order_release);
+		if (worker->parked_) {
+			worker->wakeCond_.notify_one();
+		}
+	}
+
+	//all workers check the state of the pool again
+	void ThreadPool::notifyWorkers() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		for (auto& worker : workers_) {
+			worker->signaled_.store(true, std::memory_order_release);
+			worker->wakeCond_.notify_one();
+		}
 	}
 
 	void ThreadPool::shutdown() {
@@ -60,33 +265,180 @@ namespace randomx {
 			std::unique_lock<std::mutex> lock(mutex_);
 			shutdown_ = true;
 		}
-		cond_.notify_all();
+		notifyWorkers();
+		controlCond_.notify_all();
+		inactiveCond_.notify_all();
 		for (auto t : threads_) {
-			t->join();
+			if (t->joinable()) {
+				t->join();
+			}
+		}
+		if (controlThread_->joinable()) {
+			controlThread_->join();
+		}
+	}
+
+	void ThreadPool::pinWorkers(const std::vector<CpuInfo>& cpus) {
+		if (cpus.empty()) {
+			return;
+		}
+		for (unsigned i = 0; i < workers_.size(); ++i) {
+			auto& cpu = cpus[i % cpus.size()];
+			if (setThreadAffinity(*threads_[i], cpu.cpu)) {
+				workers_[i]->node_ = cpu.node;
+			}
+		}
+	}
+
+	std::vector<int> ThreadPool::getNodes() const {
+		std::vector<int> nodes;
+		for (auto& worker : workers_) {
+			if (worker->node_ >= 0 && std::find(nodes.begin(), nodes.end(), worker->node_) == nodes.end()) {
+				nodes.push_back(worker->node_);
+			}
+		}
+		std::sort(nodes.begin(), nodes.end());
+		return nodes;
+	}
+
+	void ThreadPool::runParallel(ServiceWorker* self, std::function<void(ServiceWorker*)> task) {
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			task_ = task;
+			taskGeneration_++;
+		}
+		notifyWorkers();
+		inactiveCond_.notify_all();
+		task(self);
+		//workers that wake up after this point will skip the task
+		std::unique_lock<std::mutex> lock(mutex_);
+		task_ = nullptr;
+		taskCond_.wait(lock, [&] { return taskActive_ == 0; });
+	}
+
+	unsigned ThreadPool::getParallelThreads(ServiceWorker* self) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		unsigned threads = 1;
+		for (auto& worker : workers_) {
+			if (worker.get() != self && !worker->standby_) {
+				threads++;
+			}
+		}
+		return threads;
+	}
+
+	void ThreadPool::park(ServiceWorker& worker) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		worker.standby_ = true;
+		std::unique_lock<std::mutex> workerLock(worker.mutex_);
+		worker.idle_ = true;
+		worker.cond_.notify_one();
+	}
+
+	void ThreadPool::unpark(ServiceWorker& worker) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		reseedCond_.wait(lock, [&] { return !reseeding_; });
+		worker.standby_ = false;
+		std::unique_lock<std::mutex> workerLock(worker.mutex_);
+		worker.idle_ = false;
+	}
+
+	void ThreadPool::lockReseed() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		reseedCond_.wait(lock, [&] { return !reseeding_ && !reseedLocked_; });
+		reseedLocked_ = true;
+	}
+
+	void ThreadPool::unlockReseed() {
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			reseedLocked_ = false;
 		}
+		reseedCond_.notify_all();
 	}
 
-	void ThreadPool::reseed(ServiceWorker& self, const void* seed, size_t length) {
+	void ThreadPool::reseed(ServiceWorker& self, const void* seed, size_t length, std::function<bool()> current) {
+		reseed(&self, seed, length, std::move(current));
+	}
+
+	void ThreadPool::reseed(const void* seed, size_t length, std::function<bool()> current) {
+		reseed(nullptr, seed, length, std::move(current));
+	}
+
+	void ThreadPool::reseed(ServiceWorker* self, const void* seed, size_t length, std::function<bool()> current) {
+		runExclusive(self, [&] {
+			if (current && !current()) {
+				return;
+			}
+			//reinitialize the cache and dataset
+			svc_.reinit(self, seed, length);
+			//refresh workers
+			for (auto& worker : workers_) {
+				svc_.refreshMachine(worker->vm_, worker->partition_->light_);
+			}
+		});
+	}
+
+	void ThreadPool::runExclusive(ServiceWorker* self, std::function<void()> fn) {
 		//set the reseed variable; this stops pending requests from being processed
+		if (self != nullptr) {
+			park(*self);
+		}
 		{
 			std::unique_lock<std::mutex> lock(mutex_);
+			//another reseed may be in progress
+			reseedCond_.wait(lock, [&] { return !reseeding_ && !reseedLocked_; });
 			reseeding_ = true;
 		}
+		//pending requests are passed to the control worker
+		controlCond_.notify_one();
 		//wait until all workers are idle (except of the worker who is running this code)
 		for (auto& worker : workers_) {
-			if (&self != worker.get()) {
+			if (self != worker.get()) {
 				worker->waitIdle();
 			}
 		}
-		//reinitialize the cache and dataset
-		svc_.reinitCache(seed, length);
-		svc_.reinitDataset();
-		//refresh workers
+		fn();
+		//notify workers
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			reseeding_ = false;
+		}
+		notifyWorkers();
+		reseedCond_.notify_all();
+		if (self != nullptr) {
+			unpark(*self);
+		}
+	}
+
+	void ThreadPool::recreateMachines() {
+		for (auto& worker : workers_) {
+			if (worker->vm_ != nullptr) {
+				svc_.destroyMachine(worker->vm_);
+			}
+			worker->vm_ = svc_.createMachine(worker->partition_->light_);
+		}
+	}
+
+	void ThreadPool::releaseMachines() {
 		for (auto& worker : workers_) {
-			svc_.refreshMachine(worker->vm_);
+			if (worker->vm_ != nullptr) {
+				svc_.destroyMachine(worker->vm_);
+				worker->vm_ = nullptr;
+			}
 		}
-		//notify workers
-		reseeding_ = false;
-		cond_.notify_all();
+	}
+
+	void ThreadPool::setSpinTime(unsigned microseconds) {
+		spinTime_ = microseconds;
+	}
+
+	void ThreadPool::setActiveWorkers(size_t n) {
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			activeWorkers_ = std::min(std::max<size_t>(n, 1), workers_.size());
+		}
+		notifyWorkers();
+		inactiveCond_.notify_all();
 	}
 }
\ No newline at end of file
@@ -29,28 +29,137 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #pragma once
 
 #include "task_queue.h"
+#include "cpu_topology.h"
+#include "partition.h"
+#include "client_queue.h"
 #include <vector>
-#include <list>
+#include <deque>
 #include <memory>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <cstdint>
+#include <atomic>
+#include <string>
 
 namespace randomx {
 
 	class Service;
 	class ServiceWorker;
+	class ThreadPool;
+
+	struct QueueStats {
+		size_t queued;
+		uint64_t started;
+		double waitAvg; //moving average in milliseconds
+		double waitMax;
+		uint64_t rejected;
+		uint64_t dropped;
+		uint64_t expired;
+		uint64_t cancelled;
+	};
+
+	//a group of workers with its own queue of connections
+	struct WorkerPartition : public httplib::TaskQueue<ServiceWorker> {
+		WorkerPartition(ThreadPool& pool, const PartitionOptions& options);
+
+		virtual void enqueue(std::function<void(ServiceWorker&)> fn) override;
+		virtual void enqueue(httplib::Task<ServiceWorker> task) override;
+		//the pool is shut down by the main server
+		virtual void shutdown() override {}
+
+		ThreadPool& pool_;
+		std::string name_;
+		bool light_;
+		ClientQueue queue_;
+		//workers waiting for a connection; the last one is woken up first
+		std::vector<ServiceWorker*> idle_;
+		//work that is done only when no connections are waiting
+		std::deque<std::function<void(ServiceWorker&)>> background_;
+		std::atomic<uint64_t> hashes_;
+		std::atomic<unsigned> busy_;
+		//requests that were not processed because their deadline passed or the client disconnected
+		std::atomic<uint64_t> expired_;
+		std::atomic<uint64_t> cancelled_;
+		//queue statistics are guarded by the pool mutex
+		uint64_t started_;
+		double waitAvg_;
+		double waitMax_;
+		uint64_t rejected_;
+		uint64_t dropped_;
+	};
 
 	class ThreadPool : public httplib::TaskQueue<ServiceWorker> {
 	public:
 		ThreadPool(Service& server, size_t n);
+		ThreadPool(Service& server, const std::vector<PartitionOptions>& partitions);
 
 		ThreadPool(const ThreadPool&) = delete;
 		virtual ~ThreadPool();
 
+		//jobs are processed by the first partition unless they are enqueued to a specific partition
 		virtual void enqueue(std::function<void(ServiceWorker&)> fn) override;
+		virtual void enqueue(httplib::Task<ServiceWorker> task) override;
+		//waiting connections are shared among clients (see ClientQueue); connections whose deadline has passed are rejected
+		void enqueue(WorkerPartition& partition, httplib::Task<ServiceWorker> task);
+		//runs the function on a worker of the partition when no connections are waiting
+		void enqueueBackground(WorkerPartition& partition, std::function<void(ServiceWorker&)> fn);
+
+		//limits the number of connections waiting in each partition; when the queue is full,
+		//either the new connection or the oldest pending connection is rejected (0 = unlimited)
+		void setQueueLimit(size_t limit, bool dropOldest);
+
+		//sets how clients are identified for fair scheduling and their limits in all partitions
+		void setClientLimits(const ClientLimits& limits);
+		//returns false if the client of the connection has exceeded its hash rate quota
+		bool checkQuota(ServiceWorker& worker, int& retryAfter);
+		//charges the client of the connection for calculated hashes
+		void chargeHashes(ServiceWorker& worker, uint64_t hashes);
+		std::vector<ClientUsage> getClientUsage(const WorkerPartition& partition);
+
+		//the reseed is skipped if current returns false once the workers are idle
+		void reseed(ServiceWorker& self, const void* seed, size_t length, std::function<bool()> current = nullptr);
+		void reseed(const void* seed, size_t length, std::function<bool()> current = nullptr);
+
+		//prevents reseeding while the dataset is being read by another thread
+		void lockReseed();
+		void unlockReseed();
+
+		//a parked worker is treated as idle and doesn't block reseeding; it must not use its VM until unparked
+		void park(ServiceWorker& worker);
+		void unpark(ServiceWorker& worker);
+
+		//runs the task on all idle workers and on the calling thread; may only be called while reseeding
+		void runParallel(ServiceWorker* self, std::function<void(ServiceWorker*)> task);
+		//the number of threads that run a parallel task; parked workers don't take part
+		unsigned getParallelThreads(ServiceWorker* self);
+
+		//stops processing requests, waits until all workers are idle and runs the function on the calling thread;
+		//pending requests are passed to the control worker in the meantime
+		void runExclusive(ServiceWorker* self, std::function<void()> fn);
+
+		//creates new VMs for all workers; may only be called from runExclusive
+		void recreateMachines();
+
+		//destroys the VMs of all workers, which then answer hash requests like the control worker; may only be called from runExclusive
+		void releaseMachines();
+
+		//only workers with a lower id process requests; the others still take part in parallel tasks
+		void setActiveWorkers(size_t n);
+
+		//idle workers spin for this number of microseconds before they sleep (0 = sleep immediately)
+		void setSpinTime(unsigned microseconds);
+
+		size_t getPartitionCount() const {
+			return partitions_.size();
+		}
+		WorkerPartition& getPartition(size_t index) {
+			return *partitions_[index];
+		}
+		QueueStats getQueueStats(const WorkerPartition& partition);
 
-		void reseed(ServiceWorker& self, const void* seed, size_t length);
+		void pinWorkers(const std::vector<CpuInfo>& cpus);
+		std::vector<int> getNodes() const;
 
 		virtual void shutdown() override;
 
@@ -60,16 +169,38 @@ namespace randomx {
 
 	private:
 		friend struct ServiceWorker;
+		friend struct WorkerPartition;
+
+		void reseed(ServiceWorker* self, const void* seed, size_t length, std::function<bool()> current);
+		void notifyWorkers();
+		void wakeWorker(WorkerPartition& partition);
+		std::function<void(ServiceWorker&)> takeJob(WorkerPartition& partition, ServiceWorker& worker);
+		void finishJob(ServiceWorker& worker);
+		int getRetryAfter(const WorkerPartition& partition);
 
 		Service& svc_;
 		std::vector<std::shared_ptr<std::thread>> threads_;
 		std::vector<std::shared_ptr<ServiceWorker>> workers_;
-		std::list<std::function<void(ServiceWorker&)>> jobs_;
+		std::shared_ptr<ServiceWorker> control_;
+		std::shared_ptr<std::thread> controlThread_;
+		std::vector<std::unique_ptr<WorkerPartition>> partitions_;
 
 		bool shutdown_;
 		bool reseeding_;
+		bool reseedLocked_;
+		size_t activeWorkers_;
+		size_t queueLimit_;
+		bool dropOldest_;
+		std::atomic<unsigned> spinTime_;
+
+		std::function<void(ServiceWorker*)> task_;
+		uint64_t taskGeneration_;
+		unsigned taskActive_;
+		std::condition_variable taskCond_;
+		std::condition_variable reseedCond_;
+		std::condition_variable controlCond_;
+		std::condition_variable inactiveCond_;
 
-		std::condition_variable cond_;
 		std::mutex mutex_;
 	};
 
@@ -0,0 +1,317 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "upgrade.h"
+#include "service.h"
+#include "../RandomX/src/randomx.h"
+#include "dataset_wrapper.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <cerrno>
+#endif
+
+namespace randomx {
+
+	static const char upgradeMagic[8] = { 'R', 'X', 'U', 'P', 'G', 'R', 'A', 'D' };
+	static const uint32_t upgradeVersion = 1;
+
+	struct UpgradeMessage {
+		char magic[8];
+		uint32_t version;
+		uint32_t initialized;
+		uint64_t datasetSize;
+		char algorithm[8];
+		uint32_t hasDataset;
+		uint32_t seedSize;
+		char seed[60];
+	};
+
+	static uint64_t getDatasetSize() {
+		return (uint64_t)randomx_dataset_item_count() * RANDOMX_DATASET_ITEM_SIZE;
+	}
+
+#if defined(__linux__)
+	int startUpgrade(const std::vector<std::string>& args) {
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+			return -1;
+		}
+		//everything the child needs is prepared before fork, because only
+		//async-signal-safe functions may be called in the child
+		auto childFd = std::to_string(fds[1]);
+		std::vector<char*> argv;
+		for (size_t i = 0; i < args.size(); ++i) {
+			//skip the option from a previous upgrade
+			if (args[i] == "-upgrade-fd") {
+				i++;
+				continue;
+			}
+			argv.push_back((char*)args[i].c_str());
+		}
+		argv.push_back((char*)"-upgrade-fd");
+		argv.push_back((char*)childFd.c_str());
+		argv.push_back(nullptr);
+		struct rlimit limit;
+		int maxFd = getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY ? (int)limit.rlim_cur : 65536;
+
+		pid_t pid = fork();
+		if (pid < 0) {
+			close(fds[0]);
+			close(fds[1]);
+			return -1;
+		}
+		if (pid == 0) {
+			//don't leak client connections and other files to the new process
+			for (int fd = 3; fd < maxFd; ++fd) {
+				if (fd != fds[1]) {
+					close(fd);
+				}
+			}
+			//the upgrade signal stays blocked, it's handled by the new process too
+			fcntl(fds[1], F_SETFD, 0);
+			execvp(argv[0], argv.data());
+			_exit(127);
+		}
+		close(fds[1]);
+		return fds[0];
+	}
+
+	bool sendUpgradeState(int sock, const UpgradeState& state) {
+		UpgradeMessage message;
+		memset(&message, 0, sizeof(message));
+		if (state.seed.size() > sizeof(message.seed)) {
+			return false;
+		}
+		memcpy(message.magic, upgradeMagic, sizeof(upgradeMagic));
+		message.version = upgradeVersion;
+		message.initialized = state.initialized;
+		message.datasetSize = getDatasetSize();
+		strncpy(message.algorithm, SERVICE_ALGORITHM, sizeof(message.algorithm));
+		message.hasDataset = state.datasetFd >= 0;
+		message.seedSize = (uint32_t)state.seed.size();
+		memcpy(message.seed, state.seed.data(), state.seed.size());
+
+		int fds[2] = { state.listenFd, state.datasetFd };
+		int fdCount = message.hasDataset ? 2 : 1;
+		char control[CMSG_SPACE(sizeof(fds))];
+		memset(control, 0, sizeof(control));
+		struct iovec iov = { &message, sizeof(message) };
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * fdCount);
+		auto* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fdCount);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fdCount);
+		return sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t)sizeof(message);
+	}
+
+	bool receiveUpgradeState(int sock, UpgradeState& state) {
+		UpgradeMessage message;
+		int fds[2] = { -1, -1 };
+		char control[CMSG_SPACE(sizeof(fds))];
+		struct iovec iov = { &message, sizeof(message) };
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		ssize_t size = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+		for (auto* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+				memcpy(fds, CMSG_DATA(cmsg), std::min(sizeof(fds), (size_t)(cmsg->cmsg_len - CMSG_LEN(0))));
+			}
+		}
+		bool ok = size == (ssize_t)sizeof(message)
+			&& memcmp(message.magic, upgradeMagic, sizeof(upgradeMagic)) == 0
+			&& message.version == upgradeVersion
+			&& message.seedSize <= sizeof(message.seed)
+			&& fds[0] >= 0;
+		if (!ok) {
+			for (int fd : fds) {
+				if (fd >= 0) {
+					close(fd);
+				}
+			}
+			return false;
+		}
+		state.listenFd = fds[0];
+		state.initialized = message.initialized != 0;
+		state.seed.assign(message.seed, message.seedSize);
+		//the dataset can only be reused if the algorithm hasn't changed
+		bool compatible = message.hasDataset
+			&& message.datasetSize == getDatasetSize()
+			&& strncmp(message.algorithm, SERVICE_ALGORITHM, sizeof(message.algorithm)) == 0;
+		if (compatible) {
+			state.datasetFd = fds[1];
+		}
+		else if (fds[1] >= 0) {
+			close(fds[1]);
+		}
+		return true;
+	}
+
+	int copyDataset(randomx_dataset* dataset) {
+		auto size = getDatasetSize();
+		int fd = memfd_create("randomx-dataset", MFD_CLOEXEC);
+		if (fd < 0) {
+			return -1;
+		}
+		if (ftruncate(fd, size) != 0) {
+			close(fd);
+			return -1;
+		}
+		auto* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (memory == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		memcpy(memory, randomx_get_dataset_memory(dataset), size);
+		munmap(memory, size);
+		return fd;
+	}
+
+	static void unmapDataset(randomx_dataset* dataset) {
+		munmap(randomx_get_dataset_memory(dataset), getDatasetSize());
+	}
+
+	randomx_dataset* mapDataset(int fd) {
+		struct stat st;
+		auto size = getDatasetSize();
+		if (fstat(fd, &st) != 0 || (uint64_t)st.st_size != size) {
+			return nullptr;
+		}
+		auto* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (memory == MAP_FAILED) {
+			return nullptr;
+		}
+		return wrapDataset(memory, &unmapDataset);
+	}
+
+	bool sendUpgradeReady(int sock) {
+		char ready = 1;
+		bool ok = send(sock, &ready, 1, MSG_NOSIGNAL) == 1;
+		close(sock);
+		return ok;
+	}
+
+	bool waitUpgradeReady(int sock) {
+		char ready = 0;
+		bool ok = recv(sock, &ready, 1, 0) == 1 && ready == 1;
+		close(sock);
+		return ok;
+	}
+
+	void closeDescriptor(int fd) {
+		close(fd);
+	}
+
+	static sigset_t getUpgradeSignals() {
+		sigset_t signals;
+		sigemptyset(&signals);
+		sigaddset(&signals, SIGUSR2);
+		return signals;
+	}
+
+	void UpgradeSignal::block() {
+		auto signals = getUpgradeSignals();
+		pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+	}
+
+	UpgradeSignal::UpgradeSignal(std::function<void()> handler) : stop_(false) {
+		thread_ = std::thread([this, handler] {
+			auto signals = getUpgradeSignals();
+			int signal;
+			while (sigwait(&signals, &signal) == 0 && !stop_) {
+				handler();
+			}
+		});
+	}
+
+	UpgradeSignal::~UpgradeSignal() {
+		stop_ = true;
+		pthread_kill(thread_.native_handle(), SIGUSR2);
+		thread_.join();
+	}
+#else
+	int startUpgrade(const std::vector<std::string>& args) {
+		return -1;
+	}
+
+	bool sendUpgradeState(int sock, const UpgradeState& state) {
+		return false;
+	}
+
+	bool receiveUpgradeState(int sock, UpgradeState& state) {
+		return false;
+	}
+
+	int copyDataset(randomx_dataset* dataset) {
+		return -1;
+	}
+
+	randomx_dataset* mapDataset(int fd) {
+		return nullptr;
+	}
+
+	bool sendUpgradeReady(int sock) {
+		return false;
+	}
+
+	bool waitUpgradeReady(int sock) {
+		return false;
+	}
+
+	void closeDescriptor(int fd) {
+	}
+
+	void UpgradeSignal::block() {
+	}
+
+	UpgradeSignal::UpgradeSignal(std::function<void()> handler) : stop_(false) {
+	}
+
+	UpgradeSignal::~UpgradeSignal() {
+	}
+#endif
+}
@@ -0,0 +1,80 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+struct randomx_dataset;
+
+namespace randomx {
+
+	//The state passed from a running service to its replacement.
+	struct UpgradeState {
+		UpgradeState() : listenFd(-1), datasetFd(-1), initialized(false) {}
+		int listenFd;
+		int datasetFd;
+		bool initialized;
+		std::string seed;
+	};
+
+	//Starts a new instance of the service with the same command line and
+	//an additional "-upgrade-fd" option. Returns the socket connected to it or -1.
+	int startUpgrade(const std::vector<std::string>& args);
+
+	bool sendUpgradeState(int sock, const UpgradeState& state);
+	bool receiveUpgradeState(int sock, UpgradeState& state);
+
+	//Copies the dataset to a memory file that can be passed to another process.
+	int copyDataset(randomx_dataset* dataset);
+	//Maps a dataset received from another process. The dataset is released with randomx_release_dataset.
+	randomx_dataset* mapDataset(int fd);
+
+	//Sent by the new process when it's ready to accept connections. Both functions close the socket.
+	bool sendUpgradeReady(int sock);
+	bool waitUpgradeReady(int sock);
+
+	void closeDescriptor(int fd);
+
+	//Calls the handler on a separate thread when the process receives SIGUSR2.
+	class UpgradeSignal {
+	public:
+		UpgradeSignal(std::function<void()> handler);
+		~UpgradeSignal();
+		//must be called before any other threads are started
+		static void block();
+	private:
+		std::thread thread_;
+		std::atomic<bool> stop_;
+	};
+
+}
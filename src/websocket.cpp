@@ -0,0 +1,292 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "websocket.h"
+#include <algorithm>
+#include <cctype>
+
+namespace randomx {
+
+	static const char* const AcceptGuid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+	static inline uint32_t rotl(uint32_t x, int c) {
+		return (x << c) | (x >> (32 - c));
+	}
+
+	//only used for the handshake
+	static std::string sha1(const std::string& input) {
+		uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+		std::string data = input;
+		uint64_t bits = (uint64_t)input.size() * 8;
+		data += (char)0x80;
+		while (data.size() % 64 != 56) {
+			data += '\0';
+		}
+		for (int i = 7; i >= 0; --i) {
+			data += (char)(bits >> (8 * i));
+		}
+		for (size_t chunk = 0; chunk < data.size(); chunk += 64) {
+			auto bytes = (const uint8_t*)data.data() + chunk;
+			uint32_t w[80];
+			for (int i = 0; i < 16; ++i) {
+				w[i] = ((uint32_t)bytes[4 * i] << 24) | (bytes[4 * i + 1] << 16) | (bytes[4 * i + 2] << 8) | bytes[4 * i + 3];
+			}
+			for (int i = 16; i < 80; ++i) {
+				w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+			}
+			uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+			for (int i = 0; i < 80; ++i) {
+				uint32_t f, k;
+				if (i < 20) {
+					f = (b & c) | (~b & d);
+					k = 0x5A827999;
+				}
+				else if (i < 40) {
+					f = b ^ c ^ d;
+					k = 0x6ED9EBA1;
+				}
+				else if (i < 60) {
+					f = (b & c) | (b & d) | (c & d);
+					k = 0x8F1BBCDC;
+				}
+				else {
+					f = b ^ c ^ d;
+					k = 0xCA62C1D6;
+				}
+				uint32_t temp = rotl(a, 5) + f + e + k + w[i];
+				e = d;
+				d = c;
+				c = rotl(b, 30);
+				b = a;
+				a = temp;
+			}
+			h[0] += a;
+			h[1] += b;
+			h[2] += c;
+			h[3] += d;
+			h[4] += e;
+		}
+		std::string digest;
+		for (int i = 0; i < 20; ++i) {
+			digest += (char)(h[i / 4] >> (24 - 8 * (i % 4)));
+		}
+		return digest;
+	}
+
+	//checks if a comma-separated header value contains the token (case-insensitive)
+	static bool hasToken(const std::string& value, const char* token) {
+		size_t pos = 0;
+		while (pos <= value.size()) {
+			auto end = value.find(',', pos);
+			if (end == std::string::npos) {
+				end = value.size();
+			}
+			auto begin = value.find_first_not_of(' ', pos);
+			auto last = value.find_last_not_of(' ', end - 1);
+			if (begin < end && last != std::string::npos && last >= begin) {
+				std::string item = value.substr(begin, last - begin + 1);
+				std::transform(item.begin(), item.end(), item.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+				if (item == token) {
+					return true;
+				}
+			}
+			pos = end + 1;
+		}
+		return false;
+	}
+
+	WebSocketSession::WebSocketSession(WebSocketHub& hub, socket_t sock, MessageHandler handler) :
+		HubConnection(hub, sock, MaxPending),
+		sessions_(hub),
+		handler_(std::move(handler)),
+		fragmented_(false)
+	{
+	}
+
+	bool WebSocketSession::send(const std::string& message, bool wait) {
+		return sendFrame(0x2, message.data(), message.size(), wait);
+	}
+
+	bool WebSocketSession::sendFrame(uint8_t opcode, const char* data, size_t size, bool wait) {
+		std::string frame;
+		frame.reserve(size + 10);
+		frame += (char)(0x80 | opcode);
+		if (size < 126) {
+			frame += (char)size;
+		}
+		else if (size < 65536) {
+			frame += (char)126;
+			frame += (char)(size >> 8);
+			frame += (char)size;
+		}
+		else {
+			frame += (char)127;
+			for (int i = 7; i >= 0; --i) {
+				frame += (char)((uint64_t)size >> (8 * i));
+			}
+		}
+		frame.append(data, size);
+		return write(frame, wait);
+	}
+
+	void WebSocketSession::close(uint16_t code) {
+		char payload[2] = { (char)(code >> 8), (char)code };
+		sendFrame(0x8, payload, sizeof(payload), false);
+		shutdown();
+	}
+
+	//Passes the complete messages in the input buffer to the handler. Returns false if the
+	//session has been closed.
+	bool WebSocketSession::parse(const std::shared_ptr<HubConnection>& self) {
+		size_t maxMessage = sessions_.getMaxMessage();
+		size_t pos = 0;
+		while (!closed_ && accepting()) {
+			size_t available = input_.size() - pos;
+			if (available < 2) {
+				break;
+			}
+			auto p = (const uint8_t*)input_.data() + pos;
+			bool fin = (p[0] & 0x80) != 0;
+			uint8_t opcode = p[0] & 0x0f;
+			uint64_t length = p[1] & 0x7f;
+			size_t header = 2;
+			if (length == 126) {
+				if (available < 4) {
+					break;
+				}
+				length = (p[2] << 8) | p[3];
+				header = 4;
+			}
+			else if (length == 127) {
+				if (available < 10) {
+					break;
+				}
+				length = 0;
+				for (int i = 0; i < 8; ++i) {
+					length = (length << 8) | p[2 + i];
+				}
+				header = 10;
+			}
+			//client frames must be masked and no extensions are negotiated
+			if ((p[0] & 0x70) || !(p[1] & 0x80)) {
+				close(1002);
+				return false;
+			}
+			bool control = (opcode & 0x08) != 0;
+			if (control && (!fin || length > 125)) {
+				close(1002);
+				return false;
+			}
+			if (!control && length > maxMessage - std::min(maxMessage, message_.size())) {
+				close(1009);
+				return false;
+			}
+			header += 4;
+			if (available < header || available - header < length) {
+				break;
+			}
+			auto mask = p + header - 4;
+			std::string payload((const char*)p + header, (size_t)length);
+			for (size_t i = 0; i < payload.size(); ++i) {
+				payload[i] ^= mask[i % 4];
+			}
+			pos += header + (size_t)length;
+			switch (opcode) {
+			case 0x0:
+				if (!fragmented_) {
+					close(1002);
+					return false;
+				}
+				message_ += payload;
+				break;
+			case 0x1:
+				//only binary messages are supported
+				close(1003);
+				return false;
+			case 0x2:
+				if (fragmented_) {
+					close(1002);
+					return false;
+				}
+				message_ = std::move(payload);
+				fragmented_ = true;
+				break;
+			case 0x8:
+				//the close frame is echoed with the status code of the client
+				sendFrame(0x8, payload.data(), std::min<size_t>(payload.size(), 2), false);
+				shutdown();
+				return false;
+			case 0x9:
+				sendFrame(0xA, payload.data(), payload.size(), false);
+				continue;
+			case 0xA:
+				continue;
+			default:
+				close(1002);
+				return false;
+			}
+			if (fin) {
+				fragmented_ = false;
+				pending_++;
+				std::string message;
+				message.swap(message_);
+				handler_(std::static_pointer_cast<WebSocketSession>(self), std::move(message));
+			}
+		}
+		input_.erase(0, pos);
+		return !closed_;
+	}
+
+	WebSocketHub::WebSocketHub() :
+		maxMessage_(65536)
+	{
+	}
+
+	bool WebSocketHub::getAcceptKey(const httplib::Request& req, std::string& acceptKey) {
+		auto key = req.get_header_value("Sec-WebSocket-Key");
+		if (!hasToken(req.get_header_value("Upgrade"), "websocket") || !hasToken(req.get_header_value("Connection"), "upgrade") ||
+			req.get_header_value("Sec-WebSocket-Version") != "13" || key.size() != 24) {
+			return false;
+		}
+		acceptKey = httplib::detail::base64_encode(sha1(key + AcceptGuid));
+		return true;
+	}
+
+	std::shared_ptr<WebSocketSession> WebSocketHub::add(socket_t sock, WebSocketSession::MessageHandler handler) {
+		auto session = std::make_shared<WebSocketSession>(*this, sock, std::move(handler));
+		return ConnectionHub::add(session) ? session : nullptr;
+	}
+
+	void WebSocketHub::broadcast(const std::string& message) {
+		for (auto& connection : getConnections()) {
+			std::static_pointer_cast<WebSocketSession>(connection)->send(message, false);
+		}
+	}
+
+}
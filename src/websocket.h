@@ -0,0 +1,87 @@
+/*
+Copyright (c) 2020, tevador <tevador@gmail.com>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+	* Neither the name of the copyright holder nor the
+	  names of its contributors may be used to endorse or promote products
+	  derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <string>
+#include <cstdint>
+#include "connection_hub.h"
+
+namespace randomx {
+
+	class WebSocketHub;
+
+	//A connection that has been upgraded to the WebSocket protocol (RFC 6455).
+	class WebSocketSession : public HubConnection {
+	public:
+		using MessageHandler = std::function<void(const std::shared_ptr<WebSocketSession>& session, std::string&& message)>;
+		//the number of messages a client may send before the first one is answered
+		static const unsigned MaxPending = 16;
+
+		WebSocketSession(WebSocketHub& hub, socket_t sock, MessageHandler handler);
+		//sends a binary message (see HubConnection::write)
+		bool send(const std::string& message, bool wait = true);
+	protected:
+		virtual bool parse(const std::shared_ptr<HubConnection>& self) override;
+		virtual void goAway() override {
+			close(1001);
+		}
+	private:
+		bool sendFrame(uint8_t opcode, const char* data, size_t size, bool wait);
+		void close(uint16_t code);
+
+		WebSocketHub& sessions_;
+		MessageHandler handler_;
+		std::string message_;
+		bool fragmented_;
+	};
+
+	class WebSocketHub : public ConnectionHub {
+	public:
+		WebSocketHub();
+		//checks the handshake request and returns the value of the Sec-WebSocket-Accept header
+		static bool getAcceptKey(const httplib::Request& req, std::string& acceptKey);
+		//returns null if there are too many sessions; the socket is closed in that case
+		std::shared_ptr<WebSocketSession> add(socket_t sock, WebSocketSession::MessageHandler handler);
+		//sends the message to all sessions without waiting
+		void broadcast(const std::string& message);
+		void setMaxMessage(size_t size) {
+			maxMessage_ = size;
+		}
+		size_t getMaxMessage() const {
+			return maxMessage_.load();
+		}
+	private:
+		std::atomic<size_t> maxMessage_;
+	};
+
+}